@@ -1,8 +1,8 @@
 #include "kaleidoscope/codegen.hpp"
 #include "kaleidoscope/lexer.hpp"
 #include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
 
-#include <fstream>
 #include <iostream>
 
 using kaleidoscope::CodeGenerationError;
@@ -11,6 +11,7 @@ using kaleidoscope::Error;
 using kaleidoscope::Lexer;
 using kaleidoscope::ParseError;
 using kaleidoscope::Parser;
+using kaleidoscope::SourceBuffer;
 
 namespace
 {
@@ -80,6 +81,8 @@ namespace
             case kaleidoscope::tok_eof:
                 codegen.DumpCode();
                 return;
+            case kaleidoscope::tok_memo:
+            case kaleidoscope::tok_fastmath:
             case kaleidoscope::tok_def:
                 codegen.HandleDefinition(p);
                 break;
@@ -100,12 +103,8 @@ namespace
         }
     }
 
-    void MainParse(std::istream &in)
+    void MainParse(Lexer &lexer)
     {
-        using kaleidoscope::Lexer;
-        using kaleidoscope::Parser;
-
-        Lexer lexer(in);
         Parser parser(lexer);
 
         std::cerr << "ready> " << std::flush;
@@ -119,11 +118,21 @@ int main(int argc, char *argv[])
 {
     if (argc > 1)
     {
-        std::ifstream in(argv[1]);
-        MainParse(in);
+        try
+        {
+            auto source = SourceBuffer::fromFile(argv[1]);
+            Lexer lexer(source.getText());
+            MainParse(lexer);
+        }
+        catch (Error const &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
     }
     else
     {
-        MainParse(std::cin);
+        Lexer lexer(std::cin);
+        MainParse(lexer);
     }
 }
@@ -1,20 +1,23 @@
 #include "kaleidoscope/codegen.hpp"
 #include "kaleidoscope/lexer.hpp"
 #include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
 #include "kaleidoscope/jit.hpp"
 
 #include <llvm/Support/Error.h>
 
-#include <fstream>
+#include <cstring>
 #include <iostream>
 
 using kaleidoscope::CodeGenerationError;
 using kaleidoscope::CodeGenerator;
+using kaleidoscope::DebugLevel;
 using kaleidoscope::Error;
 using kaleidoscope::KaleidoscopeJIT;
 using kaleidoscope::Lexer;
 using kaleidoscope::ParseError;
 using kaleidoscope::Parser;
+using kaleidoscope::SourceBuffer;
 
 namespace
 {
@@ -48,9 +51,9 @@ namespace
         }
 
     public:
-        DebugInfoHandler(Parser &p)
+        DebugInfoHandler(Parser &p, DebugLevel debugLevel)
             : jit_(ExitOnErr(KaleidoscopeJIT::Create())),
-              codegen_(p, jit_->getDataLayout(), "module", false)
+              codegen_(p, jit_->getDataLayout(), "module", debugLevel)
         {
         }
 
@@ -82,9 +85,9 @@ namespace
     };
 
     /// top ::= definition | external | expression | ';'
-    static void MainLoop(Parser &p)
+    static void MainLoop(Parser &p, DebugLevel debugLevel)
     {
-        DebugInfoHandler handler(p);
+        DebugInfoHandler handler(p, debugLevel);
 
         while (true)
         {
@@ -93,6 +96,8 @@ namespace
             case kaleidoscope::tok_eof:
                 handler.DumpCode();
                 return;
+            case kaleidoscope::tok_memo:
+            case kaleidoscope::tok_fastmath:
             case kaleidoscope::tok_def:
                 handler.HandleDefinition(p);
                 break;
@@ -113,32 +118,48 @@ namespace
         }
     }
 
-    void MainParse(std::istream &in)
+    void MainParse(Lexer &lexer, DebugLevel debugLevel)
     {
-        using kaleidoscope::Lexer;
-        using kaleidoscope::Parser;
-
-        Lexer lexer(in);
         Parser parser(lexer);
 
         parser.getNextToken();
 
-        MainLoop(parser);
+        MainLoop(parser, debugLevel);
     }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc > 1)
+    // debug_test -gline-tables-only [files]: line locations without types and variables
+    auto debugLevel = DebugLevel::Full;
+    int first = 1;
+
+    if (argc > 1 && std::strcmp(argv[1], "-gline-tables-only") == 0)
+    {
+        debugLevel = DebugLevel::LineTablesOnly;
+        ++first;
+    }
+
+    if (argc > first)
     {
-        for (int i = 1; i < argc; ++i)
+        for (int i = first; i < argc; ++i)
         {
-            std::ifstream in(argv[i]);
-            MainParse(in);
+            try
+            {
+                auto source = SourceBuffer::fromFile(argv[i]);
+                Lexer lexer(source.getText());
+                MainParse(lexer, debugLevel);
+            }
+            catch (Error const &e)
+            {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
         }
     }
     else
     {
-        MainParse(std::cin);
+        Lexer lexer(std::cin);
+        MainParse(lexer, debugLevel);
     }
 }
@@ -0,0 +1,285 @@
+#include "kaleidoscope/codegen.hpp"
+#include "kaleidoscope/lexer.hpp"
+#include "kaleidoscope/objcode.hpp"
+#include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/raw_ostream.h>
+
+using kaleidoscope::CodeGenerator;
+using kaleidoscope::DebugLevel;
+using kaleidoscope::Lexer;
+using kaleidoscope::ObjCodeWriter;
+using kaleidoscope::Parser;
+using kaleidoscope::SourceBuffer;
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // calls of operator new, LLVM's included
+    std::atomic<std::size_t> allocations{0};
+
+    // x + 1 * x - 2 / x + 3 < ... : a long chain of mixed-precedence operators
+    std::string operatorChain(std::size_t terms)
+    {
+        static char const ops[] = {'+', '*', '-', '/', '+', '<'};
+
+        std::string body = "x";
+        for (std::size_t i = 1; i < terms; ++i)
+        {
+            body += ' ';
+            body += ops[i % sizeof ops];
+            body += ' ';
+            body += (i % 2 == 0) ? "x" : std::to_string(i);
+        }
+
+        return "def chain(x) " + body + ";\n";
+    }
+
+    // (((x + 1) + 1) + 1) ... written with explicit parentheses
+    std::string nestedParens(std::size_t depth)
+    {
+        std::string body(depth, '(');
+        body += "x";
+        for (std::size_t i = 0; i < depth; ++i)
+        {
+            body += " + 1)";
+        }
+
+        return "def parens(x) " + body + ";\n";
+    }
+
+    // - - - ... - x with a user-defined unary operator
+    std::string unaryChain(std::size_t depth)
+    {
+        std::string body;
+        body.reserve(depth * 2 + 1);
+        for (std::size_t i = 0; i < depth; ++i)
+        {
+            body += "- ";
+        }
+
+        return "def unary-(v) 0-v;\ndef negate(x) " + body + "x;\n";
+    }
+
+    // small definitions and top-level expressions, one module each as in the REPL
+    std::string replItems(std::size_t items)
+    {
+        std::string program;
+        for (std::size_t i = 0; i < items; ++i)
+        {
+            program += i % 2 == 0 ? "def f" + std::to_string(i) + "(x) x * " + std::to_string(i) + " + 1;\n"
+                                  : "f" + std::to_string(i - 1) + "(" + std::to_string(i) + ");\n";
+        }
+
+        return program;
+    }
+
+    void runReplBenchmark(std::size_t items, std::size_t modulesPerContext)
+    {
+        auto source = SourceBuffer::fromString(replItems(items));
+
+        Lexer lexer(source.getText());
+        Parser parser(lexer);
+        CodeGenerator codegen(parser);
+        codegen.setModulesPerContext(modulesPerContext);
+
+        std::chrono::duration<double> codegenTime{0};
+        std::size_t itemAllocations = 0;
+
+        parser.getNextToken();
+
+        while (parser.getCurrentToken().getType() != kaleidoscope::tok_eof)
+        {
+            if (parser.getCurrentToken().getType() == kaleidoscope::tok_char && parser.getCurrentToken().getCharValue() == ';')
+            {
+                parser.getNextToken();
+                continue;
+            }
+
+            auto ast = parser.getCurrentToken().getType() == kaleidoscope::tok_def ? parser.ParseDefinition() : parser.ParseTopLevelExpr();
+
+            auto codegenStart = Clock::now();
+            auto allocationsStart = allocations.load();
+            codegen(ast);
+            codegen.finalizeModule();
+            itemAllocations += allocations.load() - allocationsStart;
+            codegenTime += Clock::now() - codegenStart;
+        }
+
+        std::cerr << "repl items: " << items << " items, " << modulesPerContext << " modules per context\n"
+                  << "  codegen: " << codegenTime.count() * 1e6 / items << " us/item, "
+                  << static_cast<double>(itemAllocations) / items << " allocations/item" << std::endl;
+    }
+
+    // the REPL items again, compiled to object code, one module each
+    void runDebugBenchmark(char const *label, std::size_t items, DebugLevel debugLevel)
+    {
+        auto source = SourceBuffer::fromString(replItems(items));
+
+        ObjCodeWriter objWriter;
+        Lexer lexer(source.getText());
+        Parser parser(lexer);
+        CodeGenerator codegen(parser, objWriter.getDataLayout(), "module", debugLevel);
+
+        std::chrono::duration<double> codegenTime{0}, objectTime{0};
+        std::size_t objectSize = 0;
+
+        parser.getNextToken();
+
+        while (parser.getCurrentToken().getType() != kaleidoscope::tok_eof)
+        {
+            if (parser.getCurrentToken().getType() == kaleidoscope::tok_char && parser.getCurrentToken().getCharValue() == ';')
+            {
+                parser.getNextToken();
+                continue;
+            }
+
+            auto ast = parser.getCurrentToken().getType() == kaleidoscope::tok_def ? parser.ParseDefinition() : parser.ParseTopLevelExpr();
+
+            auto codegenStart = Clock::now();
+            codegen(ast);
+            auto module = codegen.finalizeModule();
+            auto objectStart = Clock::now();
+
+            llvm::SmallString<4096> object;
+            llvm::raw_svector_ostream dest(object);
+            objWriter.writeModuleToStream(dest, *module.getModuleUnlocked());
+            objectSize += object.size();
+
+            objectTime += Clock::now() - objectStart;
+            codegenTime += objectStart - codegenStart;
+        }
+
+        std::cerr << "debug info " << label << ": " << items << " items\n"
+                  << "  codegen: " << codegenTime.count() * 1e6 / items << " us/item, "
+                  << "object code: " << objectTime.count() * 1e6 / items << " us/item, "
+                  << static_cast<double>(objectSize) / items << " bytes/item" << std::endl;
+    }
+
+    void runBenchmark(char const *label, std::size_t terms, std::string const &program)
+    {
+        auto source = SourceBuffer::fromString(program);
+
+        Lexer lexer(source.getText());
+        Parser parser(lexer);
+        CodeGenerator codegen(parser);
+
+        std::chrono::duration<double> parseTime{0}, codegenTime{0};
+
+        parser.getNextToken();
+
+        while (parser.getCurrentToken().getType() == kaleidoscope::tok_def)
+        {
+            auto parseStart = Clock::now();
+            auto ast = parser.ParseDefinition();
+            auto codegenStart = Clock::now();
+            codegen(ast);
+            auto codegenEnd = Clock::now();
+
+            parseTime += codegenStart - parseStart;
+            codegenTime += codegenEnd - codegenStart;
+
+            if (parser.getCurrentToken().getType() == kaleidoscope::tok_char && parser.getCurrentToken().getCharValue() == ';')
+            {
+                parser.getNextToken();
+            }
+        }
+
+        auto mbytes = program.size() / 1e6;
+
+        std::cerr << label << ": " << terms << " terms, " << program.size() << " bytes\n"
+                  << "  parse:   " << parseTime.count() * 1e3 << " ms, "
+                  << terms / parseTime.count() / 1e6 << " Mterms/s, "
+                  << mbytes / parseTime.count() << " MB/s\n"
+                  << "  codegen: " << codegenTime.count() * 1e3 << " ms, "
+                  << terms / codegenTime.count() / 1e6 << " Mterms/s" << std::endl;
+    }
+}
+
+// Every form of operator new and delete but the aligned ones, which
+// allocate and free with those of the runtime
+void *operator new(std::size_t size)
+{
+    ++allocations;
+
+    if (auto block = std::malloc(size != 0 ? size : 1))
+    {
+        return block;
+    }
+
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+    ++allocations;
+    return std::malloc(size != 0 ? size : 1);
+}
+
+void *operator new[](std::size_t size, std::nothrow_t const &tag) noexcept
+{
+    return operator new(size, tag);
+}
+
+void operator delete(void *block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void *block) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void *block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void *block, std::size_t) noexcept
+{
+    std::free(block);
+}
+
+void operator delete(void *block, std::nothrow_t const &) noexcept
+{
+    std::free(block);
+}
+
+void operator delete[](void *block, std::nothrow_t const &) noexcept
+{
+    std::free(block);
+}
+
+int main(int argc, char *argv[])
+{
+    std::size_t terms = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+    runBenchmark("operator chain", terms, operatorChain(terms));
+    runBenchmark("nested parentheses", terms, nestedParens(terms));
+    runBenchmark("unary chain", terms, unaryChain(terms));
+
+    auto items = std::min<std::size_t>(terms, 10000);
+    runReplBenchmark(items, 1);
+    runReplBenchmark(items, 256);
+
+    runDebugBenchmark("none", items, DebugLevel::None);
+    runDebugBenchmark("line tables only", items, DebugLevel::LineTablesOnly);
+    runDebugBenchmark("full", items, DebugLevel::Full);
+}
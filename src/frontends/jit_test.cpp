@@ -1,25 +1,75 @@
 #include "kaleidoscope/codegen.hpp"
+#include "kaleidoscope/definitioncache.hpp"
 #include "kaleidoscope/lexer.hpp"
+#include "kaleidoscope/memocache.hpp"
 #include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/profile.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
 #include "kaleidoscope/optimizer.hpp"
+#include "kaleidoscope/parallel.hpp"
 #include "kaleidoscope/jit.hpp"
 
 #include <llvm/Support/Error.h>
 
-#include <fstream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <optional>
 
 using kaleidoscope::CodeGenerationError;
 using kaleidoscope::CodeGenerator;
+using kaleidoscope::DefinitionCache;
 using kaleidoscope::Error;
+using kaleidoscope::FastMath;
 using kaleidoscope::KaleidoscopeJIT;
 using kaleidoscope::Lexer;
 using kaleidoscope::optimizeModule;
+using kaleidoscope::ParallelOptions;
+using kaleidoscope::ParallelSchedule;
 using kaleidoscope::ParseError;
 using kaleidoscope::Parser;
+using kaleidoscope::ProfileCollector;
+using kaleidoscope::ProfileOptions;
+using kaleidoscope::ReductionOptions;
+using kaleidoscope::SourceBuffer;
+using kaleidoscope::TieringOptions;
 
 namespace
 {
+    struct HandlerOptions
+    {
+        ProfileOptions profile;
+        /// gets the counters of the modules if profile instruments them
+        ProfileCollector *collector = nullptr;
+        /// calls after which a definition is optimised, see TieredCompiler;
+        /// with 0, or with a profile, definitions are optimised at once
+        std::uint64_t hotCalls = TieringOptions().hotCalls;
+        ReductionOptions reduction;
+        /// fast-math flags of all functions, see CodeGenerator::setFastMath()
+        FastMath fastMath = FastMath::None;
+    };
+
+    std::optional<ParallelSchedule> parseSchedule(char const *name)
+    {
+        if (std::strcmp(name, "static") == 0)
+        {
+            return ParallelSchedule::Static;
+        }
+
+        if (std::strcmp(name, "dynamic") == 0)
+        {
+            return ParallelSchedule::Dynamic;
+        }
+
+        if (std::strcmp(name, "guided") == 0)
+        {
+            return ParallelSchedule::Guided;
+        }
+
+        return std::nullopt;
+    }
+
     class JITHandler
     {
     private:
@@ -44,17 +94,58 @@ namespace
         }
 
     public:
-        JITHandler(Parser &p)
-            : jitCompiler_(ExitOnErr(KaleidoscopeJIT::Create())),
-              codegen_(p, jitCompiler_->getDataLayout())
+        JITHandler(Parser &p, HandlerOptions const &options)
+            : jitCompiler_(ExitOnErr(KaleidoscopeJIT::Create(options.fastMath))),
+              codegen_(p, jitCompiler_->getDataLayout()),
+              profile_(options.profile),
+              collector_(options.collector),
+              tiered_(options.hotCalls != 0 && !options.profile.enabled())
         {
+            codegen_.setReductionOptions(options.reduction);
+            codegen_.setFastMath(options.fastMath);
+
+            if (tiered_)
+            {
+                TieringOptions tiering;
+                tiering.hotCalls = options.hotCalls;
+                tiering.prepare = [this](llvm::Module &module)
+                { definitions_.importDefinitions(module); };
+
+                ExitOnErr(jitCompiler_->enableTiering(std::move(tiering)));
+            }
         }
 
         void HandleDefinition(Parser &p)
         {
             HandleParse(
                 p, &Parser::ParseDefinition, [this](auto &, auto &)
-                { auto H = jitCompiler_->addModule(codegen_.finalizeModule()); });
+                {
+            auto module = codegen_.finalizeModule();
+            // Tier 1 optimises the definition with the callees it imports, as
+            // does every later module importing it.
+            if (tiered_)
+            {
+                // the stubs of a redefined function are repointed to the new definition
+                definitions_.addDefinitions(*module.getModuleUnlocked(), true);
+                ExitOnErr(jitCompiler_->addTieredModule(std::move(module)));
+                return;
+            }
+            // With a profile, callees are imported as generated rather than
+            // as optimised, so that a function is instrumented and later
+            // annotated with the same callees inlined.
+            // Without tiering, the JIT keeps resolving the first definition of a
+            // function, so a redefinition is not imported either.
+            if (profile_.enabled())
+            {
+                definitions_.addDefinitions(*module.getModuleUnlocked(), false);
+            }
+            definitions_.importDefinitions(*module.getModuleUnlocked());
+            optimize(*module.getModuleUnlocked());
+            if (!profile_.enabled())
+            {
+                definitions_.addDefinitions(*module.getModuleUnlocked(), false);
+            }
+            auto H = jitCompiler_->addModule(std::move(module)); });
         }
 
         void HandleExtern(Parser &p)
@@ -65,19 +156,29 @@ namespace
 
         void HandleTopLevelExpression(Parser &p)
         {
-            HandleParse(p, &Parser::ParseTopLevelExpr, [this](auto &, auto &)
+            HandleParse(p, &Parser::ParseTopLevelExpr, [this](auto &, auto &ir)
                         {
+            // float32 if the module precision is, see CodeGenerator::setPrecision()
+            bool returnsFloat = ir->getReturnType()->isFloatTy();
             auto RT = jitCompiler_->getMainJITDylib().createResourceTracker();
             auto module = codegen_.finalizeModule();
-            optimizeModule(*module.getModuleUnlocked());
+            definitions_.importDefinitions(*module.getModuleUnlocked());
+            optimize(*module.getModuleUnlocked());
             auto H = jitCompiler_->addModule(std::move(module), RT);
 
             auto exprSymbol = ExitOnErr(jitCompiler_->lookup("__anon_expr"));
-            auto FP = reinterpret_cast<double (*)()>(exprSymbol.getAddress());
-
-            auto result = FP();
+            auto result = returnsFloat ? reinterpret_cast<float (*)()>(exprSymbol.getAddress())()
+                                       : reinterpret_cast<double (*)()>(exprSymbol.getAddress())();
 
-            std::cerr << "Evaluated to " << result << std::endl;
+            // a tiered function the expression called may have failed to compile
+            if (auto Err = jitCompiler_->takeCallFailures())
+            {
+                llvm::logAllUnhandledErrors(std::move(Err), llvm::errs(), "Error evaluating expression: ");
+            }
+            else
+            {
+                std::cerr << "Evaluated to " << result << std::endl;
+            }
 
             ExitOnErr(RT->remove()); });
         }
@@ -88,15 +189,30 @@ namespace
         }
 
     private:
+        void optimize(llvm::Module &module)
+        {
+            optimizeModule(module, jitCompiler_->getTargetMachine(), profile_, jitCompiler_->getVectorLibrary());
+
+            if (profile_.instrument)
+            {
+                collector_->addModule(module);
+            }
+        }
+
         llvm::ExitOnError ExitOnErr;
+        // outlives the JIT, whose tier-up thread imports from it
+        DefinitionCache definitions_;
         std::unique_ptr<KaleidoscopeJIT> jitCompiler_;
         CodeGenerator codegen_;
+        ProfileOptions profile_;
+        ProfileCollector *collector_;
+        bool tiered_;
     };
 
     /// top ::= definition | external | expression | ';'
-    static void MainLoop(Parser &p)
+    static void MainLoop(Parser &p, HandlerOptions const &options)
     {
-        JITHandler handler(p);
+        JITHandler handler(p, options);
 
         while (true)
         {
@@ -104,6 +220,8 @@ namespace
             {
             case kaleidoscope::tok_eof:
                 return;
+            case kaleidoscope::tok_memo:
+            case kaleidoscope::tok_fastmath:
             case kaleidoscope::tok_def:
                 handler.HandleDefinition(p);
                 break;
@@ -124,32 +242,185 @@ namespace
         }
     }
 
-    void MainParse(std::istream &in)
+    void MainParse(Lexer &lexer, HandlerOptions const &options)
     {
-        using kaleidoscope::Lexer;
-        using kaleidoscope::Parser;
-
-        Lexer lexer(in);
         Parser parser(lexer);
 
         parser.getNextToken();
 
-        MainLoop(parser);
+        MainLoop(parser, options);
+    }
+
+    bool MainParseFiles(int argc, char *argv[], HandlerOptions const &options)
+    {
+        for (int i = 0; i < argc; ++i)
+        {
+            try
+            {
+                auto source = SourceBuffer::fromFile(argv[i]);
+                Lexer lexer(source.getText());
+                MainParse(lexer, options);
+            }
+            catch (Error const &e)
+            {
+                std::cerr << e.what() << std::endl;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void PrintMemoStatistics()
+    {
+        for (auto const &statistics : kaleidoscope::getMemoStatistics())
+        {
+            std::cerr << "memo " << statistics.name << ": " << statistics.hits << " hits, "
+                      << statistics.misses << " misses, " << statistics.evictions << " evictions, "
+                      << statistics.size << "/" << statistics.capacity << " entries" << std::endl;
+        }
     }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc > 1)
+    // jit_test -fprofile-generate=file: instrument the code, write its profile to file at the end
+    // jit_test -fprofile-use=file: optimise with the profile in file
+    // With both, the source files run instrumented first and then again, recompiled with the profile.
+    // jit_test -ftier-up-calls=n: optimise a definition after n calls rather than 1000
+    // jit_test -fno-tiering: optimise definitions at once
+    // jit_test -fparfor-threads=n: run parfor loops on n threads rather than one per hardware thread
+    // jit_test -fparfor-chunk-size=n: run parfor loops in chunks of n iterations
+    // jit_test -fparfor-schedule=static|dynamic|guided: divide parfor loops into chunks like this
+    // jit_test -freduce-threads: split reductions across the threads of the parfor loops
+    // jit_test -freduce-ordered: combine the values of reductions in iteration order
+    // jit_test -ffast-math: allow all fast-math flags in all functions
+    std::string generateFile;
+    HandlerOptions options;
+    ParallelOptions parallel;
+    int first = 1;
+
+    for (; first < argc && std::strncmp(argv[first], "-f", 2) == 0; ++first)
     {
-        for (int i = 1; i < argc; ++i)
+        if (std::strncmp(argv[first], "-fprofile-generate=", 19) == 0)
+        {
+            generateFile = argv[first] + 19;
+        }
+        else if (std::strncmp(argv[first], "-fprofile-use=", 14) == 0)
+        {
+            options.profile.useFile = argv[first] + 14;
+        }
+        else if (std::strncmp(argv[first], "-ftier-up-calls=", 16) == 0)
+        {
+            options.hotCalls = std::strtoull(argv[first] + 16, nullptr, 10);
+
+            if (options.hotCalls == 0)
+            {
+                std::cerr << "-ftier-up-calls needs a number of calls" << std::endl;
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[first], "-fno-tiering") == 0)
+        {
+            options.hotCalls = 0;
+        }
+        else if (std::strncmp(argv[first], "-fparfor-threads=", 17) == 0)
+        {
+            parallel.threads = std::strtoul(argv[first] + 17, nullptr, 10);
+        }
+        else if (std::strncmp(argv[first], "-fparfor-chunk-size=", 20) == 0)
+        {
+            parallel.chunkSize = std::strtoll(argv[first] + 20, nullptr, 10);
+        }
+        else if (std::strncmp(argv[first], "-fparfor-schedule=", 18) == 0)
+        {
+            auto schedule = parseSchedule(argv[first] + 18);
+
+            if (!schedule)
+            {
+                std::cerr << "-fparfor-schedule needs static, dynamic or guided" << std::endl;
+                return 1;
+            }
+
+            parallel.schedule = *schedule;
+        }
+        else if (std::strcmp(argv[first], "-freduce-threads") == 0)
+        {
+            options.reduction.threads = true;
+        }
+        else if (std::strcmp(argv[first], "-freduce-ordered") == 0)
+        {
+            options.reduction.ordered = true;
+        }
+        else if (std::strcmp(argv[first], "-ffast-math") == 0)
+        {
+            options.fastMath = FastMath::All;
+        }
+        else
         {
-            std::ifstream in(argv[i]);
-            MainParse(in);
+            std::cerr << "unknown option " << argv[first] << std::endl;
+            return 1;
+        }
+    }
+
+    kaleidoscope::setParallelOptions(parallel);
+
+    if (!generateFile.empty())
+    {
+        ProfileCollector collector;
+        HandlerOptions instrument;
+        instrument.profile.instrument = true;
+        instrument.collector = &collector;
+
+        if (argc > first)
+        {
+            if (!MainParseFiles(argc - first, argv + first, instrument))
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            Lexer lexer(std::cin);
+            MainParse(lexer, instrument);
+        }
+
+        collector.writeProfile(generateFile);
+        std::cerr << "wrote " << generateFile << std::endl;
+
+        // the standard input has been read
+        if (options.profile.useFile.empty() || argc == first)
+        {
+            PrintMemoStatistics();
+            return 0;
+        }
+    }
+
+    if (!options.profile.useFile.empty())
+    {
+        try
+        {
+            kaleidoscope::checkProfile(options.profile.useFile);
+        }
+        catch (Error const &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (argc > first)
+    {
+        if (!MainParseFiles(argc - first, argv + first, options))
+        {
+            return 1;
         }
     }
     else
     {
-        MainParse(std::cin);
+        Lexer lexer(std::cin);
+        MainParse(lexer, options);
     }
+
+    PrintMemoStatistics();
 }
@@ -1,24 +1,60 @@
 #include "kaleidoscope/codegen.hpp"
 #include "kaleidoscope/lexer.hpp"
 #include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
 #include "kaleidoscope/optimizer.hpp"
 #include "kaleidoscope/objcode.hpp"
+#include "kaleidoscope/parallelcodegen.hpp"
+#include "kaleidoscope/parallelparser.hpp"
+#include "kaleidoscope/profile.hpp"
 
 #include <llvm/Support/Error.h>
 
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 
 using kaleidoscope::CodeGenerationError;
 using kaleidoscope::CodeGenerator;
 using kaleidoscope::Error;
+using kaleidoscope::FastMath;
 using kaleidoscope::Lexer;
 using kaleidoscope::ObjCodeWriter;
 using kaleidoscope::ParseError;
 using kaleidoscope::Parser;
+using kaleidoscope::ProfileOptions;
+using kaleidoscope::SourceBuffer;
 
 namespace
 {
+    struct HandlerOptions
+    {
+        ProfileOptions profile;
+        /// fast-math flags of all functions, see CodeGenerator::setFastMath()
+        FastMath fastMath = FastMath::None;
+    };
+
+    llvm::TargetOptions getTargetOptions(HandlerOptions const &options)
+    {
+        llvm::TargetOptions targetOptions;
+        kaleidoscope::applyFastMath(targetOptions, options.fastMath);
+        return targetOptions;
+    }
+
+    void writeModuleToFile(ObjCodeWriter &objWriter, CodeGenerator &codegen, std::string const &fileName, llvm::CodeGenFileType fileType = llvm::CGFT_ObjectFile)
+    {
+        std::error_code ec;
+        llvm::raw_fd_ostream dest(fileName, ec, llvm::sys::fs::OF_None);
+
+        if (ec)
+        {
+            throw std::runtime_error(ec.message());
+        }
+
+        objWriter.writeModuleToStream(dest, *codegen.finalizeModule().getModuleUnlocked(), fileType);
+    }
+
     class ObjCodeHandler
     {
     private:
@@ -50,9 +86,12 @@ namespace
         }
 
     public:
-        ObjCodeHandler(Parser &p)
-            : codegen_(p, objWriter_.getDataLayout())
+        ObjCodeHandler(Parser &p, HandlerOptions const &options)
+            : objWriter_(getTargetOptions(options)),
+              codegen_(p, objWriter_.getDataLayout())
         {
+            objWriter_.setProfileOptions(options.profile);
+            codegen_.setFastMath(options.fastMath);
         }
 
         void HandleDefinition(Parser &p)
@@ -72,17 +111,9 @@ namespace
             HandleParse(p, &Parser::ParseTopLevelExpr);
         }
 
-        void writeModuleToFile(std::string const &fileName, llvm::CodeGenFileType fileType = llvm::CGFT_ObjectFile)
+        void writeModuleToFile(std::string const &fileName)
         {
-            std::error_code ec;
-            llvm::raw_fd_ostream dest(fileName, ec, llvm::sys::fs::OF_None);
-
-            if (ec)
-            {
-                throw std::runtime_error(ec.message());
-            }
-
-            objWriter_.writeModuleToStream(dest, *codegen_.finalizeModule().getModuleUnlocked(), fileType);
+            ::writeModuleToFile(objWriter_, codegen_, fileName);
         }
 
     private:
@@ -92,9 +123,9 @@ namespace
     };
 
     /// top ::= definition | external | expression | ';'
-    static void MainLoop(Parser &p, std::string const &fileName)
+    static void MainLoop(Parser &p, std::string const &fileName, HandlerOptions const &options)
     {
-        ObjCodeHandler handler(p);
+        ObjCodeHandler handler(p, options);
 
         while (true)
         {
@@ -106,6 +137,8 @@ namespace
                 std::cerr << "wrote " << fileName << std::endl;
                 return;
             }
+            case kaleidoscope::tok_memo:
+            case kaleidoscope::tok_fastmath:
             case kaleidoscope::tok_def:
                 handler.HandleDefinition(p);
                 break;
@@ -126,32 +159,120 @@ namespace
         }
     }
 
-    void MainParse(std::istream &in, std::string const &fileName)
+    void MainParse(Lexer &lexer, std::string const &fileName, HandlerOptions const &options)
     {
-        using kaleidoscope::Lexer;
-        using kaleidoscope::Parser;
-
-        Lexer lexer(in);
         Parser parser(lexer);
 
         parser.getNextToken();
 
-        MainLoop(parser, fileName);
+        MainLoop(parser, fileName, options);
+    }
+
+    /// same messages as MainLoop, for items parsed and generated in parallel
+    void ParallelCompile(SourceBuffer const &source, unsigned threadCount, std::string const &fileName, HandlerOptions const &options)
+    {
+        ObjCodeWriter objWriter(getTargetOptions(options));
+        CodeGenerator codegen(objWriter.getDataLayout());
+        objWriter.setProfileOptions(options.profile);
+        codegen.setFastMath(options.fastMath);
+
+        auto items = kaleidoscope::parseParallel(source.getText(), threadCount);
+        auto errors = kaleidoscope::generateParallel(codegen, items, threadCount);
+
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+            if (items[i].kind == kaleidoscope::ParsedItem::Error)
+            {
+                std::cerr << std::get<std::string>(items[i].ast) << std::endl;
+            }
+            else if (!errors[i].empty())
+            {
+                std::cerr << errors[i] << std::endl;
+            }
+        }
+
+        writeModuleToFile(objWriter, codegen, fileName);
+        std::cerr << "wrote " << fileName << std::endl;
     }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc > 1)
+    // objcode_test -fprofile-generate ...: instrument the code for compiler-rt's profile runtime
+    // objcode_test -fprofile-use=file ...: optimise with the indexed profile in file
+    // objcode_test -ffast-math ...: allow all fast-math flags in all functions
+    HandlerOptions options;
+    int first = 1;
+
+    for (; first < argc && std::strncmp(argv[first], "-f", 2) == 0; ++first)
     {
-        for (int i = 1; i < argc; ++i)
+        if (std::strcmp(argv[first], "-fprofile-generate") == 0)
         {
-            std::ifstream in(argv[i]);
-            MainParse(in, std::string(argv[i]) + ".o");
+            options.profile.instrument = true;
+        }
+        else if (std::strncmp(argv[first], "-fprofile-use=", 14) == 0)
+        {
+            options.profile.useFile = argv[first] + 14;
+        }
+        else if (std::strcmp(argv[first], "-ffast-math") == 0)
+        {
+            options.fastMath = FastMath::All;
+        }
+        else
+        {
+            std::cerr << "unknown option " << argv[first] << std::endl;
+            return 1;
+        }
+    }
+
+    if (!options.profile.useFile.empty())
+    {
+        try
+        {
+            kaleidoscope::checkProfile(options.profile.useFile);
+        }
+        catch (Error const &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    // objcode_test -j[threads] file: parse and generate the items of file in parallel
+    if (argc > first + 1 && std::strncmp(argv[first], "-j", 2) == 0)
+    {
+        unsigned threadCount = argv[first][2] != '\0' ? std::atoi(argv[first] + 2) : std::thread::hardware_concurrency();
+
+        try
+        {
+            ParallelCompile(SourceBuffer::fromFile(argv[first + 1]), threadCount, std::string(argv[first + 1]) + ".o", options);
+        }
+        catch (Error const &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+    }
+    else if (argc > first)
+    {
+        for (int i = first; i < argc; ++i)
+        {
+            try
+            {
+                auto source = SourceBuffer::fromFile(argv[i]);
+                Lexer lexer(source.getText());
+                MainParse(lexer, std::string(argv[i]) + ".o", options);
+            }
+            catch (Error const &e)
+            {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
         }
     }
     else
     {
-        MainParse(std::cin, "module.o");
+        Lexer lexer(std::cin);
+        MainParse(lexer, "module.o", options);
     }
 }
@@ -1,9 +1,9 @@
 #include "kaleidoscope/codegen.hpp"
 #include "kaleidoscope/lexer.hpp"
 #include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
 #include "kaleidoscope/optimizer.hpp"
 
-#include <fstream>
 #include <iostream>
 
 using kaleidoscope::CodeGenerationError;
@@ -12,6 +12,7 @@ using kaleidoscope::Error;
 using kaleidoscope::Lexer;
 using kaleidoscope::ParseError;
 using kaleidoscope::Parser;
+using kaleidoscope::SourceBuffer;
 
 namespace
 {
@@ -86,6 +87,8 @@ namespace
                 finalModule.getModuleUnlocked()->print(llvm::errs(), nullptr);
                 return;
             }
+            case kaleidoscope::tok_memo:
+            case kaleidoscope::tok_fastmath:
             case kaleidoscope::tok_def:
                 codegen.HandleDefinition(p);
                 break;
@@ -106,12 +109,8 @@ namespace
         }
     }
 
-    void MainParse(std::istream &in)
+    void MainParse(Lexer &lexer)
     {
-        using kaleidoscope::Lexer;
-        using kaleidoscope::Parser;
-
-        Lexer lexer(in);
         Parser parser(lexer);
 
         parser.getNextToken();
@@ -124,11 +123,21 @@ int main(int argc, char *argv[])
 {
     if (argc > 1)
     {
-        std::ifstream in(argv[1]);
-        MainParse(in);
+        try
+        {
+            auto source = SourceBuffer::fromFile(argv[1]);
+            Lexer lexer(source.getText());
+            MainParse(lexer);
+        }
+        catch (Error const &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
     }
     else
     {
-        MainParse(std::cin);
+        Lexer lexer(std::cin);
+        MainParse(lexer);
     }
 }
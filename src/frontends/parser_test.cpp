@@ -1,11 +1,19 @@
+#include "kaleidoscope/error.hpp"
 #include "kaleidoscope/lexer.hpp"
+#include "kaleidoscope/parallelparser.hpp"
 #include "kaleidoscope/parser.hpp"
+#include "kaleidoscope/sourcebuffer.hpp"
 
-#include <fstream>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <thread>
 
+using kaleidoscope::Error;
 using kaleidoscope::Lexer;
+using kaleidoscope::ParsedItem;
 using kaleidoscope::Parser;
+using kaleidoscope::SourceBuffer;
 
 namespace
 {
@@ -66,6 +74,8 @@ namespace
             {
             case kaleidoscope::tok_eof:
                 return;
+            case kaleidoscope::tok_memo:
+            case kaleidoscope::tok_fastmath:
             case kaleidoscope::tok_def:
                 HandleDefinition(p);
                 break;
@@ -86,12 +96,8 @@ namespace
         }
     }
 
-    void MainParse(std::istream &in)
+    void MainParse(Lexer &lexer)
     {
-        using kaleidoscope::Lexer;
-        using kaleidoscope::Parser;
-
-        Lexer lexer(in);
         Parser parser(lexer);
 
         std::cerr << "ready> " << std::flush;
@@ -99,17 +105,58 @@ namespace
 
         MainLoop(parser);
     }
+
+    /// same messages as MainLoop, for items parsed by kaleidoscope::parseParallel
+    void ParallelParse(SourceBuffer const &source, unsigned threadCount)
+    {
+        for (auto const &item : kaleidoscope::parseParallel(source.getText(), threadCount))
+        {
+            switch (item.kind)
+            {
+            case ParsedItem::Definition:
+                std::cerr << "Parsed a function definition\n";
+                break;
+            case ParsedItem::Extern:
+                std::cerr << "Parsed an extern\n";
+                break;
+            case ParsedItem::TopLevelExpression:
+                std::cerr << "Parsed a top-level expr\n";
+                break;
+            case ParsedItem::Error:
+                std::cerr << std::get<std::string>(item.ast) << std::endl;
+                break;
+            }
+        }
+    }
 }
 
 int main(int argc, char *argv[])
 {
-    if (argc > 1)
+    if (argc == 1)
+    {
+        Lexer lexer(std::cin);
+        MainParse(lexer);
+        return 0;
+    }
+
+    try
     {
-        std::ifstream in(argv[1]);
-        MainParse(in);
+        // parser_test -j[threads] file: parse the top-level items of file in parallel
+        if (argc > 2 && std::strncmp(argv[1], "-j", 2) == 0)
+        {
+            unsigned threadCount = argv[1][2] != '\0' ? std::atoi(argv[1] + 2) : std::thread::hardware_concurrency();
+            ParallelParse(SourceBuffer::fromFile(argv[2]), threadCount);
+        }
+        else
+        {
+            auto source = SourceBuffer::fromFile(argv[1]);
+            Lexer lexer(source.getText());
+            MainParse(lexer);
+        }
     }
-    else
+    catch (Error const &e)
     {
-        MainParse(std::cin);
+        std::cerr << e.what() << std::endl;
+        return 1;
     }
 }
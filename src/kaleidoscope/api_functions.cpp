@@ -1,4 +1,10 @@
+#include "api_functions.hpp"
+
+#include "ast.hpp"
+
+#include <cmath>
 #include <iostream>
+#include <sstream>
 
 #ifdef _WIN32
 #define DLLEXPORT __declspec(dllexport)
@@ -8,13 +14,95 @@
 
 extern "C" double DLLEXPORT putchard(double X)
 {
-    std::cerr << static_cast<char>(X) << std::flush;
+    char c = static_cast<char>(X);
+    kaleidoscope::writeOutput(std::string_view(&c, 1));
     return 0;
 }
 
 /// printd - printf that takes a double prints it as "%f\n", returning 0.
 extern "C" double DLLEXPORT printd(double X)
 {
-    std::cerr << X << std::endl;
+    std::ostringstream line;
+    line << X << '\n';
+    kaleidoscope::writeOutput(line.str());
     return 0;
 }
+
+extern "C" int DLLEXPORT kaleidoscope_memo_lookup(kaleidoscope::MemoDescriptor *descriptor, double const *args, double *result)
+{
+    return kaleidoscope::getMemoCache(*descriptor).lookup(args, *result);
+}
+
+extern "C" void DLLEXPORT kaleidoscope_memo_store(kaleidoscope::MemoDescriptor *descriptor, double const *args, double result)
+{
+    kaleidoscope::getMemoCache(*descriptor).store(args, result);
+}
+
+extern "C" DLLEXPORT double *kaleidoscope_array_new(std::int64_t length)
+{
+    return kaleidoscope::allocateArray(length);
+}
+
+extern "C" void DLLEXPORT kaleidoscope_array_release(double *data)
+{
+    kaleidoscope::releaseArray(data);
+}
+
+extern "C" std::int64_t DLLEXPORT kaleidoscope_array_length(double const *data)
+{
+    return kaleidoscope::getArrayLength(data);
+}
+
+namespace
+{
+    /// the number of iterations, 0 for NaN, negative or too many ones
+    std::int64_t getIterationCount(double trips, char const *construct)
+    {
+        if (!(trips > 0))
+        {
+            return 0;
+        }
+
+        if (!(trips < 0x1p62))
+        {
+            std::cerr << construct << ": too many iterations (" << trips << ")" << std::endl;
+            return 0;
+        }
+
+        return static_cast<std::int64_t>(std::ceil(trips));
+    }
+}
+
+extern "C" void DLLEXPORT kaleidoscope_parfor(kaleidoscope::ParallelBody body, void *context, double trips)
+{
+    kaleidoscope::parallelFor(getIterationCount(trips, "parfor"), body, context);
+}
+
+extern "C" double DLLEXPORT kaleidoscope_reduce(kaleidoscope::ReductionBody body, void *context, double trips, std::int32_t kind, std::int32_t ordered)
+{
+    using kaleidoscope::ReductionKind;
+
+    auto count = getIterationCount(trips, "reduction");
+
+    switch (static_cast<ReductionKind>(kind))
+    {
+    case ReductionKind::Sum:
+        return kaleidoscope::parallelReduce(count, body, context, 0.0, [](double lhs, double rhs)
+                                            { return lhs + rhs; },
+                                            ordered != 0);
+    case ReductionKind::Product:
+        return kaleidoscope::parallelReduce(count, body, context, 1.0, [](double lhs, double rhs)
+                                            { return lhs * rhs; },
+                                            ordered != 0);
+    case ReductionKind::Min:
+        return kaleidoscope::parallelReduce(count, body, context, HUGE_VAL, [](double lhs, double rhs)
+                                            { return std::fmin(lhs, rhs); },
+                                            ordered != 0);
+    case ReductionKind::Max:
+        break;
+    }
+
+    return kaleidoscope::parallelReduce(count, body, context, -HUGE_VAL, [](double lhs, double rhs)
+                                        { return std::fmax(lhs, rhs); },
+                                        ordered != 0);
+}
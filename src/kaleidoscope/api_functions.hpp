@@ -1,7 +1,31 @@
 #ifndef INCLUDED_KALEIDOSCOPE_API_FUNCTIONS_HPP
 #define INCLUDED_KALEIDOSCOPE_API_FUNCTIONS_HPP
 
+#include "arrays.hpp"
+#include "memocache.hpp"
+#include "parallel.hpp"
+
+#include <cstdint>
+
 extern "C" double putchard(double X);
 extern "C" double printd(double X);
 
+// result cache of 'memo def' functions, called by the code CodeGenerator emits
+extern "C" int kaleidoscope_memo_lookup(kaleidoscope::MemoDescriptor *descriptor, double const *args, double *result);
+extern "C" void kaleidoscope_memo_store(kaleidoscope::MemoDescriptor *descriptor, double const *args, double result);
+
+// arrays: array(n) calls kaleidoscope_array_new, release(a)
+// kaleidoscope_array_release, and an extern returning an array must return
+// storage allocated by kaleidoscope_array_new
+extern "C" double *kaleidoscope_array_new(std::int64_t length);
+extern "C" void kaleidoscope_array_release(double *data);
+extern "C" std::int64_t kaleidoscope_array_length(double const *data);
+
+// runs a parfor loop: body runs the iterations of a chunk, trips is the
+// unrounded number of iterations
+extern "C" void kaleidoscope_parfor(kaleidoscope::ParallelBody body, void *context, double trips);
+// runs a reduction of the given ReductionKind like a parfor loop, ordered if
+// not 0, see ReductionOptions
+extern "C" double kaleidoscope_reduce(kaleidoscope::ReductionBody body, void *context, double trips, std::int32_t kind, std::int32_t ordered);
+
 #endif
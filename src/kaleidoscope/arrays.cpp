@@ -0,0 +1,90 @@
+#include "arrays.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        struct FreeDeleter
+        {
+            void operator()(void *block) const { std::free(block); }
+        };
+
+        // the blocks of the arrays not released yet, by their data pointer
+        struct ArrayRegistry
+        {
+            std::mutex mutex;
+            std::unordered_map<double const *, std::unique_ptr<std::byte, FreeDeleter>> blocks;
+        };
+
+        // the caller is generated code, which cannot handle an exception
+        [[noreturn]] void fail(char const *message, std::int64_t value)
+        {
+            std::cerr << message << value << std::endl;
+            std::abort();
+        }
+
+        ArrayRegistry &registry()
+        {
+            static ArrayRegistry instance;
+            return instance;
+        }
+    }
+
+    // A block is the header, padded to the alignment so that the data starts
+    // on the next boundary, followed by the elements, rounded up to whole
+    // cache lines so that a vector loop never reads past the block.
+    double *allocateArray(std::int64_t length)
+    {
+        constexpr auto alignment = ArrayLayout::alignment;
+
+        if (length > maxArrayLength)
+        {
+            fail("array: too many elements: ", length);
+        }
+
+        auto count = static_cast<std::size_t>(std::max<std::int64_t>(length, 0));
+        auto dataBytes = (count * sizeof(double) + alignment - 1) / alignment * alignment;
+
+        auto block = static_cast<std::byte *>(std::aligned_alloc(alignment, alignment + dataBytes));
+
+        if (block == nullptr)
+        {
+            fail("array: cannot allocate elements: ", length);
+        }
+
+        std::memset(block, 0, alignment + dataBytes);
+
+        auto data = reinterpret_cast<double *>(block + alignment);
+        reinterpret_cast<std::int64_t *>(data)[ArrayLayout::lengthIndex] = static_cast<std::int64_t>(count);
+
+        auto &arrayRegistry = registry();
+        std::lock_guard lock(arrayRegistry.mutex);
+        arrayRegistry.blocks.emplace(data, block);
+
+        return data;
+    }
+
+    void releaseArray(double *data)
+    {
+        auto &arrayRegistry = registry();
+        std::lock_guard lock(arrayRegistry.mutex);
+
+        if (arrayRegistry.blocks.erase(data) == 0)
+        {
+            fail("release: not an array: ", reinterpret_cast<std::intptr_t>(data));
+        }
+    }
+
+    std::int64_t getArrayLength(double const *data)
+    {
+        return reinterpret_cast<std::int64_t const *>(data)[ArrayLayout::lengthIndex];
+    }
+}
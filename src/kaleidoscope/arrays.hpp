@@ -0,0 +1,43 @@
+#ifndef INCLUDED_KALEIDOSCOPE_ARRAYS_HPP
+#define INCLUDED_KALEIDOSCOPE_ARRAYS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace kaleidoscope
+{
+    /// Arrays of doubles are stored contiguously, starting at a 64 byte
+    /// (cache line) boundary, with their length as an int64 right in front of
+    /// the first element. A Kaleidoscope value refers to an array by the
+    /// address of its first element, so the data pointer is all an extern or
+    /// the generated code needs.
+    struct ArrayLayout
+    {
+        static constexpr std::size_t alignment = 64;
+        /// offset of the length from the first element, in int64s
+        static constexpr std::ptrdiff_t lengthIndex = -1;
+    };
+
+    /// array(n) allocates n zeroed elements, len(a) is the length of a and
+    /// release(a) frees a, evaluating to 0. Calls of these names never refer
+    /// to user functions.
+    inline constexpr std::string_view arrayBuiltin = "array";
+    inline constexpr std::string_view lengthBuiltin = "len";
+    inline constexpr std::string_view releaseBuiltin = "release";
+
+    /// the longest array, whose size in bytes still fits a std::ptrdiff_t
+    inline constexpr std::int64_t maxArrayLength = (PTRDIFF_MAX - 2 * ArrayLayout::alignment) / sizeof(double);
+
+    /// Allocates length zeroed elements, none for a negative length. Arrays
+    /// are owned by the runtime until they are released; those still
+    /// allocated are freed when the process exits. A length above
+    /// maxArrayLength is a runtime error, which aborts the process.
+    double *allocateArray(std::int64_t length);
+    /// Frees an array allocated by allocateArray(). Releasing anything else,
+    /// or an array twice, is a runtime error.
+    void releaseArray(double *data);
+    std::int64_t getArrayLength(double const *data);
+}
+
+#endif
@@ -1,31 +1,31 @@
 #include "ast.hpp"
 
+#include <algorithm>
+#include <bit>
 #include <cassert>
 
 namespace kaleidoscope
 {
-    ASTBase::~ASTBase() {}
-
     NumberExprAST::NumberExprAST(SourceLocation const &loc, double Val)
-        : ASTBase(loc), Val(Val) {}
+        : ASTBase(loc), Val(std::bit_cast<std::array<std::uint32_t, 2>>(Val)) {}
 
     double NumberExprAST::getVal() const noexcept
     {
-        return Val;
+        return std::bit_cast<double>(Val);
     }
 
-    VariableExprAST::VariableExprAST(SourceLocation const &loc, const std::string &Name)
+    VariableExprAST::VariableExprAST(SourceLocation const &loc, Symbol Name)
         : ASTBase(loc), Name(Name) {}
 
-    std::string const &VariableExprAST::getName() const noexcept
+    Symbol VariableExprAST::getName() const noexcept
     {
         return Name;
     }
 
-    UnaryExprAST::UnaryExprAST(SourceLocation const &loc, char op, ExprAST opd)
+    UnaryExprAST::UnaryExprAST(SourceLocation const &loc, char op, ExprRef opd)
         : ASTBase(loc),
           Op(op),
-          Operand(std::make_unique<ExprAST>(std::move(opd)))
+          Operand(opd)
     {
     }
 
@@ -34,129 +34,258 @@ namespace kaleidoscope
         return Op;
     }
 
-    ExprAST const &UnaryExprAST::getOperand() const noexcept
+    ExprRef UnaryExprAST::getOperand() const noexcept
     {
-        return *Operand;
+        return Operand;
     }
 
-    BinaryExprAST::BinaryExprAST(SourceLocation const &loc, char op, ExprAST LHS, ExprAST RHS)
+    BinaryExprAST::BinaryExprAST(SourceLocation const &loc, char op, ExprRef LHS, ExprRef RHS)
         : ASTBase(loc),
           Op(op),
-          LHS(std::make_unique<ExprAST>(std::move(LHS))),
-          RHS(std::make_unique<ExprAST>(std::move(RHS))) {}
+          LHS(LHS),
+          RHS(RHS) {}
 
     char BinaryExprAST::getOp() const noexcept
     {
         return Op;
     }
 
-    ExprAST const &BinaryExprAST::getLHS() const noexcept
+    ExprRef BinaryExprAST::getLHS() const noexcept
     {
-        return *LHS;
+        return LHS;
     }
-    ExprAST const &BinaryExprAST::getRHS() const noexcept
+    ExprRef BinaryExprAST::getRHS() const noexcept
     {
-        return *RHS;
+        return RHS;
     }
 
-    IfExprAST::IfExprAST(SourceLocation const &loc, ExprAST Cond, ExprAST ThenBranch, ExprAST ElseBranch)
+    IndexExprAST::IndexExprAST(SourceLocation const &loc, ExprRef array, ExprRef index)
         : ASTBase(loc),
-          condition_(std::make_unique<ExprAST>(std::move(Cond))),
-          thenBranch_(std::make_unique<ExprAST>(std::move(ThenBranch))),
-          elseBranch_(std::make_unique<ExprAST>(std::move(ElseBranch)))
+          array_(array),
+          index_(index)
     {
     }
 
-    ExprAST const &IfExprAST::getCondition() const noexcept
+    ExprRef IndexExprAST::getArray() const noexcept
     {
-        return *condition_;
+        return array_;
     }
-    ExprAST const &IfExprAST::getThenBranch() const noexcept
+    ExprRef IndexExprAST::getIndex() const noexcept
     {
-        return *thenBranch_;
+        return index_;
     }
-    ExprAST const &IfExprAST::getElseBranch() const noexcept
+
+    IfExprAST::IfExprAST(SourceLocation const &loc, ExprRef Cond, ExprRef ThenBranch, ExprRef ElseBranch)
+        : ASTBase(loc),
+          condition_(Cond),
+          thenBranch_(ThenBranch),
+          elseBranch_(ElseBranch)
     {
-        return *elseBranch_;
     }
 
-    ForExprAST::ForExprAST(SourceLocation const &loc, std::string varName, ExprAST start, ExprAST end, std::unique_ptr<ExprAST> step, ExprAST body)
+    ExprRef IfExprAST::getCondition() const noexcept
+    {
+        return condition_;
+    }
+    ExprRef IfExprAST::getThenBranch() const noexcept
+    {
+        return thenBranch_;
+    }
+    ExprRef IfExprAST::getElseBranch() const noexcept
+    {
+        return elseBranch_;
+    }
+
+    ForExprAST::ForExprAST(SourceLocation const &loc, Symbol varName, ExprRef start, ExprRef end, ExprRef step, ExprRef body)
         : ASTBase(loc),
           varName_(varName),
-          start_(std::make_unique<ExprAST>(std::move(start))),
-          end_(std::make_unique<ExprAST>(std::move(end))),
-          step_(std::move(step)),
-          body_(std::make_unique<ExprAST>(std::move(body)))
+          start_(start),
+          end_(end),
+          step_(step),
+          body_(body)
     {
     }
 
-    std::string const &ForExprAST::getVarName() const noexcept
+    Symbol ForExprAST::getVarName() const noexcept
     {
         return varName_;
     }
-    ExprAST const &ForExprAST::getStart() const noexcept
+    ExprRef ForExprAST::getStart() const noexcept
     {
-        return *start_;
+        return start_;
     }
-    ExprAST const &ForExprAST::getEnd() const noexcept
+    ExprRef ForExprAST::getEnd() const noexcept
     {
-        return *end_;
+        return end_;
     }
-    ExprAST const *ForExprAST::getStep() const noexcept
+    ExprRef ForExprAST::getStep() const noexcept
     {
-        return step_.get();
+        return step_;
     }
-    ExprAST const &ForExprAST::getBody() const noexcept
+    ExprRef ForExprAST::getBody() const noexcept
     {
-        return *body_;
+        return body_;
     }
 
     CallExprAST::CallExprAST(SourceLocation const &loc,
-                             const std::string &Callee,
-                             std::vector<ExprAST> Args)
-        : ASTBase(loc), Callee(Callee), Args(std::move(Args)) {}
+                             Symbol Callee,
+                             ASTRange Args)
+        : ASTBase(loc), Callee(Callee), Args(Args) {}
 
-    std::string const &CallExprAST::getCallee() const noexcept { return Callee; }
-    std::vector<ExprAST> const &CallExprAST::getArgs() const noexcept { return Args; }
+    Symbol CallExprAST::getCallee() const noexcept { return Callee; }
+    ASTRange CallExprAST::getArgs() const noexcept { return Args; }
 
-    PrototypeAST::PrototypeAST(SourceLocation const &loc,
-                               const std::string &name,
-                               std::vector<std::string> Args,
-                               bool isOperator,
-                               int precedence)
+    VariableDeclarationAST::VariableDeclarationAST(SourceLocation const &loc, Symbol name, ExprRef initVal)
         : ASTBase(loc),
-          Name(name),
-          Args(std::move(Args)),
-          isOperator_(isOperator),
-          precedence_(precedence)
+          name_(name),
+          initVal_(initVal)
     {
     }
 
-    VariableDeclarationAST::VariableDeclarationAST(SourceLocation const &loc, std::string const &name, ExprAST initVal)
+    Symbol VariableDeclarationAST::getName() const noexcept { return name_; }
+    ExprRef VariableDeclarationAST::getInitVal() const noexcept { return initVal_; }
+
+    VarExprAST::VarExprAST(SourceLocation const &loc, ASTRange declarations, ExprRef Body)
         : ASTBase(loc),
-          name_(name),
-          initVal_(std::make_unique<ExprAST>(std::move(initVal)))
+          declarations_(declarations),
+          body_(Body)
     {
     }
 
-    std::string const &VariableDeclarationAST::getName() const noexcept { return name_; }
-    ExprAST const &VariableDeclarationAST::getInitVal() const noexcept { return *initVal_; }
+    ASTRange VarExprAST::getDeclarations() const noexcept { return declarations_; }
+    ExprRef VarExprAST::getBody() const noexcept { return body_; }
 
-    VarExprAST::VarExprAST(SourceLocation const &loc, std::vector<VariableDeclarationAST> declarations, ExprAST Body)
-        : ASTBase(loc),
-          declarations_(std::move(declarations)),
-          body_(std::make_unique<ExprAST>(std::move(Body)))
+    ExprRef ASTArena::add(ExprAST node)
     {
+        ExprRef ref(static_cast<std::uint32_t>(nodes_.size()));
+        nodes_.push_back(std::move(node));
+        return ref;
     }
 
-    std::vector<VariableDeclarationAST> const &VarExprAST::getDeclarations() const noexcept { return declarations_; }
-    ExprAST const &VarExprAST::getBody() const noexcept { return *body_; }
+    ASTRange ASTArena::addArgs(std::span<ExprRef const> args)
+    {
+        ASTRange range{static_cast<std::uint32_t>(args_.size()), static_cast<std::uint32_t>(args.size())};
+        args_.insert(args_.end(), args.begin(), args.end());
+        return range;
+    }
 
-    const std::string &PrototypeAST::getName() const noexcept
+    ASTRange ASTArena::addDeclarations(std::span<VariableDeclarationAST const> declarations)
+    {
+        ASTRange range{static_cast<std::uint32_t>(declarations_.size()), static_cast<std::uint32_t>(declarations.size())};
+        declarations_.insert(declarations_.end(), declarations.begin(), declarations.end());
+        return range;
+    }
+
+    ExprAST const &ASTArena::operator[](ExprRef ref) const
+    {
+        assert(ref.isValid() && ref.index() < nodes_.size());
+        return nodes_[ref.index()];
+    }
+
+    ExprAST const *ASTArena::tryGet(ExprRef ref) const
+    {
+        return ref.isValid() ? &(*this)[ref] : nullptr;
+    }
+
+    std::span<ExprRef const> ASTArena::getArgs(CallExprAST const &call) const
+    {
+        auto range = call.getArgs();
+        return std::span<ExprRef const>(args_).subspan(range.first, range.count);
+    }
+
+    std::span<VariableDeclarationAST const> ASTArena::getDeclarations(VarExprAST const &var) const
+    {
+        auto range = var.getDeclarations();
+        return std::span<VariableDeclarationAST const>(declarations_).subspan(range.first, range.count);
+    }
+
+    SourceLocation const &ASTArena::getLocation(ExprRef ref) const
+    {
+        return std::visit([](ASTBase const &ast) -> SourceLocation const &
+                          { return ast.getLocation(); },
+                          (*this)[ref]);
+    }
+
+    void ASTArena::setLoopHints(ExprRef forExpr, LoopHints const &hints)
+    {
+        assert(std::holds_alternative<ForExprAST>((*this)[forExpr]) || std::holds_alternative<ParForExprAST>((*this)[forExpr]) ||
+               std::holds_alternative<ReductionExprAST>((*this)[forExpr]));
+        assert(loopHints_.empty() || loopHints_.back().first.index() < forExpr.index());
+
+        if (!hints.empty())
+        {
+            loopHints_.emplace_back(forExpr, hints);
+        }
+    }
+
+    LoopHints ASTArena::getLoopHints(ExprRef forExpr) const
+    {
+        auto entry = std::lower_bound(loopHints_.begin(), loopHints_.end(), forExpr.index(), [](auto const &hinted, std::uint32_t index)
+                                      { return hinted.first.index() < index; });
+
+        return entry != loopHints_.end() && entry->first == forExpr ? entry->second : LoopHints();
+    }
+
+    void ASTArena::setReductionKind(ExprRef reduction, ReductionKind kind)
+    {
+        assert(std::holds_alternative<ReductionExprAST>((*this)[reduction]));
+        assert(reductionKinds_.empty() || reductionKinds_.back().first.index() < reduction.index());
+
+        reductionKinds_.emplace_back(reduction, kind);
+    }
+
+    ReductionKind ASTArena::getReductionKind(ExprRef reduction) const
+    {
+        auto entry = std::lower_bound(reductionKinds_.begin(), reductionKinds_.end(), reduction.index(), [](auto const &kinded, std::uint32_t index)
+                                      { return kinded.first.index() < index; });
+
+        assert(entry != reductionKinds_.end() && entry->first == reduction);
+        return entry->second;
+    }
+
+    void ASTArena::clear() noexcept
+    {
+        nodes_.clear();
+        nodes_.shrink_to_fit();
+        args_.clear();
+        args_.shrink_to_fit();
+        declarations_.clear();
+        declarations_.shrink_to_fit();
+        loopHints_.clear();
+        loopHints_.shrink_to_fit();
+        reductionKinds_.clear();
+        reductionKinds_.shrink_to_fit();
+    }
+
+    PrototypeAST::PrototypeAST(SourceLocation const &loc,
+                               Symbol name,
+                               std::vector<Symbol> Args,
+                               bool isOperator,
+                               int precedence,
+                               bool isMemoized,
+                               std::vector<bool> arrayArgs,
+                               bool returnsArray,
+                               FastMath fastMath,
+                               Precision precision)
+        : ASTBase(loc),
+          Name(name),
+          Args(std::move(Args)),
+          isOperator_(isOperator),
+          precedence_(precedence),
+          isMemoized_(isMemoized),
+          arrayArgs_(std::move(arrayArgs)),
+          returnsArray_(returnsArray),
+          fastMath_(fastMath),
+          precision_(precision)
+    {
+        arrayArgs_.resize(this->Args.size());
+    }
+
+    Symbol PrototypeAST::getName() const noexcept
     {
         return Name;
     }
-    const std::vector<std::string> &PrototypeAST::getArgs() const noexcept
+    const std::vector<Symbol> &PrototypeAST::getArgs() const noexcept
     {
         return Args;
     };
@@ -176,18 +305,50 @@ namespace kaleidoscope
     char PrototypeAST::getOperatorName() const noexcept
     {
         assert(isOperator());
-        return *getName().rbegin();
+        return getName().str().back();
     }
     int PrototypeAST::getBinaryPrecedence() const noexcept
     {
         return precedence_;
     }
+    bool PrototypeAST::isMemoized() const noexcept
+    {
+        return isMemoized_;
+    }
+    FastMath PrototypeAST::getFastMath() const noexcept
+    {
+        return fastMath_;
+    }
+    Precision PrototypeAST::getPrecision() const noexcept
+    {
+        return precision_;
+    }
+    PrototypeAST PrototypeAST::withPrecision(Precision precision) const
+    {
+        auto proto = *this;
+        proto.precision_ = precision;
+        return proto;
+    }
+    bool PrototypeAST::isArrayArg(std::size_t index) const noexcept
+    {
+        return arrayArgs_[index];
+    }
+    bool PrototypeAST::returnsArray() const noexcept
+    {
+        return returnsArray_;
+    }
+    bool PrototypeAST::hasArrays() const noexcept
+    {
+        return returnsArray_ || std::find(arrayArgs_.begin(), arrayArgs_.end(), true) != arrayArgs_.end();
+    }
 
     FunctionAST::FunctionAST(SourceLocation const &loc,
                              PrototypeAST Proto,
-                             ExprAST Body)
-        : ASTBase(loc), Proto(std::move(Proto)), Body(std::move(Body)) {}
+                             ASTArena Arena,
+                             ExprRef Body)
+        : ASTBase(loc), Proto(std::move(Proto)), Arena(std::move(Arena)), Body(Body) {}
 
     PrototypeAST const &FunctionAST::getProto() const noexcept { return Proto; }
-    ExprAST const &FunctionAST::getBody() const noexcept { return Body; }
+    ASTArena const &FunctionAST::getArena() const noexcept { return Arena; }
+    ExprRef FunctionAST::getBody() const noexcept { return Body; }
 }
@@ -1,10 +1,14 @@
 #ifndef INCLUDED_KALEIDOSCOPE_AST_HPP
 #define INCLUDED_KALEIDOSCOPE_AST_HPP
 
+#include "interner.hpp"
 #include "sourcelocation.hpp"
 
-#include <memory>
-#include <string>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <utility>
 #include <vector>
 #include <variant>
 
@@ -18,21 +22,50 @@ namespace kaleidoscope
         {
         }
 
-        virtual ~ASTBase() = 0;
-
         SourceLocation const &getLocation() const { return loc_; }
 
     private:
         SourceLocation loc_;
     };
 
+    /// ExprRef - 32 bit index of an expression node in the ASTArena of the
+    /// top-level item it belongs to.
+    class ExprRef
+    {
+    public:
+        /// A reference to no node, e.g. a for loop without a step expression.
+        ExprRef() = default;
+        explicit ExprRef(std::uint32_t index) noexcept : index_(index) {}
+
+        std::uint32_t index() const noexcept { return index_; }
+        bool isValid() const noexcept { return index_ != invalidIndex; }
+
+        friend bool operator==(ExprRef lhs, ExprRef rhs) noexcept { return lhs.index_ == rhs.index_; }
+
+    private:
+        static constexpr std::uint32_t invalidIndex = std::numeric_limits<std::uint32_t>::max();
+
+        std::uint32_t index_ = invalidIndex;
+    };
+
+    /// ASTRange - a run of list elements (call arguments, var declarations)
+    /// stored in an ASTArena.
+    struct ASTRange
+    {
+        std::uint32_t first = 0;
+        std::uint32_t count = 0;
+    };
+
     class NumberExprAST;
     class VariableExprAST;
     class UnaryExprAST;
     class BinaryExprAST;
     class CallExprAST;
+    class IndexExprAST;
     class IfExprAST;
     class ForExprAST;
+    class ParForExprAST;
+    class ReductionExprAST;
     class VarExprAST;
 
     using ExprAST = std::variant<NumberExprAST,
@@ -40,13 +73,17 @@ namespace kaleidoscope
                                  UnaryExprAST,
                                  BinaryExprAST,
                                  CallExprAST,
+                                 IndexExprAST,
                                  IfExprAST,
                                  ForExprAST,
+                                 ParForExprAST,
+                                 ReductionExprAST,
                                  VarExprAST>;
 
     class NumberExprAST : public ASTBase
     {
-        double Val;
+        // stored as two words so the node only needs 4 byte alignment, which keeps ExprAST at 32 bytes
+        std::array<std::uint32_t, 2> Val;
 
     public:
         NumberExprAST(SourceLocation const &loc, double Val);
@@ -57,155 +94,400 @@ namespace kaleidoscope
     /// VariableExprAST - Expression class for referencing a variable, like "a".
     class VariableExprAST : public ASTBase
     {
-        std::string Name;
+        Symbol Name;
 
     public:
-        VariableExprAST(SourceLocation const &loc, const std::string &Name);
+        VariableExprAST(SourceLocation const &loc, Symbol Name);
 
-        std::string const &getName() const noexcept;
+        Symbol getName() const noexcept;
     };
 
     class UnaryExprAST : public ASTBase
     {
         char Op;
-        std::unique_ptr<ExprAST> Operand;
+        ExprRef Operand;
 
     public:
-        UnaryExprAST(SourceLocation const &loc, char op, ExprAST opd);
+        UnaryExprAST(SourceLocation const &loc, char op, ExprRef opd);
 
         char getOp() const noexcept;
-        ExprAST const &getOperand() const noexcept;
+        ExprRef getOperand() const noexcept;
     };
 
     /// BinaryExprAST - Expression class for a binary operator.
     class BinaryExprAST : public ASTBase
     {
         char Op;
-        std::unique_ptr<ExprAST> LHS, RHS;
+        ExprRef LHS, RHS;
 
     public:
-        BinaryExprAST(SourceLocation const &loc, char op, ExprAST LHS, ExprAST RHS);
+        BinaryExprAST(SourceLocation const &loc, char op, ExprRef LHS, ExprRef RHS);
 
         char getOp() const noexcept;
-        ExprAST const &getLHS() const noexcept;
-        ExprAST const &getRHS() const noexcept;
+        ExprRef getLHS() const noexcept;
+        ExprRef getRHS() const noexcept;
+    };
+
+    /// IndexExprAST - an element of an array, like "a[i]", or the target of
+    /// an assignment to one.
+    class IndexExprAST : public ASTBase
+    {
+    public:
+        IndexExprAST(SourceLocation const &loc, ExprRef array, ExprRef index);
+
+        ExprRef getArray() const noexcept;
+        ExprRef getIndex() const noexcept;
+
+    private:
+        ExprRef array_, index_;
     };
 
     class IfExprAST : public ASTBase
     {
     public:
-        IfExprAST(SourceLocation const &loc, ExprAST Cond, ExprAST ThenBranch, ExprAST ElseBranch);
+        IfExprAST(SourceLocation const &loc, ExprRef Cond, ExprRef ThenBranch, ExprRef ElseBranch);
 
-        ExprAST const &getCondition() const noexcept;
-        ExprAST const &getThenBranch() const noexcept;
-        ExprAST const &getElseBranch() const noexcept;
+        ExprRef getCondition() const noexcept;
+        ExprRef getThenBranch() const noexcept;
+        ExprRef getElseBranch() const noexcept;
 
     private:
-        std::unique_ptr<ExprAST> condition_, thenBranch_, elseBranch_;
+        ExprRef condition_, thenBranch_, elseBranch_;
     };
 
     class ForExprAST : public ASTBase
     {
     public:
-        ForExprAST(SourceLocation const &loc, std::string varName, ExprAST start, ExprAST end, std::unique_ptr<ExprAST> step, ExprAST body);
+        ForExprAST(SourceLocation const &loc, Symbol varName, ExprRef start, ExprRef end, ExprRef step, ExprRef body);
 
-        std::string const &getVarName() const noexcept;
-        ExprAST const &getStart() const noexcept;
-        ExprAST const &getEnd() const noexcept;
-        ExprAST const *getStep() const noexcept;
-        ExprAST const &getBody() const noexcept;
+        Symbol getVarName() const noexcept;
+        ExprRef getStart() const noexcept;
+        ExprRef getEnd() const noexcept;
+        /// invalid if the loop has no explicit step
+        ExprRef getStep() const noexcept;
+        ExprRef getBody() const noexcept;
 
     private:
-        std::string varName_;
-        std::unique_ptr<ExprAST> start_;
-        std::unique_ptr<ExprAST> end_;
-        std::unique_ptr<ExprAST> step_;
-        std::unique_ptr<ExprAST> body_;
+        Symbol varName_;
+        ExprRef start_;
+        ExprRef end_;
+        ExprRef step_;
+        ExprRef body_;
+    };
+
+    /// ParForExprAST - "parfor i = start, end, step in body": start, end and
+    /// step are evaluated once, then the body runs for i = start + k * step,
+    /// k = 0, 1, ... as long as i lies before end, in any order and in
+    /// parallel. Every iteration starts with the values the variables around
+    /// the loop had when it started.
+    class ParForExprAST : public ForExprAST
+    {
+    public:
+        using ForExprAST::ForExprAST;
+    };
+
+    enum class ReductionKind : std::uint8_t
+    {
+        Sum,
+        Product,
+        Min,
+        Max
+    };
+
+    /// ReductionExprAST - "sum i = start, end, step in body" and likewise
+    /// product, min and max: the sum etc. of the values of body over the
+    /// iterations of "parfor i = start, end, step", in which body sees the
+    /// variables around it the same way. 0 for an empty sum, 1 for an empty
+    /// product, infinity for an empty min and -infinity for an empty max;
+    /// min and max ignore NaN values. The kind is kept in the ASTArena.
+    class ReductionExprAST : public ForExprAST
+    {
+    public:
+        using ForExprAST::ForExprAST;
+    };
+
+    /// LoopHints - optimisation hints written between the header of a for loop
+    /// and 'in', e.g. "for i = 0, i < n, 1 unroll(4) vectorize(8) in ...".
+    /// 0 means no hint; 1 disables unrolling or vectorization.
+    struct LoopHints
+    {
+        std::uint32_t unroll = 0;
+        std::uint32_t vectorize = 0;
+        std::uint32_t interleave = 0;
+
+        bool empty() const noexcept { return unroll == 0 && vectorize == 0 && interleave == 0; }
+    };
+
+    /// FastMath - floating point assumptions a function may be optimised
+    /// under, LLVM's fast-math flags. "fastmath def" allows all of them,
+    /// "fastmath(reassoc contract) def" only the ones listed.
+    enum class FastMath : std::uint8_t
+    {
+        None = 0,
+        /// reassociate, e.g. to vectorise a reduction
+        Reassoc = 1 << 0,
+        /// fuse a multiplication and an addition into an fma
+        Contract = 1 << 1,
+        /// arguments and results are not NaN
+        NoNaNs = 1 << 2,
+        /// arguments and results are not infinite
+        NoInfs = 1 << 3,
+        /// the sign of a zero does not matter
+        NoSignedZeros = 1 << 4,
+        /// x / y may become x * (1 / y)
+        AllowReciprocal = 1 << 5,
+        /// math functions may be approximated
+        ApproxFunc = 1 << 6,
+        All = (1 << 7) - 1
+    };
+
+    constexpr FastMath operator|(FastMath lhs, FastMath rhs) noexcept
+    {
+        return static_cast<FastMath>(static_cast<std::uint8_t>(lhs) | static_cast<std::uint8_t>(rhs));
+    }
+
+    /// whether all of flags are set in fastMath
+    constexpr bool allows(FastMath fastMath, FastMath flags) noexcept
+    {
+        return (static_cast<std::uint8_t>(fastMath) & static_cast<std::uint8_t>(flags)) == static_cast<std::uint8_t>(flags);
+    }
+
+    /// Precision - the floating point type a function computes with, keeps its
+    /// variables in and takes and returns its arguments and result as, written
+    /// as "def float32 f(x)" or "extern float32 sinf(x)". A definition without
+    /// one has the precision of the module, an extern the double of C.
+    enum class Precision : std::uint8_t
+    {
+        Default,
+        Single,
+        Double
     };
 
     class VariableDeclarationAST : public ASTBase
     {
     public:
-        VariableDeclarationAST(SourceLocation const &loc, std::string const &name, ExprAST initVal);
+        VariableDeclarationAST(SourceLocation const &loc, Symbol name, ExprRef initVal);
 
-        std::string const &getName() const noexcept;
-        ExprAST const &getInitVal() const noexcept;
+        Symbol getName() const noexcept;
+        ExprRef getInitVal() const noexcept;
 
     private:
-        std::string name_;
-        std::unique_ptr<ExprAST> initVal_;
+        Symbol name_;
+        ExprRef initVal_;
     };
 
     class VarExprAST : public ASTBase
     {
     public:
-        VarExprAST(SourceLocation const &loc, std::vector<VariableDeclarationAST> declarations, ExprAST Body);
+        VarExprAST(SourceLocation const &loc, ASTRange declarations, ExprRef Body);
 
-        std::vector<VariableDeclarationAST> const &getDeclarations() const noexcept;
-        ExprAST const &getBody() const noexcept;
+        /// resolve with ASTArena::getDeclarations
+        ASTRange getDeclarations() const noexcept;
+        ExprRef getBody() const noexcept;
 
     private:
-        std::vector<VariableDeclarationAST> declarations_;
-        std::unique_ptr<ExprAST> body_;
+        ASTRange declarations_;
+        ExprRef body_;
     };
 
     /// CallExprAST - Expression class for function calls.
     class CallExprAST : public ASTBase
     {
-        std::string Callee;
-        std::vector<ExprAST> Args;
+        Symbol Callee;
+        ASTRange Args;
 
     public:
-        CallExprAST(SourceLocation const &loc, const std::string &Callee, std::vector<ExprAST> Args);
+        CallExprAST(SourceLocation const &loc, Symbol Callee, ASTRange Args);
+
+        Symbol getCallee() const noexcept;
+        /// resolve with ASTArena::getArgs
+        ASTRange getArgs() const noexcept;
+    };
+
+    /// ASTArena - owns all expression nodes of one top-level item. Nodes are
+    /// appended to contiguous storage and refer to each other by index, so the
+    /// nodes are small, trivially copyable and freed all at once with the arena.
+    class ASTArena
+    {
+    public:
+        ExprRef add(ExprAST node);
+        ASTRange addArgs(std::span<ExprRef const> args);
+        ASTRange addDeclarations(std::span<VariableDeclarationAST const> declarations);
+
+        ExprAST const &operator[](ExprRef ref) const;
+        /// nullptr for an invalid ref
+        ExprAST const *tryGet(ExprRef ref) const;
+
+        std::span<ExprRef const> getArgs(CallExprAST const &call) const;
+        std::span<VariableDeclarationAST const> getDeclarations(VarExprAST const &var) const;
 
-        CallExprAST(CallExprAST const &) = delete;
-        CallExprAST(CallExprAST &&) = default;
-        CallExprAST &operator=(CallExprAST const &) = delete;
-        CallExprAST &operator=(CallExprAST &&) = default;
+        SourceLocation const &getLocation(ExprRef ref) const;
 
-        std::string const &getCallee() const noexcept;
-        std::vector<ExprAST> const &getArgs() const noexcept;
+        /// Loop hints are kept out of the nodes, which most loops do without.
+        /// forExpr must be the for, parfor or reduction node added last.
+        void setLoopHints(ExprRef forExpr, LoopHints const &hints);
+        LoopHints getLoopHints(ExprRef forExpr) const;
+
+        /// Likewise the kind of a reduction, which would make the nodes larger.
+        /// reduction must be the node added last.
+        void setReductionKind(ExprRef reduction, ReductionKind kind);
+        ReductionKind getReductionKind(ExprRef reduction) const;
+
+        /// calls f with every valid child reference of node, in source order
+        template <typename F>
+        void forEachChild(ExprAST const &node, F f) const;
+
+        std::size_t size() const noexcept { return nodes_.size(); }
+
+        /// releases all nodes in one go
+        void clear() noexcept;
+
+    private:
+        std::vector<ExprAST> nodes_;
+        std::vector<ExprRef> args_;
+        std::vector<VariableDeclarationAST> declarations_;
+        // sorted by node index
+        std::vector<std::pair<ExprRef, LoopHints>> loopHints_;
+        // sorted by node index
+        std::vector<std::pair<ExprRef, ReductionKind>> reductionKinds_;
     };
 
+    template <typename F>
+    void ASTArena::forEachChild(ExprAST const &node, F f) const
+    {
+        auto visitValid = [&f](ExprRef child)
+        {
+            if (child.isValid())
+            {
+                f(child);
+            }
+        };
+
+        if (auto unary = std::get_if<UnaryExprAST>(&node))
+        {
+            visitValid(unary->getOperand());
+        }
+        else if (auto binary = std::get_if<BinaryExprAST>(&node))
+        {
+            visitValid(binary->getLHS());
+            visitValid(binary->getRHS());
+        }
+        else if (auto call = std::get_if<CallExprAST>(&node))
+        {
+            for (auto arg : getArgs(*call))
+            {
+                visitValid(arg);
+            }
+        }
+        else if (auto index = std::get_if<IndexExprAST>(&node))
+        {
+            visitValid(index->getArray());
+            visitValid(index->getIndex());
+        }
+        else if (auto ifExpr = std::get_if<IfExprAST>(&node))
+        {
+            visitValid(ifExpr->getCondition());
+            visitValid(ifExpr->getThenBranch());
+            visitValid(ifExpr->getElseBranch());
+        }
+        else if (auto forExpr = std::get_if<ForExprAST>(&node))
+        {
+            visitValid(forExpr->getStart());
+            visitValid(forExpr->getEnd());
+            visitValid(forExpr->getStep());
+            visitValid(forExpr->getBody());
+        }
+        else if (auto parFor = std::get_if<ParForExprAST>(&node))
+        {
+            visitValid(parFor->getStart());
+            visitValid(parFor->getEnd());
+            visitValid(parFor->getStep());
+            visitValid(parFor->getBody());
+        }
+        else if (auto reduction = std::get_if<ReductionExprAST>(&node))
+        {
+            visitValid(reduction->getStart());
+            visitValid(reduction->getEnd());
+            visitValid(reduction->getStep());
+            visitValid(reduction->getBody());
+        }
+        else if (auto var = std::get_if<VarExprAST>(&node))
+        {
+            for (auto const &decl : getDeclarations(*var))
+            {
+                visitValid(decl.getInitVal());
+            }
+
+            visitValid(var->getBody());
+        }
+    }
+
     /// PrototypeAST - This class represents the "prototype" for a function,
     /// which captures its name, and its argument names (thus implicitly the
     /// number of arguments the function takes).
     class PrototypeAST : public ASTBase
     {
-        std::string Name;
-        std::vector<std::string> Args;
+        Symbol Name;
+        std::vector<Symbol> Args;
         bool isOperator_;
         int precedence_;
+        bool isMemoized_;
+        std::vector<bool> arrayArgs_;
+        bool returnsArray_;
+        FastMath fastMath_;
+        Precision precision_;
 
     public:
         PrototypeAST(SourceLocation const &loc,
-                     const std::string &name,
-                     std::vector<std::string> Args,
+                     Symbol name,
+                     std::vector<Symbol> Args,
                      bool isOperator = false,
-                     int precedence = 0);
+                     int precedence = 0,
+                     bool isMemoized = false,
+                     std::vector<bool> arrayArgs = {},
+                     bool returnsArray = false,
+                     FastMath fastMath = FastMath::None,
+                     Precision precision = Precision::Default);
 
-        const std::string &getName() const noexcept;
-        const std::vector<std::string> &getArgs() const noexcept;
+        Symbol getName() const noexcept;
+        const std::vector<Symbol> &getArgs() const noexcept;
 
         bool isOperator() const noexcept;
         bool isUnaryOperator() const noexcept;
         bool isBinaryOperator() const noexcept;
         char getOperatorName() const noexcept;
         int getBinaryPrecedence() const noexcept;
+        /// defined with 'memo def': results are cached per argument tuple
+        bool isMemoized() const noexcept;
+        /// the flags of 'fastmath def'
+        FastMath getFastMath() const noexcept;
+        Precision getPrecision() const noexcept;
+        /// a copy with precision, e.g. to resolve Precision::Default
+        PrototypeAST withPrecision(Precision precision) const;
+
+        /// Arguments and results declared with [], like "extern sum(xs[])" or
+        /// "def first(xs[]) xs[0]", are arrays: an argument is passed as data
+        /// pointer and int64 length, a result is returned as data pointer.
+        bool isArrayArg(std::size_t index) const noexcept;
+        bool returnsArray() const noexcept;
+        bool hasArrays() const noexcept;
     };
 
-    /// FunctionAST - This class represents a function definition itself.
+    /// FunctionAST - This class represents a function definition itself. It owns
+    /// the arena holding the nodes of its body.
     class FunctionAST : public ASTBase
     {
         PrototypeAST Proto;
-        ExprAST Body;
+        ASTArena Arena;
+        ExprRef Body;
 
     public:
-        FunctionAST(SourceLocation const &loc, PrototypeAST Proto, ExprAST Body);
+        FunctionAST(SourceLocation const &loc, PrototypeAST Proto, ASTArena Arena, ExprRef Body);
 
         PrototypeAST const &getProto() const noexcept;
-        ExprAST const &getBody() const noexcept;
+        ASTArena const &getArena() const noexcept;
+        ExprRef getBody() const noexcept;
     };
 } // namespace kaleidoscope
 
-#endif
\ No newline at end of file
+#endif
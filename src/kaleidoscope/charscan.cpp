@@ -0,0 +1,113 @@
+#include "charscan.hpp"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        constexpr bool isSpace(char c) noexcept
+        {
+            return c == ' ' || (c >= '\t' && c <= '\r');
+        }
+
+        constexpr bool isDigit(char c) noexcept
+        {
+            return c >= '0' && c <= '9';
+        }
+
+        constexpr bool isAlnum(char c) noexcept
+        {
+            char lower = static_cast<char>(c | 0x20);
+            return isDigit(c) || (lower >= 'a' && lower <= 'z');
+        }
+
+        constexpr bool isNumberChar(char c) noexcept
+        {
+            return isDigit(c) || c == '.';
+        }
+
+#ifdef __SSE2__
+        // Mask of bytes in [lo, hi]. Bytes >= 0x80 compare as negative and never match,
+        // which is what we want for the ASCII-only classes used here.
+        inline __m128i inRange(__m128i bytes, char lo, char hi) noexcept
+        {
+            return _mm_and_si128(_mm_cmpgt_epi8(bytes, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                                 _mm_cmplt_epi8(bytes, _mm_set1_epi8(static_cast<char>(hi + 1))));
+        }
+
+        inline __m128i spaceMask(__m128i bytes) noexcept
+        {
+            return _mm_or_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), inRange(bytes, '\t', '\r'));
+        }
+
+        inline __m128i alnumMask(__m128i bytes) noexcept
+        {
+            __m128i lower = _mm_or_si128(bytes, _mm_set1_epi8(0x20));
+            return _mm_or_si128(inRange(bytes, '0', '9'), inRange(lower, 'a', 'z'));
+        }
+
+        inline __m128i numberMask(__m128i bytes) noexcept
+        {
+            return _mm_or_si128(inRange(bytes, '0', '9'), _mm_cmpeq_epi8(bytes, _mm_set1_epi8('.')));
+        }
+#endif
+
+        template <typename SimdClass, typename ScalarClass>
+        char const *skipWhile(char const *first, char const *last, SimdClass simdClass, ScalarClass scalarClass) noexcept
+        {
+#ifdef __SSE2__
+            while (last - first >= 16)
+            {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(first));
+                unsigned outside = ~static_cast<unsigned>(_mm_movemask_epi8(simdClass(bytes))) & 0xffffu;
+
+                if (outside != 0)
+                {
+                    return first + __builtin_ctz(outside);
+                }
+
+                first += 16;
+            }
+#else
+            (void)simdClass;
+#endif
+
+            while (first != last && scalarClass(*first))
+            {
+                ++first;
+            }
+
+            return first;
+        }
+    }
+
+    char const *skipWhitespace(char const *first, char const *last) noexcept
+    {
+#ifdef __SSE2__
+        return skipWhile(first, last, spaceMask, isSpace);
+#else
+        return skipWhile(first, last, nullptr, isSpace);
+#endif
+    }
+
+    char const *skipAlnum(char const *first, char const *last) noexcept
+    {
+#ifdef __SSE2__
+        return skipWhile(first, last, alnumMask, isAlnum);
+#else
+        return skipWhile(first, last, nullptr, isAlnum);
+#endif
+    }
+
+    char const *skipNumberChars(char const *first, char const *last) noexcept
+    {
+#ifdef __SSE2__
+        return skipWhile(first, last, numberMask, isNumberChar);
+#else
+        return skipWhile(first, last, nullptr, isNumberChar);
+#endif
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef INCLUDED_KALEIDOSCOPE_CHARSCAN_HPP
+#define INCLUDED_KALEIDOSCOPE_CHARSCAN_HPP
+
+namespace kaleidoscope
+{
+    // Character class scanners for the buffer lexer. Each returns a pointer to
+    // the first character in [first, last) that is not in the class, or last.
+    // The character classes are those of the "C" locale, i.e. what the stream
+    // lexer gets from std::isspace, std::isalnum and std::isdigit.
+    char const *skipWhitespace(char const *first, char const *last) noexcept;
+    char const *skipAlnum(char const *first, char const *last) noexcept;
+    char const *skipNumberChars(char const *first, char const *last) noexcept;
+}
+
+#endif
@@ -1,6 +1,10 @@
 #include "codegen.hpp"
 
+#include "arrays.hpp"
+#include "simplifier.hpp"
+
 #include <llvm/IR/Constants.h>
+#include <llvm/IR/MDBuilder.h>
 #include <llvm/IR/Verifier.h>
 
 #include <boost/format.hpp>
@@ -9,6 +13,8 @@
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <span>
 #include <sstream>
 #include <utility>
 
@@ -19,348 +25,1674 @@ namespace kaleidoscope
     {
     }
 
-    CodeGenerator::CodeGenerator(Parser &p, llvm::DataLayout dataLayout, std::string const &moduleName, bool disableDebug)
-        : TheParser(p),
+    namespace
+    {
+        llvm::FastMathFlags getFastMathFlags(FastMath fastMath)
+        {
+            llvm::FastMathFlags flags;
+            flags.setAllowReassoc(allows(fastMath, FastMath::Reassoc));
+            flags.setAllowContract(allows(fastMath, FastMath::Contract));
+            flags.setNoNaNs(allows(fastMath, FastMath::NoNaNs));
+            flags.setNoInfs(allows(fastMath, FastMath::NoInfs));
+            flags.setNoSignedZeros(allows(fastMath, FastMath::NoSignedZeros));
+            flags.setAllowReciprocal(allows(fastMath, FastMath::AllowReciprocal));
+            flags.setApproxFunc(allows(fastMath, FastMath::ApproxFunc));
+
+            return flags;
+        }
+
+        // The code generator resets its target options from these attributes
+        // for every function, so they override those of the target machine.
+        void addFastMathAttributes(llvm::Function &F, FastMath fastMath)
+        {
+            constexpr auto unsafe = FastMath::Reassoc | FastMath::NoSignedZeros | FastMath::AllowReciprocal;
+
+            std::pair<char const *, bool> const attributes[] = {
+                {"unsafe-fp-math", allows(fastMath, unsafe)},
+                {"no-nans-fp-math", allows(fastMath, FastMath::NoNaNs)},
+                {"no-infs-fp-math", allows(fastMath, FastMath::NoInfs)},
+                {"no-signed-zeros-fp-math", allows(fastMath, FastMath::NoSignedZeros)},
+                {"approx-func-fp-math", allows(fastMath, FastMath::ApproxFunc)}};
+
+            for (auto [name, value] : attributes)
+            {
+                if (value)
+                {
+                    F.addFnAttr(name, "true");
+                }
+            }
+        }
+    }
+
+    void applyFastMath(llvm::TargetOptions &options, FastMath fastMath)
+    {
+        options.UnsafeFPMath = allows(fastMath, FastMath::Reassoc | FastMath::NoSignedZeros | FastMath::AllowReciprocal);
+        options.NoNaNsFPMath = allows(fastMath, FastMath::NoNaNs);
+        options.NoInfsFPMath = allows(fastMath, FastMath::NoInfs);
+        options.NoSignedZerosFPMath = allows(fastMath, FastMath::NoSignedZeros);
+        options.ApproxFuncFPMath = allows(fastMath, FastMath::ApproxFunc);
+        options.AllowFPOpFusion = allows(fastMath, FastMath::Contract) ? llvm::FPOpFusion::Fast : llvm::FPOpFusion::Standard;
+    }
+
+    CodeGenerator::CodeGenerator(Parser &p, llvm::DataLayout dataLayout, std::string const &moduleName, DebugLevel debugLevel)
+        : CodeGenerator(std::move(dataLayout), moduleName, debugLevel)
+    {
+        TheParser = &p;
+    }
+
+    CodeGenerator::CodeGenerator(llvm::DataLayout dataLayout, std::string const &moduleName, DebugLevel debugLevel)
+        : TheParser(nullptr),
           dataLayout(std::move(dataLayout)),
-          TheContext(std::make_unique<llvm::LLVMContext>()),
-          disableDebug_(disableDebug),
+          debugLevel_(debugLevel),
           globalSymbols_(nullptr),
           activeScope_(&globalSymbols_)
     {
         finalizeModule(moduleName);
     }
 
+    CodeGenerator::CodeGenerator(CodeGenerator const &parent, std::string const &moduleName)
+        : CodeGenerator(parent.dataLayout, moduleName, parent.debugLevel_)
+    {
+        memoOptions_ = parent.memoOptions_;
+        reductionOptions_ = parent.reductionOptions_;
+        fastMath_ = parent.fastMath_;
+        precision_ = parent.precision_;
+        FunctionProtos = parent.FunctionProtos;
+        effects_ = parent.effects_;
+    }
+
     llvm::orc::ThreadSafeModule CodeGenerator::finalizeModule(std::string const &newModuleName)
     {
+        auto moduleContext = context_;
+        std::optional<llvm::orc::ThreadSafeContext::Lock> lock;
+
+        // functions declared before the definitions of their callees arrived
+        // may have become pure since
+        if (TheModule)
+        {
+            lock.emplace(moduleContext.getLock());
+
+            for (auto &function : TheModule->functions())
+            {
+                if (!function.hasLocalLinkage() && !function.isIntrinsic())
+                {
+                    applyEffects(&function);
+                }
+            }
+        }
+
         if (debugInfo_)
         {
             debugInfo_->finalize();
         }
 
-        auto ctx = std::make_unique<llvm::LLVMContext>();
-        auto mod = std::make_unique<llvm::Module>(newModuleName, *ctx);
-        mod->setDataLayout(dataLayout);
+        auto mod = std::move(TheModule);
+        debugInfo_.reset();
+        lock.reset();
+
+        // ORC keeps the previous context alive until its last module is gone
+        if (contextModules_ == 0 || contextModules_ >= modulesPerContext_)
+        {
+            context_ = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+            TheContext = context_.getContext();
+            TheBuilder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+            contextModules_ = 0;
+        }
+        else
+        {
+            // the builder must not refer to the previous module any more
+            TheBuilder->ClearInsertionPoint();
+            TheBuilder->SetCurrentDebugLocation(llvm::DebugLoc());
+        }
+
+        ++contextModules_;
 
-        TheContext.swap(ctx);
-        TheModule.swap(mod);
-        TheBuilder = std::make_unique<llvm::IRBuilder<>>(*TheContext);
+        TheModule = std::make_unique<llvm::Module>(newModuleName, *TheContext);
+        TheModule->setDataLayout(dataLayout);
 
-        debugInfo_ = std::make_unique<DebugInfo>(*TheModule, disableDebug_);
+        debugInfo_ = std::make_unique<DebugInfo>(*TheModule, debugLevel_);
 
-        return llvm::orc::ThreadSafeModule(std::move(mod), std::move(ctx));
+        return llvm::orc::ThreadSafeModule(std::move(mod), std::move(moduleContext));
     }
 
     llvm::Value *CodeGenerator::getConstant(double value) const
     {
-        return llvm::ConstantFP::get(*TheContext, llvm::APFloat(value));
+        return llvm::ConstantFP::get(floatTy_, value);
     }
 
-    llvm::Value *CodeGenerator::generateOptional(ExprAST const *ast, double defaultValue)
+    llvm::Value *CodeGenerator::getBoolCondition(llvm::Value *condValue, llvm::Twine const &name)
     {
-        return ast ? (*this)(*ast) : getConstant(defaultValue);
+        if (condValue->getType()->isFloatingPointTy())
+        {
+            return TheBuilder->CreateFCmpONE(condValue, llvm::ConstantFP::get(condValue->getType(), 0.0), name);
+        }
+
+        return convert(condValue, TheBuilder->getInt1Ty());
     }
 
-    llvm::Value *CodeGenerator::getBoolCondition(llvm::Value *condValue, llvm::Twine const &name)
+    llvm::Type *CodeGenerator::getType(ValueType type) const
     {
-        return TheBuilder->CreateFCmpONE(condValue, getConstant(0.0), name);
+        switch (type)
+        {
+        case ValueType::Int:
+            return llvm::Type::getInt64Ty(*TheContext);
+        case ValueType::Bool:
+            return llvm::Type::getInt1Ty(*TheContext);
+        case ValueType::Array:
+            return llvm::Type::getDoublePtrTy(*TheContext);
+        default:
+            return floatTy_;
+        }
     }
 
-    llvm::AllocaInst *CodeGenerator::createScopedVariable(llvm::Function *F, std::string const &varName)
+    llvm::Type *CodeGenerator::getFloatType(Precision precision) const
     {
-        llvm::IRBuilder<> tempBuilder(&F->getEntryBlock(), F->getEntryBlock().begin());
-        return tempBuilder.CreateAlloca(llvm::Type::getDoubleTy(*TheContext), 0, varName.c_str());
+        return precision == Precision::Single ? llvm::Type::getFloatTy(*TheContext) : llvm::Type::getDoubleTy(*TheContext);
     }
 
-    llvm::Value *CodeGenerator::operator()(ExprAST const &expr)
+    llvm::Value *CodeGenerator::convert(llvm::Value *value, llvm::Type *type)
     {
-        return std::visit(*this, expr);
+        auto from = value->getType();
+
+        if (from == type)
+        {
+            return value;
+        }
+
+        // arrays and numbers do not convert into each other
+        if (from->isPointerTy())
+        {
+            throw CodeGenerationError("expected a number, not an array");
+        }
+
+        if (type->isPointerTy())
+        {
+            throw CodeGenerationError("expected an array, not a number");
+        }
+
+        if (type->isFloatingPointTy() && from->isFloatingPointTy())
+        {
+            // between functions of different precision
+            return TheBuilder->CreateFPCast(value, type, "fpcast");
+        }
+
+        if (type->isFloatingPointTy())
+        {
+            // i1 is 0 or 1, i64 values are exact integers
+            return from->isIntegerTy(1) ? TheBuilder->CreateUIToFP(value, type, "booltmp") : TheBuilder->CreateSIToFP(value, type, "inttmp");
+        }
+
+        if (type->isIntegerTy(1))
+        {
+            return from->isFloatingPointTy() ? TheBuilder->CreateFCmpONE(value, llvm::ConstantFP::get(from, 0.0), "tobool") : TheBuilder->CreateICmpNE(value, llvm::ConstantInt::get(from, 0), "tobool");
+        }
+
+        return from->isIntegerTy(1) ? TheBuilder->CreateZExt(value, type, "toint") : TheBuilder->CreateFPToSI(value, type, "toint");
     }
 
-    llvm::Value *CodeGenerator::operator()(NumberExprAST const &expr)
+    llvm::Value *CodeGenerator::toFloat(llvm::Value *value)
     {
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
-        return getConstant(expr.getVal());
+        return convert(value, floatTy_);
     }
 
-    llvm::Value *CodeGenerator::operator()(VariableExprAST const &expr)
+    void CodeGenerator::returnValue(llvm::Value *value)
     {
-        auto value = activeScope_->tryLookup(expr.getName());
-
-        if (value == nullptr)
+        // nullptr: the expression in tail position has returned already
+        if (value != nullptr)
         {
-            throw CodeGenerationError("Unknown variable " + expr.getName());
+            TheBuilder->CreateRet(convert(value, TheBuilder->GetInsertBlock()->getParent()->getReturnType()));
         }
+    }
 
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
-        return TheBuilder->CreateLoad(llvm::Type::getDoubleTy(*TheContext), value, expr.getName().c_str());
+    llvm::Value *CodeGenerator::getArrayData(llvm::Value *array)
+    {
+        return convert(array, llvm::Type::getDoublePtrTy(*TheContext));
     }
 
-    llvm::Value *CodeGenerator::operator()(UnaryExprAST const &expr)
+    // The length of an array never changes, so its load is invariant and can
+    // be hoisted out of loops even if they call functions or store elements.
+    llvm::Value *CodeGenerator::getArrayLength(llvm::Value *data)
     {
-        auto opd = (*this)(expr.getOperand());
-        auto F = getFunction(std::string("unary") + expr.getOp(), "Unknown unary operator %1%");
+        auto int64Ty = TheBuilder->getInt64Ty();
+        auto lengths = TheBuilder->CreateBitCast(data, int64Ty->getPointerTo());
+        auto lengthAddress = TheBuilder->CreateInBoundsGEP(int64Ty, lengths, TheBuilder->getInt64(ArrayLayout::lengthIndex), "lenaddr");
 
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
-        return TheBuilder->CreateCall(F, opd, "unop");
+        auto length = TheBuilder->CreateLoad(int64Ty, lengthAddress, "len");
+        length->setMetadata(llvm::LLVMContext::MD_tbaa, getArrayAccessTag(true));
+        length->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(*TheContext, {}));
+
+        return length;
     }
 
-    llvm::Value *CodeGenerator::operator()(BinaryExprAST const &expr)
+    llvm::Value *CodeGenerator::getElementAddress(llvm::Value *array, llvm::Value *index)
     {
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+        auto data = getArrayData(array);
+        return TheBuilder->CreateInBoundsGEP(TheBuilder->getDoubleTy(), data, convert(index, TheBuilder->getInt64Ty()), "elementaddr");
+    }
 
-        if (expr.getOp() == '=')
-        {
-            if (auto destVarAST = std::get_if<VariableExprAST>(&expr.getLHS()))
-            {
-                auto destVarSpace = activeScope_->tryLookup(destVarAST->getName());
-                auto assignedValue = (*this)(expr.getRHS());
+    llvm::MDNode *CodeGenerator::getArrayAccessTag(bool length)
+    {
+        llvm::MDBuilder mdBuilder(*TheContext);
 
-                TheBuilder->CreateStore(assignedValue, destVarSpace);
+        auto root = mdBuilder.createTBAARoot("Kaleidoscope arrays");
+        auto type = mdBuilder.createTBAAScalarTypeNode(length ? "length" : "element", root);
 
-                return assignedValue;
-            }
-            else
+        return mdBuilder.createTBAAStructTagNode(type, type, 0);
+    }
+
+    // The loop ID is a distinct node whose first operand is the node itself,
+    // followed by one node per hint.
+    llvm::MDNode *CodeGenerator::getLoopMetadata(LoopHints const &hints)
+    {
+        llvm::SmallVector<llvm::Metadata *, 5> operands{nullptr};
+
+        auto addHint = [&](llvm::StringRef name, std::optional<std::uint32_t> value)
+        {
+            llvm::SmallVector<llvm::Metadata *, 2> hint{llvm::MDString::get(*TheContext, name)};
+
+            if (value)
             {
-                throw CodeGenerationError("destination of '=' must be a variable");
+                hint.push_back(llvm::ConstantAsMetadata::get(TheBuilder->getInt32(*value)));
             }
+
+            operands.push_back(llvm::MDNode::get(*TheContext, hint));
+        };
+
+        if (hints.unroll == 1)
+        {
+            addHint("llvm.loop.unroll.disable", std::nullopt);
         }
-        else
+        else if (hints.unroll > 1)
         {
-            llvm::Value *L = (*this)(expr.getLHS());
-            llvm::Value *R = (*this)(expr.getRHS());
-
-            switch (expr.getOp())
-            {
-            case '+':
-                return TheBuilder->CreateFAdd(L, R, "addtmp");
-            case '-':
-                return TheBuilder->CreateFSub(L, R, "subtmp");
-            case '*':
-                return TheBuilder->CreateFMul(L, R, "multmp");
-            case '/':
-                return TheBuilder->CreateFDiv(L, R, "divtmp");
-            case '<':
-            {
-                llvm::Value *C = TheBuilder->CreateFCmpULT(L, R, "cmptmp");
+            addHint("llvm.loop.unroll.count", hints.unroll);
+        }
 
-                return TheBuilder->CreateUIToFP(C, llvm::Type::getDoubleTy(*TheContext), "booltmp");
-            }
-            default:
-                break;
-            }
+        if (hints.vectorize > 1)
+        {
+            operands.push_back(llvm::MDNode::get(*TheContext, {llvm::MDString::get(*TheContext, "llvm.loop.vectorize.enable"),
+                                                               llvm::ConstantAsMetadata::get(TheBuilder->getTrue())}));
+        }
 
-            auto F = getFunction(std::string("binary") + expr.getOp(), "binary operator %1% not found!");
+        if (hints.vectorize != 0)
+        {
+            addHint("llvm.loop.vectorize.width", hints.vectorize);
+        }
 
-            llvm::Value *Vals[] = {L, R};
-            return TheBuilder->CreateCall(F, Vals, "binop");
+        if (hints.interleave != 0)
+        {
+            addHint("llvm.loop.interleave.count", hints.interleave);
         }
+
+        auto loopID = llvm::MDNode::getDistinct(*TheContext, operands);
+        loopID->replaceOperandWith(0, loopID);
+
+        return loopID;
     }
 
-    llvm::Value *CodeGenerator::operator()(CallExprAST const &expr)
+    llvm::AllocaInst *CodeGenerator::createScopedVariable(llvm::Function *F, Symbol varName, llvm::Type *type)
     {
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+        llvm::IRBuilder<> tempBuilder(&F->getEntryBlock(), F->getEntryBlock().begin());
+        return tempBuilder.CreateAlloca(type, 0, llvm::StringRef(varName.str()));
+    }
 
-        // Look up the name in the global module table.
-        llvm::Function *CalleeF = getFunction(expr.getCallee(), "Unknown function referenced: %1%");
+    Variable CodeGenerator::declareVariable(Symbol name, llvm::Type *type)
+    {
+        return ssa_.declare(name, type);
+    }
 
-        // If argument mismatch error.
-        if (CalleeF->arg_size() != expr.getArgs().size())
-            throw CodeGenerationError("Incorrect # arguments passed");
+    llvm::Value *CodeGenerator::readVariable(Variable variable)
+    {
+        return ssa_.read(variable, TheBuilder->GetInsertBlock());
+    }
 
-        std::vector<llvm::Value *> ArgsV;
-        ArgsV.reserve(expr.getArgs().size());
-        std::transform(begin(expr.getArgs()), end(expr.getArgs()), std::back_inserter(ArgsV), std::ref(*this));
+    void CodeGenerator::writeVariable(Variable variable, llvm::Value *value)
+    {
+        ssa_.write(variable, TheBuilder->GetInsertBlock(), value);
 
-        return TheBuilder->CreateCall(CalleeF, ArgsV, "calltmp");
+        if (variable.debugSpace != nullptr)
+        {
+            TheBuilder->CreateStore(value, variable.debugSpace);
+        }
     }
 
-    llvm::Value *CodeGenerator::operator()(IfExprAST const &expr)
+    std::vector<std::pair<Symbol, Variable>> CodeGenerator::getCapturedVariables(ExprRef expr, Symbol excluded) const
     {
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+        std::vector<std::pair<Symbol, Variable>> captured;
+        std::vector<ExprRef> pending{expr};
 
-        auto conditionValue = (*this)(expr.getCondition());
-        auto condition = getBoolCondition(conditionValue, "ifcond");
+        while (!pending.empty())
+        {
+            auto const &node = (*arena_)[pending.back()];
+            pending.pop_back();
 
-        auto parentFunction = TheBuilder->GetInsertBlock()->getParent();
+            if (auto reference = std::get_if<VariableExprAST>(&node))
+            {
+                auto name = reference->getName();
+                auto variable = activeScope_->tryLookup(name);
 
-        auto ThenBBStart = llvm::BasicBlock::Create(*TheContext, "then", parentFunction);
-        auto ElseBBStart = llvm::BasicBlock::Create(*TheContext, "else", parentFunction);
-        auto MergeBB = llvm::BasicBlock::Create(*TheContext, "ifcont", parentFunction);
+                bool known = std::any_of(captured.begin(), captured.end(), [name](auto const &entry)
+                                         { return entry.first == name; });
 
-        TheBuilder->CreateCondBr(condition, ThenBBStart, ElseBBStart);
+                if (variable && name != excluded && !known)
+                {
+                    captured.emplace_back(name, *variable);
+                }
+            }
 
-        TheBuilder->SetInsertPoint(ThenBBStart);
-        auto valThen = (*this)(expr.getThenBranch());
-        TheBuilder->CreateBr(MergeBB);
-        auto ThenBBEnd = TheBuilder->GetInsertBlock();
+            arena_->forEachChild(node, [&pending](ExprRef child)
+                                 { pending.push_back(child); });
+        }
 
-        TheBuilder->SetInsertPoint(ElseBBStart);
-        auto valElse = (*this)(expr.getElseBranch());
-        TheBuilder->CreateBr(MergeBB);
-        auto ElseBBEnd = TheBuilder->GetInsertBlock();
+        return captured;
+    }
 
-        TheBuilder->SetInsertPoint(MergeBB);
+    llvm::Value *CodeGenerator::popValue()
+    {
+        auto value = emitValues_.back();
+        emitValues_.pop_back();
+        return value;
+    }
 
-        auto PN = TheBuilder->CreatePHI(llvm::Type::getDoubleTy(*TheContext), 2, "iftmp");
-        PN->addIncoming(valThen, ThenBBEnd);
-        PN->addIncoming(valElse, ElseBBEnd);
+    bool CodeGenerator::descend(ExprRef child, bool tail)
+    {
+        emitTasks_.emplace_back(child, tail);
+        return false;
+    }
 
-        return PN;
+    bool CodeGenerator::finish(llvm::Value *result)
+    {
+        emitValues_.push_back(result);
+        return true;
     }
 
-    llvm::Value *CodeGenerator::operator()(ForExprAST const &expr)
+    // A call in tail position is returned right away. If the callee has the
+    // same function type as the caller, i.e. the same argument and result
+    // types in the same precision, arrays in the same places, and the same
+    // calling convention, it is a musttail call, which the backend always
+    // lowers to a jump, whatever the optimisation level. Other calls in tail
+    // position, e.g. of a function of another precision, are only marked as
+    // candidates for tail call elimination.
+    bool CodeGenerator::finishCall(llvm::Function *callee, llvm::ArrayRef<llvm::Value *> args, llvm::Twine const &name, EmitTask const &task)
     {
-        auto TheFunction = TheBuilder->GetInsertBlock()->getParent();
-        auto loopVarSpace = createScopedVariable(TheFunction, expr.getVarName());
+        std::vector<llvm::Value *> convertedArgs;
+        for (std::size_t i = 0; i < args.size(); ++i)
+        {
+            convertedArgs.push_back(convert(args[i], callee->getArg(i)->getType()));
+        }
 
-        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+        auto call = TheBuilder->CreateCall(callee, convertedArgs, name);
+
+        if (!task.tail)
+        {
+            return finish(call);
+        }
 
-        auto startVal = (*this)(expr.getStart());
-        TheBuilder->CreateStore(startVal, loopVarSpace);
+        auto caller = TheBuilder->GetInsertBlock()->getParent();
+        bool mustTail = callee->getFunctionType() == caller->getFunctionType() && callee->getCallingConv() == caller->getCallingConv();
 
-        auto LoopBB = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction);
-        // explicit fall-through from current to loop. Implicit is not allowed.
-        TheBuilder->CreateBr(LoopBB);
-        TheBuilder->SetInsertPoint(LoopBB);
+        call->setTailCallKind(mustTail ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+        TheBuilder->CreateRet(convert(call, caller->getReturnType()));
 
-        {
-            SymbolScope loopScope(activeScope_);
-            loopScope.tryDeclare(expr.getVarName(), loopVarSpace);
+        return finish(nullptr);
+    }
 
-            (*this)(expr.getBody());
+    // Expressions are emitted with an explicit task stack rather than by recursion,
+    // so deeply nested expressions do not grow the native stack. A step either
+    // descends into a child (and is resumed at its next stage once the child's
+    // value is on emitValues_) or finishes by pushing its own value.
+    llvm::Value *CodeGenerator::operator()(ExprRef expr)
+    {
+        return emit(expr, false);
+    }
+
+    llvm::Value *CodeGenerator::emit(ExprRef expr, bool tail)
+    {
+        auto taskBase = emitTasks_.size();
+        auto valueBase = emitValues_.size();
 
-            llvm::Value *StepVal = generateOptional(expr.getStep(), 1.0);
+        descend(expr, tail);
 
-            llvm::Value *curLoopVarValue = TheBuilder->CreateLoad(llvm::Type::getDoubleTy(*TheContext), loopVarSpace, expr.getVarName());
-            llvm::Value *nextLoopVarValue = TheBuilder->CreateFAdd(curLoopVarValue, StepVal, "nextVar");
-            TheBuilder->CreateStore(nextLoopVarValue, loopVarSpace);
+        try
+        {
+            while (emitTasks_.size() > taskBase)
+            {
+                auto &task = emitTasks_.back();
+                bool finished = std::visit([this, &task](auto const &node)
+                                           { return step(node, task); },
+                                           (*arena_)[task.expr]);
 
-            llvm::Value *endVal = (*this)(expr.getEnd());
-            llvm::Value *endCond = getBoolCondition(endVal, "loopcond");
+                if (finished)
+                {
+                    emitTasks_.pop_back();
+                }
+            }
+        }
+        catch (...)
+        {
+            // symbol scopes held by the tasks must be closed innermost first
+            while (emitTasks_.size() > taskBase)
+            {
+                emitTasks_.pop_back();
+            }
 
-            auto AfterBB = llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
-            TheBuilder->CreateCondBr(endCond, LoopBB, AfterBB);
-            TheBuilder->SetInsertPoint(AfterBB);
+            emitValues_.resize(valueBase);
+            throw;
         }
 
-        return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*TheContext));
+        return popValue();
     }
 
-    llvm::Value *CodeGenerator::operator()(VarExprAST const &expr)
+    bool CodeGenerator::step(NumberExprAST const &expr, EmitTask &task)
     {
-        SymbolScope varScope(activeScope_);
-        auto F = TheBuilder->GetInsertBlock()->getParent();
+        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
 
-        for (auto &decl : expr.getDeclarations())
+        if (types_.getType(task.expr) == ValueType::Int)
         {
-            llvm::Value *initVal = (*this)(decl.getInitVal());
+            return finish(TheBuilder->getInt64(static_cast<std::int64_t>(expr.getVal())));
+        }
 
-            auto space = createScopedVariable(F, decl.getName());
-            TheBuilder->CreateStore(initVal, space);
+        return finish(getConstant(expr.getVal()));
+    }
 
-            if (!varScope.tryDeclare(decl.getName(), space))
-            {
-                throw CodeGenerationError("redefined variable '" + decl.getName() + "' in var block");
-            }
+    bool CodeGenerator::step(VariableExprAST const &expr, EmitTask &)
+    {
+        auto variable = activeScope_->tryLookup(expr.getName());
+
+        if (!variable)
+        {
+            throw CodeGenerationError("Unknown variable " + std::string(expr.getName().str()));
         }
 
         debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
-        return (*this)(expr.getBody());
+        return finish(readVariable(*variable));
     }
 
-    llvm::Function *CodeGenerator::getFunction(std::string const &name, std::string const &errmsg_format)
+    bool CodeGenerator::step(UnaryExprAST const &expr, EmitTask &task)
     {
-        llvm::Function *F = TheModule->getFunction(name);
-
-        if (F)
+        if (task.stage++ == 0)
         {
-            return F;
+            return descend(expr.getOperand());
         }
 
-        auto FI = FunctionProtos.find(name);
-
-        if (FI != FunctionProtos.end())
+        if (expr.getOp() == '!')
         {
-            return (*this)(FI->second);
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return finish(TheBuilder->CreateNot(getBoolCondition(popValue(), "tobool"), "nottmp"));
         }
 
-        std::ostringstream formatter;
-        formatter << boost::format(errmsg_format) % name;
+        llvm::Value *opd[] = {popValue()};
+        Symbol name(std::string("unary") + expr.getOp());
+        auto F = getFunction(name, "Unknown unary operator %1%");
 
-        throw CodeGenerationError(formatter.str());
+        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+        return finishCall(F, getCallArguments(name, opd), "unop", task);
     }
 
-    llvm::Function *CodeGenerator::operator()(PrototypeAST const &expr)
+    bool CodeGenerator::step(BinaryExprAST const &expr, EmitTask &task)
     {
-        std::vector<llvm::Type *> Doubles(expr.getArgs().size(), llvm::Type::getDoubleTy(*TheContext));
+        if (expr.getOp() == op_and || expr.getOp() == op_or)
+        {
+            return stepLogical(expr, task);
+        }
 
-        llvm::FunctionType *FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*TheContext), Doubles, false);
-        llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, expr.getName(), *TheModule);
+        if (expr.getOp() == '=')
+        {
+            if (auto element = std::get_if<IndexExprAST>(&(*arena_)[expr.getLHS()]))
+            {
+                return stepElementAssignment(expr, *element, task);
+            }
 
-        std::size_t ix = 0;
-        for (auto &arg : F->args())
+            if (task.stage++ == 0)
+            {
+                debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+
+                if (auto destVarAST = std::get_if<VariableExprAST>(&(*arena_)[expr.getLHS()]))
+                {
+                    auto variable = activeScope_->tryLookup(destVarAST->getName());
+
+                    if (!variable)
+                    {
+                        throw CodeGenerationError("Unknown variable " + std::string(destVarAST->getName().str()));
+                    }
+
+                    task.variable = *variable;
+                    return descend(expr.getRHS());
+                }
+                else
+                {
+                    throw CodeGenerationError("destination of '=' must be a variable or an array element");
+                }
+            }
+
+            auto assignedValue = convert(popValue(), ssa_.getType(task.variable));
+            writeVariable(task.variable, assignedValue);
+
+            return finish(assignedValue);
+        }
+
+        switch (task.stage++)
         {
-            arg.setName(expr.getArgs()[ix]);
-            ++ix;
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(expr.getLHS());
+        case 1:
+            return descend(expr.getRHS());
+        default:
+            break;
         }
 
-        return F;
+        llvm::Value *R = popValue();
+        llvm::Value *L = popValue();
+
+        if (expr.getOp() == '<')
+        {
+            // the i1 is converted where a double is needed
+            if (L->getType()->isIntegerTy(64) && R->getType()->isIntegerTy(64))
+            {
+                return finish(TheBuilder->CreateICmpSLT(L, R, "cmptmp"));
+            }
+
+            return finish(TheBuilder->CreateFCmpULT(toFloat(L), toFloat(R), "cmptmp"));
+        }
+
+        switch (expr.getOp())
+        {
+        case '+':
+            return finish(TheBuilder->CreateFAdd(toFloat(L), toFloat(R), "addtmp"));
+        case '-':
+            return finish(TheBuilder->CreateFSub(toFloat(L), toFloat(R), "subtmp"));
+        case '*':
+            return finish(TheBuilder->CreateFMul(toFloat(L), toFloat(R), "multmp"));
+        case '/':
+            return finish(TheBuilder->CreateFDiv(toFloat(L), toFloat(R), "divtmp"));
+        default:
+            break;
+        }
+
+        // the operands of a user-defined operator may be arrays
+        Symbol name(std::string("binary") + expr.getOp());
+        auto F = getFunction(name, "binary operator %1% not found!");
+
+        llvm::Value *Vals[] = {L, R};
+        return finishCall(F, getCallArguments(name, Vals), "binop", task);
     }
 
-    void CodeGenerator::registerExtern(PrototypeAST ast)
+    // a[i] = v evaluates a, i and v in this order and is v
+    bool CodeGenerator::stepElementAssignment(BinaryExprAST const &expr, IndexExprAST const &element, EmitTask &task)
     {
-        FunctionProtos.insert_or_assign(ast.getName(), ast);
+        switch (task.stage++)
+        {
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(element.getArray());
+        case 1:
+            return descend(element.getIndex());
+        case 2:
+            return descend(expr.getRHS());
+        default:
+            break;
+        }
+
+        auto value = convert(popValue(), TheBuilder->getDoubleTy());
+        auto index = popValue();
+        auto address = getElementAddress(popValue(), index);
+
+        auto store = TheBuilder->CreateStore(value, address);
+        store->setMetadata(llvm::LLVMContext::MD_tbaa, getArrayAccessTag(false));
+
+        return finish(value);
     }
 
-    llvm::Function *CodeGenerator::operator()(FunctionAST const &expr)
+    // && and || evaluate their right operand only if the left one does not decide the result
+    bool CodeGenerator::stepLogical(BinaryExprAST const &expr, EmitTask &task)
     {
-        llvm::Function *F = nullptr;
+        auto &[LHSBBEnd, RHSBBStart, MergeBB] = task.blocks;
+        bool isAnd = expr.getOp() == op_and;
 
-        try
+        switch (task.stage++)
         {
-            registerExtern(expr.getProto());
-            F = getFunction(expr.getProto().getName(), "Could not create function %1%");
-
-            TheParser.registerOperator(expr.getProto());
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(expr.getLHS());
+        case 1:
+        {
+            auto lhsCondition = getBoolCondition(popValue(), "lhscond");
 
-            llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*TheContext, "entry", F);
-            TheBuilder->SetInsertPoint(entryBlock);
+            auto parentFunction = TheBuilder->GetInsertBlock()->getParent();
+            LHSBBEnd = TheBuilder->GetInsertBlock();
+            RHSBBStart = llvm::BasicBlock::Create(*TheContext, isAnd ? "andrhs" : "orrhs", parentFunction);
+            MergeBB = llvm::BasicBlock::Create(*TheContext, isAnd ? "andcont" : "orcont", parentFunction);
 
+            if (isAnd)
             {
-                DebugScope debugScope(*debugInfo_, *TheBuilder, F, expr.getProto());
-                SymbolScope functionScope(activeScope_);
+                TheBuilder->CreateCondBr(lhsCondition, RHSBBStart, MergeBB);
+            }
+            else
+            {
+                TheBuilder->CreateCondBr(lhsCondition, MergeBB, RHSBBStart);
+            }
 
-                int argIdx = 0;
-                for (auto &arg : F->args())
-                {
-                    auto varSpace = createScopedVariable(F, arg.getName().str());
-                    debugInfo_->declareParameter(*TheBuilder, varSpace, arg.getName().str(), argIdx, expr.getProto().getLocation());
-                    TheBuilder->CreateStore(&arg, varSpace);
-                    functionScope.tryDeclare(std::string(arg.getName()), varSpace);
+            TheBuilder->SetInsertPoint(RHSBBStart);
+            return descend(expr.getRHS());
+        }
+        default:
+            break;
+        }
 
-                    ++argIdx;
-                }
+        auto rhsCondition = getBoolCondition(popValue(), "rhscond");
+        TheBuilder->CreateBr(MergeBB);
+        auto RHSBBEnd = TheBuilder->GetInsertBlock();
 
-                debugInfo_->emitLocation(*TheBuilder, std::visit([](ASTBase const &ast)
-                                                                 { return ast.getLocation(); },
-                                                                 expr.getBody()));
-                llvm::Value *bodyCode = (*this)(expr.getBody());
-                TheBuilder->CreateRet(bodyCode);
-            }
+        TheBuilder->SetInsertPoint(MergeBB);
 
-            llvm::verifyFunction(*F);
+        auto PN = TheBuilder->CreatePHI(TheBuilder->getInt1Ty(), 2, isAnd ? "andtmp" : "ortmp");
+        PN->addIncoming(TheBuilder->getInt1(!isAnd), LHSBBEnd);
+        PN->addIncoming(rhsCondition, RHSBBEnd);
 
-            return F;
+        return finish(PN);
+    }
+
+    bool CodeGenerator::step(CallExprAST const &expr, EmitTask &task)
+    {
+        auto callee = expr.getCallee();
+
+        if (callee.str() == arrayBuiltin || callee.str() == lengthBuiltin || callee.str() == releaseBuiltin)
+        {
+            return stepArrayBuiltin(expr, task);
         }
-        catch (CodeGenerationError const &e)
+
+        if (auto builtin = getMathBuiltin(callee.str()); builtin != nullptr && !(effects_.isDefined(callee) && isDeclared(callee)))
         {
-            std::cerr << e.what() << std::endl;
+            return stepMathBuiltin(expr, *builtin, task);
+        }
 
-            TheParser.removeOperator(expr.getProto());
+        auto args = arena_->getArgs(expr);
 
-            if (F != nullptr)
-            {
-                F->eraseFromParent();
+        if (task.stage == 0)
+        {
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+
+            // Look up the name in the global module table.
+            task.function = getFunction(callee, "Unknown function referenced: %1%");
+
+            // If argument mismatch error.
+            auto proto = getPrototype(callee);
+            if ((proto != nullptr ? proto->getArgs().size() : task.function->arg_size()) != args.size())
+                throw CodeGenerationError("Incorrect # arguments passed");
+        }
+
+        if (task.stage < args.size())
+        {
+            return descend(args[task.stage++]);
+        }
+
+        auto ArgsV = getCallArguments(callee, std::span(emitValues_).last(args.size()));
+        emitValues_.resize(emitValues_.size() - args.size());
+
+        return finishCall(task.function, ArgsV, "calltmp", task);
+    }
+
+    // an array argument is passed as data pointer and length
+    std::vector<llvm::Value *> CodeGenerator::getCallArguments(Symbol callee, std::span<llvm::Value *const> values)
+    {
+        auto proto = getPrototype(callee);
+        std::vector<llvm::Value *> args;
+
+        for (std::size_t i = 0; i < values.size(); ++i)
+        {
+            if (proto != nullptr && proto->isArrayArg(i))
+            {
+                auto data = getArrayData(values[i]);
+                args.push_back(data);
+                args.push_back(getArrayLength(data));
+            }
+            else
+            {
+                args.push_back(values[i]);
+            }
+        }
+
+        return args;
+    }
+
+    bool CodeGenerator::stepArrayBuiltin(CallExprAST const &expr, EmitTask &task)
+    {
+        auto args = arena_->getArgs(expr);
+
+        if (task.stage++ == 0)
+        {
+            if (args.size() != 1)
+            {
+                throw CodeGenerationError(std::string(expr.getCallee().str()) + " takes one argument");
+            }
+
+            return descend(args[0]);
+        }
+
+        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+
+        if (expr.getCallee().str() == lengthBuiltin)
+        {
+            return finish(getArrayLength(getArrayData(popValue())));
+        }
+
+        auto doublePtrTy = TheBuilder->getDoubleTy()->getPointerTo();
+
+        if (expr.getCallee().str() == releaseBuiltin)
+        {
+            auto release = TheModule->getOrInsertFunction("kaleidoscope_array_release", TheBuilder->getVoidTy(), doublePtrTy);
+            TheBuilder->CreateCall(release, getArrayData(popValue()));
+
+            return finish(llvm::Constant::getNullValue(floatTy_));
+        }
+
+        auto int64Ty = TheBuilder->getInt64Ty();
+        auto allocate = TheModule->getOrInsertFunction("kaleidoscope_array_new", doublePtrTy, int64Ty);
+
+        // saturated, so that the runtime rejects a huge length instead of
+        // getting one that wrapped around
+        auto length = popValue();
+        if (length->getType()->isFloatingPointTy())
+        {
+            length = TheBuilder->CreateIntrinsic(llvm::Intrinsic::fptosi_sat, {int64Ty, length->getType()}, {length}, nullptr, "length");
+        }
+
+        return finish(TheBuilder->CreateCall(allocate, convert(length, int64Ty), "arraydata"));
+    }
+
+    bool CodeGenerator::stepMathBuiltin(CallExprAST const &expr, MathBuiltin const &builtin, EmitTask &task)
+    {
+        auto args = arena_->getArgs(expr);
+
+        if (task.stage == 0 && args.size() != builtin.arity)
+        {
+            throw CodeGenerationError(std::string(builtin.name) + " takes " + std::to_string(builtin.arity) + (builtin.arity == 1 ? " argument" : " arguments"));
+        }
+
+        if (task.stage < args.size())
+        {
+            return descend(args[task.stage++]);
+        }
+
+        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+
+        auto argValues = std::span(emitValues_).last(args.size());
+        std::vector<llvm::Value *> ArgsV;
+
+        std::transform(argValues.begin(), argValues.end(), std::back_inserter(ArgsV), [this](auto value)
+                       { return toFloat(value); });
+        emitValues_.resize(emitValues_.size() - args.size());
+
+        return finish(TheBuilder->CreateIntrinsic(builtin.intrinsic, {floatTy_}, ArgsV, nullptr, "mathtmp"));
+    }
+
+    bool CodeGenerator::step(IndexExprAST const &expr, EmitTask &task)
+    {
+        switch (task.stage++)
+        {
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(expr.getArray());
+        case 1:
+            return descend(expr.getIndex());
+        default:
+            break;
+        }
+
+        auto index = popValue();
+        auto element = TheBuilder->CreateLoad(TheBuilder->getDoubleTy(), getElementAddress(popValue(), index), "element");
+        element->setMetadata(llvm::LLVMContext::MD_tbaa, getArrayAccessTag(false));
+
+        return finish(element);
+    }
+
+    bool CodeGenerator::step(IfExprAST const &expr, EmitTask &task)
+    {
+        auto &[ElseBBStart, MergeBB, ThenBBEnd] = task.blocks;
+
+        switch (task.stage++)
+        {
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(expr.getCondition());
+        case 1:
+        {
+            auto condition = getBoolCondition(popValue(), "ifcond");
+
+            auto parentFunction = TheBuilder->GetInsertBlock()->getParent();
+
+            auto ThenBBStart = llvm::BasicBlock::Create(*TheContext, "then", parentFunction);
+            ElseBBStart = llvm::BasicBlock::Create(*TheContext, "else", parentFunction);
+
+            if (!task.tail)
+            {
+                MergeBB = llvm::BasicBlock::Create(*TheContext, "ifcont", parentFunction);
+            }
+
+            TheBuilder->CreateCondBr(condition, ThenBBStart, ElseBBStart);
+
+            TheBuilder->SetInsertPoint(ThenBBStart);
+            return descend(expr.getThenBranch(), task.tail);
+        }
+        case 2:
+            // in tail position each branch returns its own value, so that
+            // calls in the branches are tail calls
+            if (task.tail)
+            {
+                returnValue(popValue());
+
+                TheBuilder->SetInsertPoint(ElseBBStart);
+                return descend(expr.getElseBranch(), true);
+            }
+
+            task.value = convert(popValue(), getType(types_.getType(task.expr)));
+            TheBuilder->CreateBr(MergeBB);
+            ThenBBEnd = TheBuilder->GetInsertBlock();
+
+            TheBuilder->SetInsertPoint(ElseBBStart);
+            return descend(expr.getElseBranch());
+        default:
+            break;
+        }
+
+        if (task.tail)
+        {
+            returnValue(popValue());
+            return finish(nullptr);
+        }
+
+        auto valElse = convert(popValue(), task.value->getType());
+        TheBuilder->CreateBr(MergeBB);
+        auto ElseBBEnd = TheBuilder->GetInsertBlock();
+
+        TheBuilder->SetInsertPoint(MergeBB);
+
+        auto PN = TheBuilder->CreatePHI(task.value->getType(), 2, "iftmp");
+        PN->addIncoming(task.value, ThenBBEnd);
+        PN->addIncoming(valElse, ElseBBEnd);
+
+        return finish(PN);
+    }
+
+    bool CodeGenerator::step(ForExprAST const &expr, EmitTask &task)
+    {
+        auto TheFunction = TheBuilder->GetInsertBlock()->getParent();
+        auto &loopVar = task.variable;
+        auto &LoopBB = task.blocks[0];
+
+        switch (task.stage++)
+        {
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(expr.getStart());
+        case 1:
+            loopVar = declareVariable(expr.getVarName(), getType(types_.getLoopVariableType(task.expr)));
+            writeVariable(loopVar, convert(popValue(), ssa_.getType(loopVar)));
+
+            LoopBB = llvm::BasicBlock::Create(*TheContext, "loop", TheFunction);
+            // explicit fall-through from current to loop. Implicit is not allowed.
+            TheBuilder->CreateBr(LoopBB);
+            TheBuilder->SetInsertPoint(LoopBB);
+            ssa_.openLoopHeader(LoopBB);
+
+            task.scope = std::make_unique<SymbolScope>(activeScope_);
+            task.scope->tryDeclare(expr.getVarName(), loopVar);
+
+            return descend(expr.getBody());
+        case 2:
+            popValue(); // the body's value is not used
+
+            if (expr.getStep().isValid())
+            {
+                return descend(expr.getStep());
+            }
+
+            emitValues_.push_back(TheBuilder->getInt64(1));
+            [[fallthrough]];
+        case 3:
+        {
+            task.stage = 4;
+
+            llvm::Value *StepVal = convert(popValue(), ssa_.getType(loopVar));
+
+            llvm::Value *curLoopVarValue = readVariable(loopVar);
+            // an integer counter would need 2^53 iterations to differ from the double one
+            llvm::Value *nextLoopVarValue = StepVal->getType()->isIntegerTy()
+                                                ? TheBuilder->CreateNSWAdd(curLoopVarValue, StepVal, "nextVar")
+                                                : TheBuilder->CreateFAdd(curLoopVarValue, StepVal, "nextVar");
+            writeVariable(loopVar, nextLoopVarValue);
+
+            return descend(expr.getEnd());
+        }
+        default:
+            break;
+        }
+
+        llvm::Value *endCond = getBoolCondition(popValue(), "loopcond");
+
+        auto AfterBB = llvm::BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+        auto backEdge = TheBuilder->CreateCondBr(endCond, LoopBB, AfterBB);
+        ssa_.seal(LoopBB);
+        TheBuilder->SetInsertPoint(AfterBB);
+
+        auto hints = arena_->getLoopHints(task.expr);
+        if (!hints.empty())
+        {
+            backEdge->setMetadata(llvm::LLVMContext::MD_loop, getLoopMetadata(hints));
+        }
+
+        task.scope.reset();
+
+        return finish(llvm::Constant::getNullValue(floatTy_));
+    }
+
+    bool CodeGenerator::step(ParForExprAST const &expr, EmitTask &task)
+    {
+        return stepOutlinedLoop(expr, task);
+    }
+
+    bool CodeGenerator::step(ReductionExprAST const &expr, EmitTask &task)
+    {
+        return stepOutlinedLoop(expr, task);
+    }
+
+    // The loop of a parfor or a reduction is outlined into a function running
+    // the iterations [begin, end), which the runtime calls for the chunks of
+    // the iterations from the threads of its pool. The values of start, step
+    // and the variables the body uses are passed in a context struct; in the
+    // body they are copied to variables of its own at the start of every
+    // iteration.
+    bool CodeGenerator::stepOutlinedLoop(ForExprAST const &expr, EmitTask &task)
+    {
+        switch (task.stage++)
+        {
+        case 0:
+            debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+            return descend(expr.getStart());
+        case 1:
+            return descend(expr.getEnd());
+        case 2:
+            if (expr.getStep().isValid())
+            {
+                return descend(expr.getStep());
+            }
+
+            emitValues_.push_back(TheBuilder->getInt64(1));
+            [[fallthrough]];
+        case 3:
+            task.stage = 4;
+            return beginOutlinedLoop(expr, task);
+        default:
+            break;
+        }
+
+        return std::holds_alternative<ReductionExprAST>((*arena_)[task.expr])
+                   ? finishReduction(expr, task)
+                   : finishParallelLoop(expr, task);
+    }
+
+    bool CodeGenerator::beginOutlinedLoop(ForExprAST const &expr, EmitTask &task)
+    {
+        bool reduction = std::holds_alternative<ReductionExprAST>((*arena_)[task.expr]);
+        auto loopVarTy = getType(types_.getLoopVariableType(task.expr));
+        auto int64Ty = TheBuilder->getInt64Ty();
+
+        auto stepValue = convert(popValue(), loopVarTy);
+        auto end = toFloat(popValue());
+        auto start = convert(popValue(), loopVarTy);
+
+        // rounded up to the number of iterations
+        task.value = TheBuilder->CreateFDiv(TheBuilder->CreateFSub(end, toFloat(start)), toFloat(stepValue), "trips");
+
+        auto parent = TheBuilder->GetInsertBlock()->getParent();
+        auto captured = getCapturedVariables(expr.getBody(), expr.getVarName());
+
+        std::vector<llvm::Type *> fieldTypes{loopVarTy, loopVarTy};
+        for (auto const &[name, variable] : captured)
+        {
+            fieldTypes.push_back(ssa_.getType(variable));
+        }
+
+        auto contextTy = llvm::StructType::get(*TheContext, fieldTypes);
+        task.context = createScopedVariable(parent, Symbol(reduction ? "reduce.context" : "parfor.context"), contextTy);
+
+        TheBuilder->CreateStore(start, TheBuilder->CreateStructGEP(contextTy, task.context, 0));
+        TheBuilder->CreateStore(stepValue, TheBuilder->CreateStructGEP(contextTy, task.context, 1));
+
+        for (unsigned i = 0; i < captured.size(); ++i)
+        {
+            TheBuilder->CreateStore(readVariable(captured[i].second), TheBuilder->CreateStructGEP(contextTy, task.context, i + 2));
+        }
+
+        // kaleidoscope_reduce takes a body returning double
+        auto resultTy = reduction ? (reductionOptions_.threads ? TheBuilder->getDoubleTy() : floatTy_) : TheBuilder->getVoidTy();
+        auto bodyTy = llvm::FunctionType::get(resultTy, {TheBuilder->getInt8PtrTy(), int64Ty, int64Ty}, false);
+        auto F = llvm::Function::Create(bodyTy, llvm::Function::InternalLinkage, parent->getName() + (reduction ? ".reduce" : ".parfor"), *TheModule);
+        outlinedFunctions_.push_back(F);
+
+        // a reduction the function runs itself is only outlined for the capture
+        if (reduction && !reductionOptions_.threads)
+        {
+            F->addFnAttr(llvm::Attribute::AlwaysInline);
+        }
+
+        F->getArg(0)->setName("context");
+        F->getArg(1)->setName("begin");
+        F->getArg(2)->setName("end");
+
+        // the parent continues here once the body is complete
+        task.function = F;
+        task.blocks[0] = TheBuilder->GetInsertBlock();
+
+        auto EntryBB = llvm::BasicBlock::Create(*TheContext, "entry", F);
+        TheBuilder->SetInsertPoint(EntryBB);
+
+        task.debugScope = std::make_unique<DebugScope>(*debugInfo_, *TheBuilder, F, PrototypeAST(expr.getLocation(), Symbol(F->getName()), {}));
+        task.scope = std::make_unique<SymbolScope>(activeScope_, &globalSymbols_);
+
+        // the context does not change while the loop runs
+        auto context = TheBuilder->CreateBitCast(F->getArg(0), contextTy->getPointerTo(), "context");
+        auto loadField = [&](unsigned index, llvm::StringRef name)
+        {
+            auto field = TheBuilder->CreateLoad(fieldTypes[index], TheBuilder->CreateStructGEP(contextTy, context, index), name);
+            field->setMetadata(llvm::LLVMContext::MD_invariant_load, llvm::MDNode::get(*TheContext, {}));
+            return field;
+        };
+
+        auto loopStart = loadField(0, "start");
+        auto loopStep = loadField(1, "step");
+
+        std::vector<std::pair<llvm::Value *, Variable>> privateCopies;
+        for (unsigned i = 0; i < captured.size(); ++i)
+        {
+            auto name = captured[i].first;
+            auto variable = declareVariable(name, fieldTypes[i + 2]);
+
+            privateCopies.emplace_back(loadField(i + 2, name.str()), variable);
+            task.scope->tryDeclare(name, variable);
+        }
+
+        auto loopVariable = declareVariable(expr.getVarName(), loopVarTy);
+        task.scope->tryDeclare(expr.getVarName(), loopVariable);
+
+        // the exit moves behind the blocks of the body once they are complete
+        auto LoopBB = llvm::BasicBlock::Create(*TheContext, "loop", F);
+        task.blocks[1] = LoopBB;
+        task.blocks[2] = llvm::BasicBlock::Create(*TheContext, "afterloop", F);
+
+        TheBuilder->CreateCondBr(TheBuilder->CreateICmpSLT(F->getArg(1), F->getArg(2), "nonempty"), LoopBB, task.blocks[2]);
+        TheBuilder->SetInsertPoint(LoopBB);
+        ssa_.openLoopHeader(LoopBB);
+
+        // the iteration number, followed by the partial result of a reduction
+        auto k = TheBuilder->CreatePHI(int64Ty, 2, "k");
+        k->addIncoming(F->getArg(1), EntryBB);
+
+        if (reduction)
+        {
+            auto identity = getReductionIdentity(arena_->getReductionKind(task.expr));
+            TheBuilder->CreatePHI(floatTy_, 2, "acc")->addIncoming(identity, EntryBB);
+        }
+
+        for (auto [value, variable] : privateCopies)
+        {
+            writeVariable(variable, value);
+        }
+
+        auto loopVar = loopVarTy->isIntegerTy()
+                           ? TheBuilder->CreateNSWAdd(loopStart, TheBuilder->CreateNSWMul(k, loopStep), expr.getVarName().str())
+                           : TheBuilder->CreateFAdd(loopStart, TheBuilder->CreateFMul(TheBuilder->CreateSIToFP(k, loopVarTy), loopStep), expr.getVarName().str());
+        writeVariable(loopVariable, loopVar);
+
+        debugInfo_->emitLocation(*TheBuilder, arena_->getLocation(expr.getBody()));
+        return descend(expr.getBody());
+    }
+
+    llvm::BasicBlock *CodeGenerator::closeOutlinedLoop(EmitTask &task, LoopHints const &hints)
+    {
+        auto F = task.function;
+        auto LoopBB = task.blocks[1];
+        auto AfterBB = task.blocks[2];
+        auto k = llvm::cast<llvm::PHINode>(&LoopBB->front());
+
+        auto nextK = TheBuilder->CreateNSWAdd(k, TheBuilder->getInt64(1), "nextk");
+        auto latch = TheBuilder->GetInsertBlock();
+        k->addIncoming(nextK, latch);
+
+        auto backEdge = TheBuilder->CreateCondBr(TheBuilder->CreateICmpSLT(nextK, F->getArg(2), "loopcond"), LoopBB, AfterBB);
+        ssa_.seal(LoopBB);
+
+        if (!hints.empty())
+        {
+            backEdge->setMetadata(llvm::LLVMContext::MD_loop, getLoopMetadata(hints));
+        }
+
+        AfterBB->moveAfter(&F->back());
+        TheBuilder->SetInsertPoint(AfterBB);
+
+        return latch;
+    }
+
+    void CodeGenerator::leaveOutlinedLoop(ForExprAST const &expr, EmitTask &task)
+    {
+        task.scope.reset();
+        task.debugScope.reset();
+        llvm::verifyFunction(*task.function);
+
+        TheBuilder->SetInsertPoint(task.blocks[0]);
+        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+    }
+
+    bool CodeGenerator::finishParallelLoop(ForExprAST const &expr, EmitTask &task)
+    {
+        popValue(); // the body's value is not used
+
+        closeOutlinedLoop(task, arena_->getLoopHints(task.expr));
+        TheBuilder->CreateRetVoid();
+        leaveOutlinedLoop(expr, task);
+
+        auto bytePtrTy = TheBuilder->getInt8PtrTy();
+        auto parfor = TheModule->getOrInsertFunction("kaleidoscope_parfor", TheBuilder->getVoidTy(), task.function->getType(), bytePtrTy, TheBuilder->getDoubleTy());
+        TheBuilder->CreateCall(parfor, {task.function, TheBuilder->CreateBitCast(task.context, bytePtrTy), convert(task.value, TheBuilder->getDoubleTy())});
+
+        return finish(llvm::Constant::getNullValue(floatTy_));
+    }
+
+    // Unless the reduction is ordered, the partial result is combined with the
+    // value of the body with reassociation allowed, and for min and max with
+    // NaNs and the sign of zero ignored, so that the loop vectorizer can keep
+    // partial results in the lanes of several vectors. A NaN in min or max
+    // makes the result unspecified, which freeze keeps from being poison.
+    bool CodeGenerator::finishReduction(ForExprAST const &expr, EmitTask &task)
+    {
+        auto kind = arena_->getReductionKind(task.expr);
+        auto value = toFloat(popValue());
+
+        auto F = task.function;
+        auto accumulator = llvm::cast<llvm::PHINode>(&*std::next(task.blocks[1]->begin()));
+        auto next = combineReduction(kind, accumulator, value);
+
+        auto hints = arena_->getLoopHints(task.expr);
+        bool reassociate = !reductionOptions_.ordered;
+
+        // an ordered reduction stays ordered in a fastmath function too
+        auto flags = TheBuilder->getFastMathFlags();
+        flags.setAllowReassoc(reassociate);
+
+        if (reassociate && (kind == ReductionKind::Min || kind == ReductionKind::Max))
+        {
+            flags.setNoNaNs();
+            flags.setNoSignedZeros();
+        }
+
+        llvm::cast<llvm::Instruction>(next)->setFastMathFlags(flags);
+
+        if (reassociate && hints.interleave == 0)
+        {
+            hints.interleave = reductionOptions_.accumulators;
+        }
+
+        accumulator->addIncoming(next, TheBuilder->GetInsertBlock());
+        auto latch = closeOutlinedLoop(task, hints);
+
+        llvm::Value *result = TheBuilder->CreatePHI(floatTy_, 2, "result");
+        llvm::cast<llvm::PHINode>(result)->addIncoming(getReductionIdentity(kind), &F->getEntryBlock());
+        llvm::cast<llvm::PHINode>(result)->addIncoming(next, latch);
+
+        if (reassociate && (kind == ReductionKind::Min || kind == ReductionKind::Max))
+        {
+            result = TheBuilder->CreateFreeze(result);
+        }
+
+        TheBuilder->CreateRet(convert(result, F->getReturnType()));
+        leaveOutlinedLoop(expr, task);
+
+        auto bytePtrTy = TheBuilder->getInt8PtrTy();
+        auto context = TheBuilder->CreateBitCast(task.context, bytePtrTy);
+        auto int32Ty = TheBuilder->getInt32Ty();
+
+        if (reductionOptions_.threads)
+        {
+            auto reduce = TheModule->getOrInsertFunction("kaleidoscope_reduce", TheBuilder->getDoubleTy(), F->getType(), bytePtrTy, TheBuilder->getDoubleTy(), int32Ty, int32Ty);
+
+            return finish(TheBuilder->CreateCall(reduce, {F, context, convert(task.value, TheBuilder->getDoubleTy()),
+                                                          llvm::ConstantInt::get(int32Ty, static_cast<std::uint32_t>(kind)),
+                                                          llvm::ConstantInt::get(int32Ty, reductionOptions_.ordered)},
+                                                 "reduction"));
+        }
+
+        // The count is rounded up like kaleidoscope_parfor does, with no
+        // iterations for NaN and at most 2^62.
+        auto trips = task.value;
+        auto limited = TheBuilder->CreateMinNum(TheBuilder->CreateUnaryIntrinsic(llvm::Intrinsic::ceil, trips), getConstant(0x1p62));
+        auto count = TheBuilder->CreateSelect(TheBuilder->CreateFCmpOGT(trips, getConstant(0.0)),
+                                              TheBuilder->CreateFPToSI(limited, TheBuilder->getInt64Ty()),
+                                              TheBuilder->getInt64(0), "count");
+
+        return finish(TheBuilder->CreateCall(F, {context, TheBuilder->getInt64(0), count}, "reduction"));
+    }
+
+    llvm::Value *CodeGenerator::combineReduction(ReductionKind kind, llvm::Value *lhs, llvm::Value *rhs)
+    {
+        switch (kind)
+        {
+        case ReductionKind::Sum:
+            return TheBuilder->CreateFAdd(lhs, rhs, "sum");
+        case ReductionKind::Product:
+            return TheBuilder->CreateFMul(lhs, rhs, "product");
+        case ReductionKind::Min:
+            return TheBuilder->CreateMinNum(lhs, rhs, "min");
+        case ReductionKind::Max:
+            break;
+        }
+
+        return TheBuilder->CreateMaxNum(lhs, rhs, "max");
+    }
+
+    llvm::Value *CodeGenerator::getReductionIdentity(ReductionKind kind) const
+    {
+        switch (kind)
+        {
+        case ReductionKind::Sum:
+            return getConstant(0.0);
+        case ReductionKind::Product:
+            return getConstant(1.0);
+        case ReductionKind::Min:
+            return getConstant(std::numeric_limits<double>::infinity());
+        case ReductionKind::Max:
+            break;
+        }
+
+        return getConstant(-std::numeric_limits<double>::infinity());
+    }
+
+    bool CodeGenerator::step(VarExprAST const &expr, EmitTask &task)
+    {
+        auto declarations = arena_->getDeclarations(expr);
+
+        if (task.stage == 0)
+        {
+            task.scope = std::make_unique<SymbolScope>(activeScope_);
+        }
+        else if (task.stage <= declarations.size())
+        {
+            auto &decl = declarations[task.stage - 1];
+
+            auto variable = declareVariable(decl.getName(), getType(types_.getDeclarationType(expr, task.stage - 1)));
+            writeVariable(variable, convert(popValue(), ssa_.getType(variable)));
+
+            if (!task.scope->tryDeclare(decl.getName(), variable))
+            {
+                throw CodeGenerationError("redefined variable '" + std::string(decl.getName().str()) + "' in var block");
+            }
+        }
+        else
+        {
+            // the body's value stays on the stack as the value of the var expression
+            task.scope.reset();
+            return true;
+        }
+
+        if (task.stage < declarations.size())
+        {
+            return descend(declarations[task.stage++].getInitVal());
+        }
+
+        ++task.stage;
+
+        debugInfo_->emitLocation(*TheBuilder, expr.getLocation());
+        return descend(expr.getBody(), task.tail);
+    }
+
+    llvm::Function *CodeGenerator::getFunction(Symbol name, std::string const &errmsg_format)
+    {
+        llvm::Function *F = isDeclared(name) ? TheModule->getFunction(name.str()) : nullptr;
+
+        if (F)
+        {
+            return F;
+        }
+
+        if (auto proto = getPrototype(name))
+        {
+            return (*this)(*proto);
+        }
+
+        std::ostringstream formatter;
+        formatter << boost::format(errmsg_format) % name;
+
+        throw CodeGenerationError(formatter.str());
+    }
+
+    PrototypeAST const *CodeGenerator::getPrototype(Symbol name) const
+    {
+        return name.id() < FunctionProtos.size() && FunctionProtos[name.id()] && isDeclared(name) ? &*FunctionProtos[name.id()] : nullptr;
+    }
+
+    bool CodeGenerator::isDeclared(Symbol name) const
+    {
+        return name.id() >= declaredAt_.size() || declaredAt_[name.id()] <= currentItem_;
+    }
+
+    llvm::Function *CodeGenerator::operator()(PrototypeAST const &expr)
+    {
+        auto name = expr.getName().str();
+
+        if (name == arrayBuiltin || name == lengthBuiltin || name == releaseBuiltin)
+        {
+            throw CodeGenerationError("'" + std::string(name) + "' is a builtin function");
+        }
+
+        // ! is the builtin logical not, see step(UnaryExprAST)
+        if (expr.isUnaryOperator() && expr.getOperatorName() == '!')
+        {
+            throw CodeGenerationError("'" + std::string(name) + "' is a builtin operator");
+        }
+
+        auto valueTy = getFloatType(expr.getPrecision());
+        auto doublePtrTy = llvm::Type::getDoublePtrTy(*TheContext);
+
+        std::vector<llvm::Type *> argTypes;
+        for (std::size_t i = 0; i < expr.getArgs().size(); ++i)
+        {
+            if (expr.isArrayArg(i))
+            {
+                argTypes.push_back(doublePtrTy);
+                argTypes.push_back(llvm::Type::getInt64Ty(*TheContext));
+            }
+            else
+            {
+                argTypes.push_back(valueTy);
+            }
+        }
+
+        llvm::FunctionType *FT = llvm::FunctionType::get(expr.returnsArray() ? doublePtrTy : valueTy, argTypes, false);
+        llvm::Function *F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, llvm::StringRef(name), *TheModule);
+
+        auto arg = F->arg_begin();
+        for (std::size_t i = 0; i < expr.getArgs().size(); ++i)
+        {
+            llvm::StringRef argName(expr.getArgs()[i].str());
+            (arg++)->setName(argName);
+
+            if (expr.isArrayArg(i))
+            {
+                (arg++)->setName(argName + ".len");
+            }
+        }
+
+        applyEffects(F);
+
+        return F;
+    }
+
+    void CodeGenerator::applyEffects(llvm::Function *F)
+    {
+        auto effects = effects_.getEffects(Symbol(F->getName()));
+
+        F->removeFnAttr(llvm::Attribute::ReadNone);
+        F->removeFnAttr(llvm::Attribute::NoUnwind);
+        F->removeFnAttr(llvm::Attribute::WillReturn);
+
+        if (effects.pure)
+        {
+            F->addFnAttr(llvm::Attribute::ReadNone);
+            F->addFnAttr(llvm::Attribute::NoUnwind);
+        }
+
+        if (effects.terminates)
+        {
+            F->addFnAttr(llvm::Attribute::WillReturn);
+        }
+    }
+
+    void CodeGenerator::registerExtern(PrototypeAST ast)
+    {
+        auto id = ast.getName().id();
+
+        if (id >= FunctionProtos.size())
+        {
+            FunctionProtos.resize(id + 1);
+        }
+
+        FunctionProtos[id] = std::move(ast);
+    }
+
+    // a definition without a precision gets that of the module
+    void CodeGenerator::registerDefinition(PrototypeAST const &proto)
+    {
+        registerExtern(proto.getPrecision() == Precision::Default ? proto.withPrecision(precision_) : proto);
+    }
+
+    // The cache of a memo function is described by an internal MemoDescriptor
+    // global, so that the code works in the JIT as well as in object files. F is
+    // not inlined: an inlined copy in another module would use a copy of the
+    // descriptor, and with it another cache.
+    void CodeGenerator::emitMemoLookup(llvm::Function *F, llvm::Function *body)
+    {
+        auto int32Ty = TheBuilder->getInt32Ty();
+        auto doubleTy = TheBuilder->getDoubleTy();
+        auto bytePtrTy = TheBuilder->getInt8PtrTy();
+        auto doublePtrTy = doubleTy->getPointerTo();
+
+        auto descriptorTy = llvm::StructType::get(*TheContext, {bytePtrTy, bytePtrTy, int32Ty, int32Ty, int32Ty});
+        auto name = TheBuilder->CreateGlobalString(F->getName(), F->getName() + ".name", 0, TheModule.get());
+        llvm::Constant *fields[] = {
+            llvm::ConstantPointerNull::get(bytePtrTy),
+            llvm::ConstantExpr::getPointerCast(name, bytePtrTy),
+            TheBuilder->getInt32(F->arg_size()),
+            TheBuilder->getInt32(memoOptions_.capacity),
+            TheBuilder->getInt32(static_cast<std::uint32_t>(memoOptions_.eviction))};
+        auto descriptorGlobal = new llvm::GlobalVariable(*TheModule, descriptorTy, false, llvm::GlobalValue::InternalLinkage,
+                                                         llvm::ConstantStruct::get(descriptorTy, fields), F->getName() + ".memo");
+        auto descriptor = llvm::ConstantExpr::getPointerCast(descriptorGlobal, bytePtrTy);
+
+        auto lookup = TheModule->getOrInsertFunction("kaleidoscope_memo_lookup", int32Ty, bytePtrTy, doublePtrTy, doublePtrTy);
+        auto store = TheModule->getOrInsertFunction("kaleidoscope_memo_store", TheBuilder->getVoidTy(), bytePtrTy, doublePtrTy, doubleTy);
+
+        F->addFnAttr(llvm::Attribute::NoInline);
+
+        TheBuilder->SetCurrentDebugLocation(llvm::DebugLoc());
+        TheBuilder->SetInsertPoint(llvm::BasicBlock::Create(*TheContext, "entry", F));
+
+        auto argsTy = llvm::ArrayType::get(doubleTy, F->arg_size());
+        auto argsSpace = TheBuilder->CreateAlloca(argsTy, nullptr, "args");
+        auto resultSpace = TheBuilder->CreateAlloca(doubleTy, nullptr, "result");
+
+        std::vector<llvm::Value *> args;
+        // the cache holds doubles whatever the precision of F
+        for (auto &arg : F->args())
+        {
+            TheBuilder->CreateStore(convert(&arg, doubleTy), TheBuilder->CreateConstInBoundsGEP2_32(argsTy, argsSpace, 0, arg.getArgNo()));
+            args.push_back(&arg);
+        }
+
+        auto argsPtr = TheBuilder->CreateConstInBoundsGEP2_32(argsTy, argsSpace, 0, 0, "argsptr");
+        auto isCached = TheBuilder->CreateCall(lookup, {descriptor, argsPtr, resultSpace}, "iscached");
+
+        auto HitBB = llvm::BasicBlock::Create(*TheContext, "hit", F);
+        auto MissBB = llvm::BasicBlock::Create(*TheContext, "miss", F);
+        TheBuilder->CreateCondBr(TheBuilder->CreateICmpNE(isCached, TheBuilder->getInt32(0)), HitBB, MissBB);
+
+        TheBuilder->SetInsertPoint(HitBB);
+        TheBuilder->CreateRet(convert(TheBuilder->CreateLoad(doubleTy, resultSpace, "cached"), F->getReturnType()));
+
+        TheBuilder->SetInsertPoint(MissBB);
+        auto result = TheBuilder->CreateCall(body, args, "calltmp");
+        TheBuilder->CreateCall(store, {descriptor, argsPtr, convert(result, doubleTy)});
+        TheBuilder->CreateRet(result);
+    }
+
+    llvm::Function *CodeGenerator::operator()(FunctionAST const &expr)
+    {
+        auto simplified = simplify(expr, precision_);
+        effects_.addDefinition(simplified);
+
+        try
+        {
+            return generateDefinition(expr, simplified);
+        }
+        catch (CodeGenerationError const &e)
+        {
+            std::cerr << e.what() << std::endl;
+
+            if (TheParser != nullptr)
+            {
+                TheParser->removeOperator(expr.getProto());
+            }
+
+            effects_.removeDefinition(expr.getProto().getName());
+            throw;
+        }
+    }
+
+    // simplified is expr simplified, with its effects known already
+    llvm::Function *CodeGenerator::generateDefinition(FunctionAST const &expr, FunctionAST const &simplified)
+    {
+        // the JIT may be compiling an earlier module of the context
+        auto lock = context_.getLock();
+
+        llvm::Function *F = nullptr;
+        llvm::Function *body = nullptr;
+        outlinedFunctions_.clear();
+        ssa_.clear();
+
+        try
+        {
+            registerDefinition(expr.getProto());
+            floatTy_ = getFloatType(getPrototype(expr.getProto().getName())->getPrecision());
+
+            F = getFunction(expr.getProto().getName(), "Could not create function %1%");
+            applyEffects(F);
+            body = F;
+
+            if (expr.getProto().isMemoized())
+            {
+                // F becomes the cache lookup, which calls body on a miss
+                body = llvm::Function::Create(F->getFunctionType(), llvm::Function::InternalLinkage, F->getName() + ".body", *TheModule);
+
+                for (auto &arg : body->args())
+                {
+                    arg.setName(F->getArg(arg.getArgNo())->getName());
+                }
+            }
+
+            if (TheParser != nullptr)
+            {
+                TheParser->registerOperator(expr.getProto());
+            }
+
+            arena_ = &simplified.getArena();
+            types_ = inferTypes(simplified, [this](Symbol name)
+                                { return getPrototype(name); });
+
+            // A cache hit skips the body, and all calls with the same
+            // arguments share the cached result.
+            if (expr.getProto().isMemoized())
+            {
+                auto name = expr.getProto().getName();
+
+                if (!effects_.getEffects(name).deterministic)
+                {
+                    throw CodeGenerationError("memo function '" + std::string(name.str()) + "' has side effects");
+                }
+
+                if (expr.getProto().hasArrays() || types_.getType(simplified.getBody()) == ValueType::Array)
+                {
+                    throw CodeGenerationError("memo function '" + std::string(name.str()) + "' takes or returns an array");
+                }
+            }
+
+            llvm::BasicBlock *entryBlock = llvm::BasicBlock::Create(*TheContext, "entry", body);
+            TheBuilder->SetInsertPoint(entryBlock);
+
+            auto fastMath = fastMath_ | expr.getProto().getFastMath();
+
+            {
+                // applies to the outlined loops too
+                llvm::IRBuilderBase::FastMathFlagGuard fastMathGuard(*TheBuilder);
+                TheBuilder->setFastMathFlags(getFastMathFlags(fastMath));
+
+                DebugScope debugScope(*debugInfo_, *TheBuilder, body, expr.getProto());
+                SymbolScope functionScope(activeScope_);
+
+                // the length passed with an array is in its header, too
+                auto arg = body->arg_begin();
+                for (int argIdx = 0; argIdx < static_cast<int>(expr.getProto().getArgs().size()); ++argIdx, ++arg)
+                {
+                    auto argName = expr.getProto().getArgs()[argIdx];
+                    auto variable = declareVariable(argName, arg->getType());
+
+                    // debuggers find a parameter in its stack slot
+                    if (debugLevel_ == DebugLevel::Full)
+                    {
+                        variable.debugSpace = createScopedVariable(body, argName, arg->getType());
+                        debugInfo_->declareParameter(*TheBuilder, variable.debugSpace, arg->getName().str(), argIdx, expr.getProto().getLocation());
+                    }
+
+                    writeVariable(variable, &*arg);
+                    functionScope.tryDeclare(argName, variable);
+
+                    if (expr.getProto().isArrayArg(argIdx))
+                    {
+                        ++arg;
+                    }
+                }
+
+                debugInfo_->emitLocation(*TheBuilder, arena_->getLocation(simplified.getBody()));
+                returnValue(emit(simplified.getBody(), true));
+            }
+
+            if (body != F)
+            {
+                emitMemoLookup(F, body);
+                llvm::verifyFunction(*body);
+            }
+
+            addFastMathAttributes(*F, fastMath);
+            if (body != F)
+            {
+                addFastMathAttributes(*body, fastMath);
+            }
+
+            for (auto outlined : outlinedFunctions_)
+            {
+                addFastMathAttributes(*outlined, fastMath);
+            }
+
+            // An inlined copy of F in another module would refer to the
+            // internal functions the runtime runs loops with.
+            if (std::any_of(outlinedFunctions_.begin(), outlinedFunctions_.end(), [](llvm::Function *outlined)
+                            { return !outlined->hasFnAttribute(llvm::Attribute::AlwaysInline); }))
+            {
+                F->addFnAttr(llvm::Attribute::NoInline);
+            }
+
+            llvm::verifyFunction(*F);
+
+            return F;
+        }
+        catch (CodeGenerationError const &)
+        {
+            if (body != F)
+            {
+                body->eraseFromParent();
+            }
+
+            if (F != nullptr)
+            {
+                F->eraseFromParent();
+            }
+
+            // outlined bodies may refer to each other
+            for (auto outlined : outlinedFunctions_)
+            {
+                outlined->dropAllReferences();
+            }
+
+            for (auto outlined : outlinedFunctions_)
+            {
+                outlined->eraseFromParent();
             }
 
             throw;
@@ -3,9 +3,14 @@
 
 #include "ast.hpp"
 #include "debug.hpp"
+#include "effects.hpp"
 #include "error.hpp"
+#include "mathbuiltins.hpp"
+#include "memocache.hpp"
+#include "ssa.hpp"
 #include "symbols.hpp"
 #include "parser.hpp"
+#include "typeinference.hpp"
 
 #include <llvm/IR/DIBuilder.h>
 #include <llvm/IR/Value.h>
@@ -14,10 +19,18 @@
 #include <llvm/IR/Module.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Target/TargetOptions.h>
 
-#include <map>
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <optional>
+#include <span>
 #include <stdexcept>
+#include <vector>
 
 namespace kaleidoscope
 {
@@ -27,49 +40,215 @@ namespace kaleidoscope
         CodeGenerationError(std::string const &errMsg);
     };
 
+    struct ReductionOptions
+    {
+        /// independent partial results of a reduction loop, up to 16; each
+        /// is a vector when the loop is vectorised, 1 for a single one
+        std::uint32_t accumulators = 4;
+        /// split reductions across the threads of the parfor loops
+        bool threads = false;
+        /// Combine the values in iteration order, without reassociation or
+        /// partial results. With threads, blocks of a fixed size are reduced
+        /// in order and their results combined in order, so the result does
+        /// not depend on the number of threads or the schedule.
+        bool ordered = false;
+    };
+
+    /// Sets the target options matching the fast-math flags modules are
+    /// generated with, see CodeGenerator::setFastMath(). The code generator
+    /// takes the flags of instructions and the fast-math attributes of
+    /// functions into account anyway; the options add the fusion of
+    /// multiplications and additions that carry no contract flag.
+    void applyFastMath(llvm::TargetOptions &options, FastMath fastMath);
+
+    struct ParsedItem;
+
     class CodeGenerator
     {
     public:
-        CodeGenerator(Parser &p, llvm::DataLayout dataLayout = llvm::DataLayout(""), std::string const &moduleName = "module", bool disableDebug = true);
-
-        llvm::Value *operator()(ExprAST const &expr);
-        llvm::Value *operator()(NumberExprAST const &expr);
-        llvm::Value *operator()(VariableExprAST const &expr);
-        llvm::Value *operator()(UnaryExprAST const &expr);
-        llvm::Value *operator()(BinaryExprAST const &expr);
-        llvm::Value *operator()(CallExprAST const &expr);
-        llvm::Value *operator()(IfExprAST const &expr);
-        llvm::Value *operator()(ForExprAST const &expr);
-        llvm::Value *operator()(VarExprAST const &expr);
+        CodeGenerator(Parser &p, llvm::DataLayout dataLayout = llvm::DataLayout(""), std::string const &moduleName = "module", DebugLevel debugLevel = DebugLevel::None);
+        /// without a parser to register operators with, for items parsed
+        /// already, see generateParallel()
+        explicit CodeGenerator(llvm::DataLayout dataLayout, std::string const &moduleName = "module", DebugLevel debugLevel = DebugLevel::None);
+
+        /// expr refers to the arena of the function being generated
+        llvm::Value *operator()(ExprRef expr);
 
         llvm::Function *operator()(PrototypeAST const &expr);
         llvm::Function *operator()(FunctionAST const &expr);
 
+        /// Hands out the module generated so far and starts a new one. The
+        /// modules share an LLVMContext, so that types, constants and metadata
+        /// are created once rather than per module; whoever uses a module on
+        /// another thread must hold the lock of its ThreadSafeContext, as ORC
+        /// does.
         llvm::orc::ThreadSafeModule finalizeModule(std::string const &newModuleName = "module");
 
         void registerExtern(PrototypeAST ast);
 
-    private:
-        llvm::Value *generateOptional(ExprAST const *ast, double defaultValue);
+        /// cache size and eviction of the memo functions generated from now on
+        void setMemoOptions(MemoOptions const &options) { memoOptions_ = options; }
+        /// lowering of the reductions generated from now on
+        void setReductionOptions(ReductionOptions const &options) { reductionOptions_ = options; }
+        /// fast-math flags of the functions generated from now on, in
+        /// addition to those of their fastmath annotation
+        void setFastMath(FastMath fastMath) { fastMath_ = fastMath; }
+        /// precision of the definitions and top-level expressions generated
+        /// from now on that do not declare one; Default means Double
+        void setPrecision(Precision precision) { precision_ = precision; }
+        /// Modules generated in one LLVMContext before the next module gets a
+        /// new one, bounding the constants and metadata a long session
+        /// accumulates; 1 gives every module a context of its own.
+        void setModulesPerContext(std::size_t modules) { modulesPerContext_ = std::max<std::size_t>(modules, 1); }
 
-        llvm::Function *getFunction(std::string const &name, std::string const &errmsg_format);
+    private:
+        friend std::vector<std::string> generateParallel(CodeGenerator &codegen, std::vector<ParsedItem> const &items, unsigned threadCount);
+
+        /// a worker of generateParallel(): the settings, prototypes and
+        /// effects of parent, a context and module of its own
+        CodeGenerator(CodeGenerator const &parent, std::string const &moduleName);
+
+        /// An expression node whose IR is being emitted, see operator()(ExprRef).
+        struct EmitTask
+        {
+            EmitTask(ExprRef expr, bool tail) : expr(expr), tail(tail) {}
+
+            ExprRef expr;
+            /// the value of expr is returned by the function; a task in tail
+            /// position may emit the ret itself and finish with nullptr
+            bool tail;
+            std::size_t stage = 0;
+            llvm::Value *value = nullptr;
+            Variable variable;
+            /// the context struct of an outlined loop
+            llvm::AllocaInst *context = nullptr;
+            llvm::Function *function = nullptr;
+            std::array<llvm::BasicBlock *, 3> blocks = {};
+            std::unique_ptr<SymbolScope> scope;
+            std::unique_ptr<DebugScope> debugScope;
+        };
+
+        bool step(NumberExprAST const &expr, EmitTask &task);
+        bool step(VariableExprAST const &expr, EmitTask &task);
+        bool step(UnaryExprAST const &expr, EmitTask &task);
+        bool step(BinaryExprAST const &expr, EmitTask &task);
+        bool stepLogical(BinaryExprAST const &expr, EmitTask &task);
+        bool step(CallExprAST const &expr, EmitTask &task);
+        bool stepArrayBuiltin(CallExprAST const &expr, EmitTask &task);
+        bool stepMathBuiltin(CallExprAST const &expr, MathBuiltin const &builtin, EmitTask &task);
+        bool step(IndexExprAST const &expr, EmitTask &task);
+        bool stepElementAssignment(BinaryExprAST const &expr, IndexExprAST const &element, EmitTask &task);
+        bool step(IfExprAST const &expr, EmitTask &task);
+        bool step(ForExprAST const &expr, EmitTask &task);
+        bool step(ParForExprAST const &expr, EmitTask &task);
+        bool step(ReductionExprAST const &expr, EmitTask &task);
+        /// parfor and reductions, whose loops are outlined into functions of their own
+        bool stepOutlinedLoop(ForExprAST const &expr, EmitTask &task);
+        bool beginOutlinedLoop(ForExprAST const &expr, EmitTask &task);
+        /// emits the back edge of the outlined loop and moves to its exit, returning the latch
+        llvm::BasicBlock *closeOutlinedLoop(EmitTask &task, LoopHints const &hints);
+        /// returns to the function the loop was outlined from
+        void leaveOutlinedLoop(ForExprAST const &expr, EmitTask &task);
+        bool finishParallelLoop(ForExprAST const &expr, EmitTask &task);
+        bool finishReduction(ForExprAST const &expr, EmitTask &task);
+        llvm::Value *combineReduction(ReductionKind kind, llvm::Value *lhs, llvm::Value *rhs);
+        /// the value of an empty reduction
+        llvm::Value *getReductionIdentity(ReductionKind kind) const;
+        bool step(VarExprAST const &expr, EmitTask &task);
+
+        llvm::Value *emit(ExprRef expr, bool tail);
+        bool descend(ExprRef child, bool tail = false);
+        bool finish(llvm::Value *result);
+        bool finishCall(llvm::Function *callee, llvm::ArrayRef<llvm::Value *> args, llvm::Twine const &name, EmitTask const &task);
+        /// the arguments of a call of callee with values, see PrototypeAST::isArrayArg()
+        std::vector<llvm::Value *> getCallArguments(Symbol callee, std::span<llvm::Value *const> values);
+        llvm::Value *popValue();
+
+        llvm::Function *getFunction(Symbol name, std::string const &errmsg_format);
+        /// nullptr if there is neither a definition nor an extern of name
+        PrototypeAST const *getPrototype(Symbol name) const;
+        /// false if name is only declared by an item after the one being
+        /// generated, see declaredAt_
+        bool isDeclared(Symbol name) const;
+        /// value rounded to the precision of the function being generated
         llvm::Value *getConstant(double value) const;
         llvm::Value *getBoolCondition(llvm::Value *condValue, llvm::Twine const &name);
 
-        llvm::AllocaInst *createScopedVariable(llvm::Function *F, std::string const &varName);
-
-        Parser &TheParser;
+        llvm::Type *getType(ValueType type) const;
+        llvm::Type *getFloatType(Precision precision) const;
+        /// converts between the representations of a number: float, double, i64
+        /// or i1. An array's double* converts to nothing but itself.
+        llvm::Value *convert(llvm::Value *value, llvm::Type *type);
+        /// converts to the precision of the function being generated
+        llvm::Value *toFloat(llvm::Value *value);
+        void returnValue(llvm::Value *value);
+
+        /// An array value is the address of its first element, a double* (see
+        /// ValueType::Array). getArrayData() rejects a number in its place.
+        llvm::Value *getArrayData(llvm::Value *array);
+        llvm::Value *getArrayLength(llvm::Value *data);
+        llvm::Value *getElementAddress(llvm::Value *array, llvm::Value *index);
+        /// tags the accesses of array elements and lengths as different types
+        llvm::MDNode *getArrayAccessTag(bool length);
+
+        /// registers the prototype of a definition, resolving Precision::Default
+        void registerDefinition(PrototypeAST const &proto);
+        /// operator()(FunctionAST) once expr is simplified and its effects are known
+        llvm::Function *generateDefinition(FunctionAST const &expr, FunctionAST const &simplified);
+        void emitMemoLookup(llvm::Function *F, llvm::Function *body);
+        llvm::MDNode *getLoopMetadata(LoopHints const &hints);
+        /// sets the attributes of F that follow from the effects of the function of that name
+        void applyEffects(llvm::Function *F);
+
+        /// a stack slot in the entry block of F
+        llvm::AllocaInst *createScopedVariable(llvm::Function *F, Symbol varName, llvm::Type *type);
+        /// variables live in SSA values, see SSABuilder; they are read and
+        /// written at the insertion point
+        Variable declareVariable(Symbol name, llvm::Type *type);
+        llvm::Value *readVariable(Variable variable);
+        void writeVariable(Variable variable, llvm::Value *value);
+        /// the variables of the active scopes the subtree of expr refers to, other than excluded
+        std::vector<std::pair<Symbol, Variable>> getCapturedVariables(ExprRef expr, Symbol excluded) const;
+
+        // nullptr if the items are parsed already
+        Parser *TheParser;
         llvm::DataLayout dataLayout;
-        std::unique_ptr<llvm::LLVMContext> TheContext;
+        llvm::orc::ThreadSafeContext context_;
+        llvm::LLVMContext *TheContext = nullptr;
+        std::size_t modulesPerContext_ = 256;
+        std::size_t contextModules_ = 0;
         std::unique_ptr<llvm::IRBuilder<>> TheBuilder;
         std::unique_ptr<llvm::Module> TheModule;
 
-        bool disableDebug_;
+        DebugLevel debugLevel_;
+        MemoOptions memoOptions_;
+        ReductionOptions reductionOptions_;
+        FastMath fastMath_ = FastMath::None;
+        Precision precision_ = Precision::Double;
         std::unique_ptr<DebugInfo> debugInfo_;
 
+        // arena and floating point type of the function currently being generated
+        ASTArena const *arena_ = nullptr;
+        llvm::Type *floatTy_ = nullptr;
+        TypeInfo types_;
+        // deque, so that references to tasks survive pushing their children
+        std::deque<EmitTask> emitTasks_;
+        std::vector<llvm::Value *> emitValues_;
+        // loops outlined from the function being generated
+        std::vector<llvm::Function *> outlinedFunctions_;
+
+        SSABuilder ssa_;
         SymbolTable globalSymbols_;
         SymbolTable *activeScope_;
-        std::map<std::string, PrototypeAST> FunctionProtos;
+        // indexed by Symbol::id()
+        std::vector<std::optional<PrototypeAST>> FunctionProtos;
+        EffectAnalysis effects_;
+        // In a worker of generateParallel(), which knows the prototypes of
+        // the whole file: the item first declaring each name, by Symbol::id(),
+        // and the item being generated, so that an item cannot call a
+        // function declared after it. Empty otherwise.
+        std::vector<std::size_t> declaredAt_;
+        std::size_t currentItem_ = 0;
     };
 }
 
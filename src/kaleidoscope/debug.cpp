@@ -17,45 +17,63 @@ namespace kaleidoscope
         }
     }
 
-    DebugInfo::DebugInfo(llvm::Module &module, bool disableDebug)
-        : disableDebug_(disableDebug)
+    DebugInfo::DebugInfo(llvm::Module &module, DebugLevel level)
+        : module_(module), level_(level)
     {
-        if (!disableDebug)
-        {
-            module.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+    }
+
+    void DebugInfo::createCompileUnit()
+    {
+        module_.addModuleFlag(llvm::Module::Warning, "Debug Info Version", llvm::DEBUG_METADATA_VERSION);
+
+        auto emissionKind = level_ == DebugLevel::LineTablesOnly ? llvm::DICompileUnit::LineTablesOnly : llvm::DICompileUnit::FullDebug;
 
-            builder_ = std::make_unique<llvm::DIBuilder>(module);
-            file_ = builder_->createFile(moduleFileName(module), ".");
-            compileUnit_ = builder_->createCompileUnit(llvm::dwarf::DW_LANG_C, file_, "Kaleidoscope compiler", false, "", 0);
+        builder_ = std::make_unique<llvm::DIBuilder>(module_);
+        file_ = builder_->createFile(moduleFileName(module_), ".");
+        compileUnit_ = builder_->createCompileUnit(llvm::dwarf::DW_LANG_C, file_, "Kaleidoscope compiler", false, "", 0, "", emissionKind);
+
+        if (level_ == DebugLevel::Full)
+        {
             doubleType_ = builder_->createBasicType("double", 64, llvm::dwarf::DW_ATE_float);
-            LexicalBlocks.push_back(compileUnit_);
+            floatType_ = builder_->createBasicType("float", 32, llvm::dwarf::DW_ATE_float);
         }
+
+        LexicalBlocks.push_back(compileUnit_);
     }
 
     void DebugInfo::finalize()
     {
-        if (!disableDebug_)
+        if (builder_)
         {
             builder_->finalize();
         }
     }
 
-    llvm::DISubroutineType *DebugInfo::CreateFunctionType(unsigned NumArgs)
+    llvm::DIType *DebugInfo::getType(llvm::Type *type) const
     {
-        if (!disableDebug_)
-        {
-            llvm::SmallVector<llvm::Metadata *, 8> EltTys(NumArgs + 1, doubleType_);
-            return builder_->createSubroutineType(builder_->getOrCreateTypeArray(EltTys));
-        }
-        else
+        return type->isFloatTy() ? floatType_ : doubleType_;
+    }
+
+    llvm::DISubroutineType *DebugInfo::CreateFunctionType(llvm::FunctionType *FT)
+    {
+        // line tables need no types
+        llvm::SmallVector<llvm::Metadata *, 8> EltTys;
+
+        if (level_ == DebugLevel::Full)
         {
-            return nullptr;
+            EltTys.push_back(getType(FT->getReturnType()));
+            for (auto param : FT->params())
+            {
+                EltTys.push_back(getType(param));
+            }
         }
+
+        return builder_->createSubroutineType(builder_->getOrCreateTypeArray(EltTys));
     }
 
     void DebugInfo::exitScope()
     {
-        if (!disableDebug_)
+        if (level_ != DebugLevel::None)
         {
             LexicalBlocks.pop_back();
         }
@@ -63,7 +81,7 @@ namespace kaleidoscope
 
     void DebugInfo::emitNullLocation(llvm::IRBuilder<> &irBuilder)
     {
-        if (!disableDebug_)
+        if (level_ != DebugLevel::None)
         {
             irBuilder.SetCurrentDebugLocation(llvm::DebugLoc());
         }
@@ -71,7 +89,7 @@ namespace kaleidoscope
 
     void DebugInfo::emitLocation(llvm::IRBuilder<> &irBuilder, SourceLocation const &srcLoc)
     {
-        if (!disableDebug_)
+        if (level_ != DebugLevel::None)
         {
             assert(!LexicalBlocks.empty());
 
@@ -86,20 +104,25 @@ namespace kaleidoscope
 
     void DebugInfo::enterFunction(llvm::IRBuilder<> &irBuilder, llvm::Function *F, PrototypeAST const &proto)
     {
-        if (!disableDebug_)
+        if (level_ != DebugLevel::None)
         {
+            if (!builder_)
+            {
+                createCompileUnit();
+            }
+
             auto loc = proto.getLocation();
 
             assert(!file_->isTemporary());
 
             auto SP = builder_->createFunction(file_,
-                                               proto.getName(),
+                                               proto.getName().str(),
                                                llvm::StringRef(),
                                                file_,
                                                loc.line(),
-                                               CreateFunctionType(F->arg_size()),
+                                               CreateFunctionType(F->getFunctionType()),
                                                loc.line(),
-                                               llvm::DINode::FlagPrototyped,
+                                               level_ == DebugLevel::Full ? llvm::DINode::FlagPrototyped : llvm::DINode::FlagZero,
                                                llvm::DISubprogram::SPFlagDefinition);
 
             F->setSubprogram(SP);
@@ -110,12 +133,12 @@ namespace kaleidoscope
 
     void DebugInfo::declareParameter(llvm::IRBuilder<> &irBuilder, llvm::AllocaInst *alloca, std::string const &name, int argIdx, SourceLocation const &loc)
     {
-        if (!disableDebug_)
+        if (level_ == DebugLevel::Full)
         {
             assert(!LexicalBlocks.empty());
 
             auto SP = LexicalBlocks.back();
-            auto D = builder_->createParameterVariable(SP, name, argIdx, file_, loc.line(), doubleType_, true);
+            auto D = builder_->createParameterVariable(SP, name, argIdx, file_, loc.line(), getType(alloca->getAllocatedType()), true);
             builder_->insertDeclare(alloca, D, builder_->createExpression(), llvm::DILocation::get(SP->getContext(), loc.line(), 0, SP), irBuilder.GetInsertBlock());
         }
     }
@@ -8,15 +8,29 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/Module.h>
 
+#include <cstdint>
 #include <memory>
 #include <vector>
 
 namespace kaleidoscope
 {
+    /// How much debug info the code generator emits.
+    enum class DebugLevel : std::uint8_t
+    {
+        None,
+        /// subprograms and line locations, enough for profiles and
+        /// backtraces, without types or variables
+        LineTablesOnly,
+        Full
+    };
+
+    /// DebugInfo - the debug info of one module. The compile unit is created
+    /// with the first function entered, so a module without functions gets
+    /// no debug info at all.
     class DebugInfo
     {
     public:
-        DebugInfo(llvm::Module &module, bool disableDebug = false);
+        DebugInfo(llvm::Module &module, DebugLevel level = DebugLevel::Full);
 
         void enterFunction(llvm::IRBuilder<> &irBuilder, llvm::Function *F, PrototypeAST const &proto);
         void exitScope();
@@ -29,14 +43,20 @@ namespace kaleidoscope
         void finalize();
 
     private:
-        llvm::DISubroutineType *CreateFunctionType(unsigned NumArgs);
+        void createCompileUnit();
+        llvm::DISubroutineType *CreateFunctionType(llvm::FunctionType *FT);
+        /// the basic type of float and double values
+        llvm::DIType *getType(llvm::Type *type) const;
 
-        bool disableDebug_;
+        llvm::Module &module_;
+        DebugLevel level_;
 
+        // null until the first function is entered
         std::unique_ptr<llvm::DIBuilder> builder_;
-        llvm::DIFile *file_;
-        llvm::DICompileUnit *compileUnit_;
-        llvm::DIType *doubleType_;
+        llvm::DIFile *file_ = nullptr;
+        llvm::DICompileUnit *compileUnit_ = nullptr;
+        llvm::DIType *doubleType_ = nullptr;
+        llvm::DIType *floatType_ = nullptr;
         std::vector<llvm::DIScope *> LexicalBlocks;
     };
 
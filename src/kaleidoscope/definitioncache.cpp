@@ -0,0 +1,109 @@
+#include "definitioncache.hpp"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <unordered_set>
+#include <vector>
+
+namespace kaleidoscope
+{
+    void DefinitionCache::addDefinitions(llvm::Module const &module, bool replace)
+    {
+        auto bitcode = std::make_shared<std::string>();
+        llvm::raw_string_ostream out(*bitcode);
+        llvm::WriteBitcodeToFile(module, out);
+        out.flush();
+
+        std::lock_guard lock(mutex_);
+
+        for (auto const &function : module.functions())
+        {
+            if (function.isDeclaration())
+            {
+                continue;
+            }
+
+            if (replace)
+            {
+                definitions_[function.getName().str()] = bitcode;
+            }
+            else
+            {
+                definitions_.emplace(function.getName().str(), bitcode);
+            }
+        }
+    }
+
+    void DefinitionCache::importDefinitions(llvm::Module &module) const
+    {
+        std::unordered_set<std::string> imported;
+
+        while (true)
+        {
+            std::vector<llvm::Function *> callees;
+
+            for (auto &function : module.functions())
+            {
+                if (function.isDeclaration() && !imported.count(function.getName().str()))
+                {
+                    callees.push_back(&function);
+                }
+            }
+
+            bool linked = false;
+
+            for (auto callee : callees)
+            {
+                auto name = callee->getName().str();
+                imported.insert(name);
+
+                auto bitcode = findDefinition(name);
+                if (!bitcode)
+                {
+                    continue;
+                }
+
+                auto definitionModule = llvm::cantFail(llvm::parseBitcodeFile(llvm::MemoryBufferRef(*bitcode, name), module.getContext()));
+
+                auto definition = definitionModule->getFunction(name);
+
+                // a function redefined with another number of arguments is left to the JIT to resolve
+                if (definition->getFunctionType() != callee->getFunctionType())
+                {
+                    continue;
+                }
+
+                for (auto &function : definitionModule->functions())
+                {
+                    if (!function.isDeclaration())
+                    {
+                        function.setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+                    }
+                }
+
+                // The callees of the definition are linked as declarations and
+                // picked up by the next round. Should linking fail, the call is
+                // simply not inlined.
+                llvm::Linker::linkModules(module, std::move(definitionModule), llvm::Linker::LinkOnlyNeeded);
+                linked = true;
+            }
+
+            if (!linked)
+            {
+                return;
+            }
+        }
+    }
+
+    std::shared_ptr<std::string const> DefinitionCache::findDefinition(std::string const &name) const
+    {
+        std::lock_guard lock(mutex_);
+
+        auto definition = definitions_.find(name);
+        return definition != definitions_.end() ? definition->second : nullptr;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef INCLUDED_KALEIDOSCOPE_DEFINITIONCACHE_HPP
+#define INCLUDED_KALEIDOSCOPE_DEFINITIONCACHE_HPP
+
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+    /// DefinitionCache - keeps the IR of the definitions already handed to the
+    /// JIT. Every definition lives in a module (and LLVMContext) of its own, so
+    /// the optimizer cannot see the bodies of functions defined earlier. Before
+    /// a new module is optimised, importDefinitions() links available_externally
+    /// copies of the cached callees into it. The inliner can then inline them,
+    /// and the copies are dropped again by the optimisation pipeline; the calls
+    /// that remain are resolved by the JIT as before. The cache may be used by
+    /// several threads, e.g. by the tier-up thread of a TieredCompiler.
+    class DefinitionCache
+    {
+    public:
+        /// caches the functions defined in module. Earlier definitions of the
+        /// same name are replaced only if replace is set: the cache has to
+        /// match what the JIT resolves, and a JIT without indirect stubs keeps
+        /// the first definition of a symbol.
+        void addDefinitions(llvm::Module const &module, bool replace);
+
+        /// links available_externally copies of the cached functions module
+        /// calls, and of the functions those call in turn
+        void importDefinitions(llvm::Module &module) const;
+
+    private:
+        std::shared_ptr<std::string const> findDefinition(std::string const &name) const;
+
+        mutable std::mutex mutex_;
+        // function name -> bitcode of the module defining it
+        std::unordered_map<std::string, std::shared_ptr<std::string const>> definitions_;
+    };
+}
+
+#endif
@@ -0,0 +1,232 @@
+#include "effects.hpp"
+
+#include "mathbuiltins.hpp"
+#include "token.hpp"
+
+#include <algorithm>
+#include <string>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        bool isBuiltinOperator(char op)
+        {
+            return op == '=' || op == '+' || op == '-' || op == '*' || op == '/' || op == '<' || op == op_and || op == op_or;
+        }
+    }
+
+    void EffectAnalysis::addDefinition(FunctionAST const &function)
+    {
+        auto const &arena = function.getArena();
+        auto id = function.getProto().getName().id();
+
+        std::vector<std::uint32_t> callees;
+        bool usesRuntime = false;
+        bool hasLoops = false;
+
+        // the arena holds the nodes of the body only
+        for (std::uint32_t i = 0; i < arena.size(); ++i)
+        {
+            auto const &expr = arena[ExprRef(i)];
+
+            if (auto call = std::get_if<CallExprAST>(&expr))
+            {
+                auto callee = call->getCallee();
+
+                // a math builtin is pure unless a definition replaces it
+                if (getMathBuiltin(callee.str()) == nullptr || callee.id() == id || isDefined(callee))
+                {
+                    callees.push_back(callee.id());
+                }
+            }
+            else if (auto unary = std::get_if<UnaryExprAST>(&expr); unary != nullptr && unary->getOp() != '!')
+            {
+                callees.push_back(Symbol(std::string("unary") + unary->getOp()).id());
+            }
+            else if (auto binary = std::get_if<BinaryExprAST>(&expr); binary != nullptr && !isBuiltinOperator(binary->getOp()))
+            {
+                callees.push_back(Symbol(std::string("binary") + binary->getOp()).id());
+            }
+            else if (std::holds_alternative<IndexExprAST>(expr))
+            {
+                usesRuntime = true;
+            }
+            else if (std::holds_alternative<ParForExprAST>(expr))
+            {
+                usesRuntime = true;
+                hasLoops = true;
+            }
+            else if (std::holds_alternative<ForExprAST>(expr) || std::holds_alternative<ReductionExprAST>(expr))
+            {
+                hasLoops = true;
+            }
+        }
+
+        auto maxId = std::max(id, callees.empty() ? 0 : *std::max_element(callees.begin(), callees.end()));
+        if (maxId >= nodes_.size())
+        {
+            nodes_.resize(maxId + 1);
+        }
+
+        for (auto callee : callees)
+        {
+            nodes_[callee].referenced = true;
+        }
+
+        auto &defined = nodes_[id];
+        // Only a definition that other definitions call, or one that replaces
+        // another, can change the effects of functions other than itself.
+        bool leaf = !defined.defined && !defined.referenced;
+
+        defined.defined = true;
+        defined.memoized = function.getProto().isMemoized();
+        defined.usesRuntime = usesRuntime;
+        defined.hasLoops = hasLoops;
+        defined.callees = std::move(callees);
+
+        if (leaf)
+        {
+            updateLeaf(id);
+        }
+        else
+        {
+            update();
+        }
+    }
+
+    void EffectAnalysis::removeDefinition(Symbol name)
+    {
+        if (name.id() < nodes_.size() && nodes_[name.id()].defined)
+        {
+            auto &removed = nodes_[name.id()];
+            removed.defined = false;
+            removed.memoized = false;
+            removed.usesRuntime = false;
+            removed.hasLoops = false;
+            removed.callees.clear();
+            update();
+        }
+    }
+
+    bool EffectAnalysis::isDefined(Symbol name) const
+    {
+        return name.id() < nodes_.size() && nodes_[name.id()].defined;
+    }
+
+    Effects EffectAnalysis::getEffects(Symbol name) const
+    {
+        return name.id() < nodes_.size() ? nodes_[name.id()].effects : Effects();
+    }
+
+    void EffectAnalysis::updateLeaf(std::uint32_t id)
+    {
+        auto &leaf = nodes_[id];
+
+        // a call of the function itself leaves it pure, but it may not terminate
+        bool pure = !leaf.memoized && !leaf.usesRuntime;
+        bool terminates = !leaf.hasLoops;
+        bool deterministic = !leaf.usesRuntime;
+
+        for (auto callee : leaf.callees)
+        {
+            auto effects = callee == id ? Effects{true, false, true} : nodes_[callee].effects;
+            pure = pure && effects.pure;
+            terminates = terminates && effects.terminates;
+            deterministic = deterministic && effects.deterministic;
+        }
+
+        leaf.effects = {pure, pure && terminates, deterministic};
+    }
+
+    // Purity is the greatest fixed point: every definition starts out pure and
+    // impurity spreads from memo functions, array accesses, parfor loops and
+    // calls of undefined functions to the callers. Determinism spreads the
+    // same way, except from memo functions. Termination is the least fixed
+    // point: a pure definition without loops terminates once all its callees
+    // do, which a definition on a cycle of calls never reaches.
+    void EffectAnalysis::update()
+    {
+        std::vector<std::vector<std::uint32_t>> callers(nodes_.size());
+        std::vector<std::uint32_t> impure;
+        std::vector<std::uint32_t> nondeterministic;
+
+        for (std::uint32_t id = 0; id < nodes_.size(); ++id)
+        {
+            auto &n = nodes_[id];
+            n.effects = {n.defined, false, n.defined};
+
+            for (auto callee : n.callees)
+            {
+                callers[callee].push_back(id);
+            }
+
+            if (n.defined && (n.usesRuntime || std::any_of(n.callees.begin(), n.callees.end(), [this](auto callee)
+                                                           { return !nodes_[callee].defined; })))
+            {
+                nondeterministic.push_back(id);
+                impure.push_back(id);
+            }
+            else if (n.defined && n.memoized)
+            {
+                impure.push_back(id);
+            }
+        }
+
+        spreadImpurity(&Effects::pure, std::move(impure), callers);
+        spreadImpurity(&Effects::deterministic, std::move(nondeterministic), callers);
+
+        std::vector<std::size_t> pendingCallees(nodes_.size());
+        std::vector<std::uint32_t> terminating;
+
+        for (std::uint32_t id = 0; id < nodes_.size(); ++id)
+        {
+            auto const &n = nodes_[id];
+            pendingCallees[id] = n.callees.size();
+
+            if (n.effects.pure && !n.hasLoops && n.callees.empty())
+            {
+                terminating.push_back(id);
+            }
+        }
+
+        while (!terminating.empty())
+        {
+            auto id = terminating.back();
+            terminating.pop_back();
+            nodes_[id].effects.terminates = true;
+
+            for (auto caller : callers[id])
+            {
+                if (--pendingCallees[caller] == 0 && nodes_[caller].effects.pure && !nodes_[caller].hasLoops)
+                {
+                    terminating.push_back(caller);
+                }
+            }
+        }
+    }
+
+    void EffectAnalysis::spreadImpurity(bool Effects::*flag, std::vector<std::uint32_t> impure,
+                                        std::vector<std::vector<std::uint32_t>> const &callers)
+    {
+        for (auto id : impure)
+        {
+            nodes_[id].effects.*flag = false;
+        }
+
+        while (!impure.empty())
+        {
+            auto id = impure.back();
+            impure.pop_back();
+
+            for (auto caller : callers[id])
+            {
+                if (nodes_[caller].effects.*flag)
+                {
+                    nodes_[caller].effects.*flag = false;
+                    impure.push_back(caller);
+                }
+            }
+        }
+    }
+}
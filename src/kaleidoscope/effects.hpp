@@ -0,0 +1,70 @@
+#ifndef INCLUDED_KALEIDOSCOPE_EFFECTS_HPP
+#define INCLUDED_KALEIDOSCOPE_EFFECTS_HPP
+
+#include "ast.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace kaleidoscope
+{
+    struct Effects
+    {
+        /// reads and writes no memory but its own stack frame, and does no I/O
+        bool pure = false;
+        /// pure and always returns: contains no loop and is not recursive
+        bool terminates = false;
+        /// pure but for the caches of the memo functions it is or calls, so
+        /// it returns the same result for the same arguments and its calls
+        /// can be cached in turn
+        bool deterministic = false;
+    };
+
+    /// EffectAnalysis - interprocedural effect analysis over the definitions
+    /// seen so far. A function is impure if it is a memo function (it writes
+    /// its cache), if it indexes an array or runs a parfor loop or if it
+    /// calls, directly or transitively, a function without a definition, i.e.
+    /// an extern such as putchard or printd, or one of the array builtins.
+    /// Calls of math builtins (see mathbuiltins.hpp) are pure. The effects are
+    /// updated whenever a definition is added, so a function called before it
+    /// is defined becomes pure once its definition arrives.
+    class EffectAnalysis
+    {
+    public:
+        /// adds or replaces the definition of function's name
+        void addDefinition(FunctionAST const &function);
+        void removeDefinition(Symbol name);
+
+        bool isDefined(Symbol name) const;
+        Effects getEffects(Symbol name) const;
+
+    private:
+        struct Node
+        {
+            bool defined = false;
+            bool memoized = false;
+            /// indexes arrays or runs parfor loops
+            bool usesRuntime = false;
+            bool hasLoops = false;
+            /// called by some definition
+            bool referenced = false;
+            // Symbol ids, one entry per call site
+            std::vector<std::uint32_t> callees;
+            Effects effects;
+        };
+
+        /// effects of a definition nobody calls, from the effects of its callees
+        void updateLeaf(std::uint32_t id);
+        /// recomputes the effects of all definitions
+        void update();
+        /// clears flag in the effects of the definitions in impure and of
+        /// their callers, transitively
+        void spreadImpurity(bool Effects::*flag, std::vector<std::uint32_t> impure,
+                            std::vector<std::vector<std::uint32_t>> const &callers);
+
+        // indexed by Symbol::id()
+        std::vector<Node> nodes_;
+    };
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include "interner.hpp"
+
+#include <mutex>
+
+namespace kaleidoscope
+{
+    Symbol::Symbol(std::string_view name)
+        : Symbol(SymbolInterner::instance().intern(name))
+    {
+    }
+
+    std::string_view Symbol::str() const
+    {
+        return SymbolInterner::instance().name(*this);
+    }
+
+    std::ostream &operator<<(std::ostream &out, Symbol sym)
+    {
+        return out << sym.str();
+    }
+
+    SymbolInterner::SymbolInterner()
+    {
+        names_.emplace_back();
+        ids_.emplace(std::string_view(), 0);
+    }
+
+    SymbolInterner &SymbolInterner::instance()
+    {
+        static SymbolInterner interner;
+        return interner;
+    }
+
+    Symbol SymbolInterner::intern(std::string_view name)
+    {
+        {
+            std::shared_lock lock(mutex_);
+
+            auto iter = ids_.find(name);
+            if (iter != ids_.end())
+            {
+                return Symbol(iter->second);
+            }
+        }
+
+        std::unique_lock lock(mutex_);
+
+        // someone else may have inserted the name between the two locks.
+        auto iter = ids_.find(name);
+        if (iter != ids_.end())
+        {
+            return Symbol(iter->second);
+        }
+
+        std::string_view stored = storage_.emplace_back(name);
+        auto id = static_cast<std::uint32_t>(names_.size());
+
+        names_.push_back(stored);
+        ids_.emplace(stored, id);
+
+        return Symbol(id);
+    }
+
+    std::string_view SymbolInterner::name(Symbol sym) const
+    {
+        std::shared_lock lock(mutex_);
+        return names_[sym.id()];
+    }
+
+    std::size_t SymbolInterner::size() const
+    {
+        std::shared_lock lock(mutex_);
+        return names_.size();
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef INCLUDED_KALEIDOSCOPE_INTERNER_HPP
+#define INCLUDED_KALEIDOSCOPE_INTERNER_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <ostream>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// An interned identifier. Two symbols are equal iff their names are equal,
+    /// so comparing and hashing them is an integer operation. Ids are dense, which
+    /// lets tables keyed by symbol be flat arrays indexed by id().
+    class Symbol
+    {
+    public:
+        /// The empty name, id 0.
+        Symbol() = default;
+        explicit Symbol(std::string_view name);
+
+        std::uint32_t id() const noexcept { return id_; }
+        std::string_view str() const;
+
+        bool empty() const noexcept { return id_ == 0; }
+
+        friend bool operator==(Symbol lhs, Symbol rhs) noexcept { return lhs.id_ == rhs.id_; }
+        friend bool operator!=(Symbol lhs, Symbol rhs) noexcept { return lhs.id_ != rhs.id_; }
+
+    private:
+        friend class SymbolInterner;
+
+        explicit Symbol(std::uint32_t id) noexcept : id_(id) {}
+
+        std::uint32_t id_ = 0;
+    };
+
+    std::ostream &operator<<(std::ostream &out, Symbol sym);
+
+    /// Session-wide table of identifier names. Interning is thread-safe, and the
+    /// name of a symbol stays valid until the end of the program.
+    class SymbolInterner
+    {
+    public:
+        static SymbolInterner &instance();
+
+        Symbol intern(std::string_view name);
+        std::string_view name(Symbol sym) const;
+
+        std::size_t size() const;
+
+    private:
+        SymbolInterner();
+
+        mutable std::shared_mutex mutex_;
+        // deque never moves its elements, so views of the stored strings stay valid
+        std::deque<std::string> storage_;
+        std::vector<std::string_view> names_;
+        std::unordered_map<std::string_view, std::uint32_t> ids_;
+    };
+}
+
+template <>
+struct std::hash<kaleidoscope::Symbol>
+{
+    std::size_t operator()(kaleidoscope::Symbol sym) const noexcept
+    {
+        return sym.id();
+    }
+};
+
+#endif
@@ -1,10 +1,16 @@
 #include "jit.hpp"
 
 #include "api_functions.hpp"
+#include "codegen.hpp"
+#include "optimizer.hpp"
+
+#include <llvm/Support/DynamicLibrary.h>
 
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Target/TargetMachine.h>
 
+#include <iostream>
+
 namespace kaleidoscope
 {
     // Alles, was den JIT verwendet, verwendet auch die API-Funktionen.
@@ -14,8 +20,10 @@ namespace kaleidoscope
 
     KaleidoscopeJIT::KaleidoscopeJIT(std::unique_ptr<llvm::orc::ExecutionSession> ES,
                                      llvm::orc::JITTargetMachineBuilder JTMB,
-                                     llvm::DataLayout DL)
-        : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL),
+                                     llvm::DataLayout DL,
+                                     std::unique_ptr<llvm::TargetMachine> TM,
+                                     llvm::TargetLibraryInfoImpl::VectorLibrary VecLib)
+        : ES(std::move(ES)), DL(std::move(DL)), Mangle(*this->ES, this->DL), TM(std::move(TM)), JTMB(JTMB), VecLib(VecLib),
           ObjectLayer(*this->ES,
                       []()
                       { return std::make_unique<llvm::SectionMemoryManager>(); }),
@@ -26,7 +34,7 @@ namespace kaleidoscope
         MainJD.addGenerator(
             cantFail(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
                 DL.getGlobalPrefix())));
-        if (JTMB.getTargetTriple().isOSBinFormatCOFF())
+        if (this->JTMB.getTargetTriple().isOSBinFormatCOFF())
         {
             ObjectLayer.setOverrideObjectFlagsWithResponsibilityFlags(true);
             ObjectLayer.setAutoClaimResponsibilityForObjectSymbols(true);
@@ -35,11 +43,14 @@ namespace kaleidoscope
 
     KaleidoscopeJIT::~KaleidoscopeJIT()
     {
+        // before the session, which the tier-up thread uses
+        Tiering.reset();
+
         if (auto Err = ES->endSession())
             ES->reportError(std::move(Err));
     }
 
-    llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> KaleidoscopeJIT::Create()
+    llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> KaleidoscopeJIT::Create(FastMath fastMath)
     {
         llvm::InitializeNativeTarget();
         llvm::InitializeNativeTargetAsmPrinter();
@@ -54,12 +65,35 @@ namespace kaleidoscope
         llvm::orc::JITTargetMachineBuilder JTMB(
             ES->getExecutorProcessControl().getTargetTriple());
 
+        // Vectorized loops call the functions of the vector library, which
+        // the search of the current process finds once it is loaded. Without
+        // it, math functions are only called for single elements.
+        auto VecLib = kaleidoscope::getVectorLibrary(JTMB.getTargetTriple());
+        if (VecLib == llvm::TargetLibraryInfoImpl::LIBMVEC_X86)
+        {
+            std::string errMsg;
+            if (llvm::sys::DynamicLibrary::LoadLibraryPermanently("libmvec.so.1", &errMsg))
+            {
+                std::cerr << "cannot load libmvec, math functions are not vectorized: " << errMsg << std::endl;
+                VecLib = llvm::TargetLibraryInfoImpl::NoLibrary;
+            }
+        }
+
+        // for modules optimised with a profile
+        enableColdCodeSplitting(JTMB.getOptions());
+        // for all tiers, whose target machines are created from JTMB
+        applyFastMath(JTMB.getOptions(), fastMath);
+
         auto DL = JTMB.getDefaultDataLayoutForTarget();
         if (!DL)
             return DL.takeError();
 
+        auto TM = JTMB.createTargetMachine();
+        if (!TM)
+            return TM.takeError();
+
         return std::make_unique<KaleidoscopeJIT>(std::move(ES), std::move(JTMB),
-                                                 std::move(*DL));
+                                                 std::move(*DL), std::move(*TM), VecLib);
     }
 
     llvm::Error KaleidoscopeJIT::addModule(llvm::orc::ThreadSafeModule TSM, llvm::orc::ResourceTrackerSP RT)
@@ -69,6 +103,23 @@ namespace kaleidoscope
         return CompileLayer.add(RT, std::move(TSM));
     }
 
+    llvm::Error KaleidoscopeJIT::enableTiering(TieringOptions options)
+    {
+        options.vectorLibrary = VecLib;
+
+        auto tiering = TieredCompiler::Create(*ES, MainJD, Mangle, ObjectLayer, CompileLayer, JTMB, std::move(options));
+        if (!tiering)
+            return tiering.takeError();
+
+        Tiering = std::move(*tiering);
+        return llvm::Error::success();
+    }
+
+    llvm::Error KaleidoscopeJIT::addTieredModule(llvm::orc::ThreadSafeModule TSM)
+    {
+        return Tiering->addModule(std::move(TSM));
+    }
+
     llvm::Expected<llvm::JITEvaluatedSymbol> KaleidoscopeJIT::lookup(llvm::StringRef Name)
     {
         return ES->lookup({&MainJD}, Mangle(Name.str()));
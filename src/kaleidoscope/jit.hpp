@@ -1,6 +1,9 @@
 #ifndef INCLUDED_KALEIDOSCOPE_JIT_HPP
 #define INCLUDED_KALEIDOSCOPE_JIT_HPP
 
+#include "ast.hpp"
+#include "tiering.hpp"
+
 #include <llvm/ADT/StringRef.h>
 #include <llvm/ExecutionEngine/JITSymbol.h>
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
@@ -9,8 +12,12 @@
 #include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
 #include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
 #include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/IR/DataLayout.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <memory>
 
 namespace kaleidoscope
 {
@@ -21,26 +28,46 @@ namespace kaleidoscope
 
         llvm::DataLayout DL;
         llvm::orc::MangleAndInterner Mangle;
+        std::unique_ptr<llvm::TargetMachine> TM;
+        llvm::orc::JITTargetMachineBuilder JTMB;
+        llvm::TargetLibraryInfoImpl::VectorLibrary VecLib;
 
         llvm::orc::RTDyldObjectLinkingLayer ObjectLayer;
         llvm::orc::IRCompileLayer CompileLayer;
 
         llvm::orc::JITDylib &MainJD;
 
+        std::unique_ptr<TieredCompiler> Tiering;
+
     public:
         KaleidoscopeJIT(std::unique_ptr<llvm::orc::ExecutionSession> ES,
                         llvm::orc::JITTargetMachineBuilder JTMB,
-                        llvm::DataLayout DL);
+                        llvm::DataLayout DL,
+                        std::unique_ptr<llvm::TargetMachine> TM,
+                        llvm::TargetLibraryInfoImpl::VectorLibrary VecLib);
 
         ~KaleidoscopeJIT();
 
-        static llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> Create();
+        /// fastMath: the flags the modules are generated with, see applyFastMath()
+        static llvm::Expected<std::unique_ptr<KaleidoscopeJIT>> Create(FastMath fastMath = FastMath::None);
 
         const llvm::DataLayout &getDataLayout() const { return DL; }
+        /// the target modules are compiled for, to optimize them for it
+        llvm::TargetMachine *getTargetMachine() const { return TM.get(); }
+        /// the vector library optimised modules may call, NoLibrary if it
+        /// could not be loaded
+        llvm::TargetLibraryInfoImpl::VectorLibrary getVectorLibrary() const { return VecLib; }
         llvm::orc::JITDylib &getMainJITDylib() { return MainJD; }
 
         llvm::Error addModule(llvm::orc::ThreadSafeModule TSM, llvm::orc::ResourceTrackerSP RT = nullptr);
 
+        /// compiles the modules passed to addTieredModule() in tiers, see TieredCompiler
+        llvm::Error enableTiering(TieringOptions options);
+        /// adds a module of definitions, which start unoptimised and are optimised once they are hot
+        llvm::Error addTieredModule(llvm::orc::ThreadSafeModule TSM);
+        /// see TieredCompiler::takeCallFailures()
+        llvm::Error takeCallFailures() { return TieredCompiler::takeCallFailures(); }
+
         llvm::Expected<llvm::JITEvaluatedSymbol> lookup(llvm::StringRef Name);
     };
 }
@@ -0,0 +1,109 @@
+#ifndef INCLUDED_KALEIDOSCOPE_KEYWORDS_HPP
+#define INCLUDED_KALEIDOSCOPE_KEYWORDS_HPP
+
+#include "token.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace kaleidoscope
+{
+    namespace detail
+    {
+        struct KeywordEntry
+        {
+            std::string_view spelling;
+            TokenType type;
+        };
+
+        inline constexpr KeywordEntry keywordList[] = {
+#define KEYWORD(kw) {#kw, tok_##kw},
+#include "keywords.list"
+        };
+
+        inline constexpr unsigned keywordTableBits = 5;
+        inline constexpr std::size_t keywordTableSize = std::size_t(1) << keywordTableBits;
+
+        static_assert(std::size(keywordList) <= keywordTableSize, "keyword table too small for keywords.list");
+
+        // Only looks at the first and last character and the length, so a lookup
+        // is three multiplications and one string compare.
+        constexpr std::uint32_t keywordHash(std::string_view word, std::uint32_t seed) noexcept
+        {
+            std::uint32_t h = seed;
+            h = (h ^ static_cast<unsigned char>(word.front())) * 0x01000193u;
+            h = (h ^ static_cast<unsigned char>(word.back())) * 0x01000193u;
+            h = (h ^ static_cast<std::uint32_t>(word.size())) * 0x01000193u;
+            return h >> (32 - keywordTableBits);
+        }
+
+        constexpr bool isPerfectSeed(std::uint32_t seed) noexcept
+        {
+            std::array<bool, keywordTableSize> used{};
+
+            for (auto const &entry : keywordList)
+            {
+                auto slot = keywordHash(entry.spelling, seed);
+
+                if (used[slot])
+                {
+                    return false;
+                }
+
+                used[slot] = true;
+            }
+
+            return true;
+        }
+
+        constexpr std::uint32_t findPerfectSeed() noexcept
+        {
+            std::uint32_t seed = 0x811c9dc5u;
+
+            while (!isPerfectSeed(seed))
+            {
+                ++seed;
+            }
+
+            return seed;
+        }
+
+        inline constexpr std::uint32_t keywordSeed = findPerfectSeed();
+
+        constexpr std::array<KeywordEntry, keywordTableSize> buildKeywordTable() noexcept
+        {
+            std::array<KeywordEntry, keywordTableSize> table{};
+
+            for (auto &slot : table)
+            {
+                slot = {"", tok_identifier};
+            }
+
+            for (auto const &entry : keywordList)
+            {
+                table[keywordHash(entry.spelling, keywordSeed)] = entry;
+            }
+
+            return table;
+        }
+
+        inline constexpr auto keywordTable = buildKeywordTable();
+    }
+
+    /// Looks up a keyword in the perfect hash table generated from keywords.list
+    /// at compile time. Returns tok_identifier if the word is not a keyword.
+    constexpr TokenType lookupKeyword(std::string_view word) noexcept
+    {
+        if (word.empty())
+        {
+            return tok_identifier;
+        }
+
+        auto const &entry = detail::keywordTable[detail::keywordHash(word, detail::keywordSeed)];
+        return entry.spelling == word ? entry.type : tok_identifier;
+    }
+}
+
+#endif
@@ -1,37 +1,115 @@
 #include "lexer.hpp"
 
+#include "charscan.hpp"
+#include "keywords.hpp"
+
 #include <cctype>
-#include <sstream>
+#include <charconv>
+#include <cstring>
 #include <string>
 
 namespace kaleidoscope
 {
+    namespace
+    {
+        Token identifierOrKeyword(std::string_view identifier)
+        {
+            auto keyword = lookupKeyword(identifier);
+
+            if (keyword != tok_identifier)
+            {
+                return keyword;
+            }
+
+            return Symbol(identifier);
+        }
+
+        double parseNumber(char const *first, char const *last)
+        {
+            // like the old istringstream parser, malformed numbers such as "." come out as 0
+            double NumVal = 0.0;
+            std::from_chars(first, last, NumVal);
+            return NumVal;
+        }
+    }
+
     Lexer::Lexer(std::istream &in)
-        : in_(in),
-          keywords_({
-#define KEYWORD(kw) {#kw, tok_##kw},
-#include "keywords.list"
-          })
+        : in_(&in)
+    {
+    }
+
+    Lexer::Lexer(std::string_view buffer)
+        : pos_(buffer.data()),
+          end_(buffer.data() + buffer.size())
+    {
+    }
+
+    Lexer::Lexer(std::string_view buffer, SourceLocation const &start)
+        : pos_(buffer.data()),
+          end_(buffer.data() + buffer.size()),
+          srcLoc_(start)
     {
     }
 
     bool Lexer::advance()
     {
-        if (in_.get(LastChar))
+        if (in_)
         {
-            srcLoc_.advance(LastChar);
-            return true;
+            if (in_->get(LastChar))
+            {
+                srcLoc_.advance(LastChar);
+                return true;
+            }
+
+            return false;
+        }
+
+        advanceTo(pos_);
+        return !bufferExhausted_;
+    }
+
+    // Buffer mode: consumes everything up to next, then makes *next the current
+    // character, just as if the characters had been read one by one with advance().
+    void Lexer::advanceTo(char const *next)
+    {
+        char const *consumedEnd = next;
+
+        if (next != end_)
+        {
+            LastChar = *next;
+            consumedEnd = next + 1;
         }
         else
         {
-            return false;
+            bufferExhausted_ = true;
         }
+
+        srcLoc_.advance(std::string_view(pos_, consumedEnd - pos_));
+        pos_ = consumedEnd;
     }
 
     void Lexer::discardLine()
     {
-        while (in_.get(LastChar) && LastChar != '\n')
+        if (in_)
         {
+            while (in_->get(LastChar) && LastChar != '\n')
+            {
+            }
+        }
+        else
+        {
+            auto newline = static_cast<char const *>(std::memchr(pos_, '\n', end_ - pos_));
+
+            if (newline != nullptr)
+            {
+                LastChar = '\n';
+                pos_ = newline + 1;
+            }
+            else
+            {
+                pos_ = end_;
+                bufferExhausted_ = true;
+            }
         }
 
         srcLoc_.advanceLine();
@@ -39,55 +117,102 @@ namespace kaleidoscope
 
     Token Lexer::gettok()
     {
-        while (std::isspace(LastChar) && advance())
-        {
-        }
+        return in_ ? gettokFromStream() : gettokFromBuffer();
+    }
 
-        if (!in_)
+    Token Lexer::operatorToken()
+    {
+        char ThisChar = LastChar;
+
+        if (advance() && (ThisChar == '&' || ThisChar == '|') && LastChar == ThisChar)
         {
-            return tok_eof;
+            advance();
+            return ThisChar == '&' ? op_and : op_or;
         }
-        else if (std::isalpha(LastChar))
-        {
-            std::string identifier({LastChar});
 
-            while (advance() && std::isalnum(LastChar))
+        return ThisChar;
+    }
+
+    Token Lexer::gettokFromStream()
+    {
+        while (true)
+        {
+            while (std::isspace(LastChar) && advance())
             {
-                identifier += LastChar;
             }
 
-            auto keyword_iter = keywords_.find(identifier);
-            if (keyword_iter != keywords_.end())
+            if (!*in_)
             {
-                return keyword_iter->second;
+                return tok_eof;
             }
+            else if (std::isalpha(LastChar))
+            {
+                tokenText_.assign(1, LastChar);
 
-            return identifier;
-        }
-        else if (std::isdigit(LastChar) || LastChar == '.')
-        {
-            std::string NumStr;
+                while (advance() && std::isalnum(LastChar))
+                {
+                    tokenText_ += LastChar;
+                }
 
-            do
+                return identifierOrKeyword(tokenText_);
+            }
+            else if (std::isdigit(LastChar) || LastChar == '.')
             {
-                NumStr += LastChar;
-            } while (advance() && (std::isdigit(LastChar) || LastChar == '.'));
+                tokenText_.clear();
 
-            std::istringstream parser(NumStr);
-            double NumVal = 0.0;
-            parser >> NumVal;
+                do
+                {
+                    tokenText_ += LastChar;
+                } while (advance() && (std::isdigit(LastChar) || LastChar == '.'));
 
-            return NumVal;
+                return parseNumber(tokenText_.data(), tokenText_.data() + tokenText_.size());
+            }
+            else if (LastChar == '#')
+            {
+                discardLine();
+                continue;
+            }
+
+            return operatorToken();
         }
-        else if (LastChar == '#')
+    }
+
+    Token Lexer::gettokFromBuffer()
+    {
+        while (true)
         {
-            discardLine();
-            return gettok();
-        }
+            if (!bufferExhausted_ && std::isspace(LastChar))
+            {
+                advanceTo(skipWhitespace(pos_, end_));
+            }
 
-        char ThisChar = LastChar;
-        advance();
+            if (bufferExhausted_)
+            {
+                return tok_eof;
+            }
+            else if (std::isalpha(LastChar))
+            {
+                char const *start = pos_ - 1;
+                char const *stop = skipAlnum(pos_, end_);
 
-        return ThisChar;
+                advanceTo(stop);
+                return identifierOrKeyword(std::string_view(start, stop - start));
+            }
+            else if (std::isdigit(LastChar) || LastChar == '.')
+            {
+                char const *start = pos_ - 1;
+                char const *stop = skipNumberChars(pos_, end_);
+
+                advanceTo(stop);
+                return parseNumber(start, stop);
+            }
+            else if (LastChar == '#')
+            {
+                discardLine();
+                continue;
+            }
+
+            return operatorToken();
+        }
     }
-} // namespace kaleidoscope
\ No newline at end of file
+} // namespace kaleidoscope
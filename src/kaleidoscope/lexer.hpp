@@ -5,7 +5,8 @@
 #include "token.hpp"
 
 #include <istream>
-#include <map>
+#include <string>
+#include <string_view>
 
 namespace kaleidoscope
 {
@@ -14,19 +15,35 @@ namespace kaleidoscope
     public:
         Lexer(std::istream &in);
 
+        /// Lexes an in-memory buffer (e.g. SourceBuffer::getText()) without copying it.
+        Lexer(std::string_view buffer);
+
+        /// Lexes a slice of a larger buffer; start is the location of buffer.data()
+        /// within the complete text, so tokens report their position in the file.
+        Lexer(std::string_view buffer, SourceLocation const &start);
+
         Token gettok();
         SourceLocation const &getLocation() const { return srcLoc_; }
 
     private:
+        Token gettokFromStream();
+        Token gettokFromBuffer();
+        Token operatorToken();
+
         bool advance();
+        void advanceTo(char const *next);
         void discardLine();
 
-        std::istream &in_;
+        std::istream *in_ = nullptr;
+        std::string tokenText_;
+
+        char const *pos_ = nullptr;
+        char const *end_ = nullptr;
+        bool bufferExhausted_ = false;
+
         char LastChar = ' ';
 
         SourceLocation srcLoc_;
-
-        std::map<std::string, TokenType> keywords_;
     };
 } // namespace kaleidoscope
 
@@ -0,0 +1,44 @@
+#include "mathbuiltins.hpp"
+
+#include <algorithm>
+#include <array>
+#include <iterator>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        // sorted by name
+        constexpr std::array mathBuiltins{
+            MathBuiltin{"ceil", llvm::Intrinsic::ceil, 1},
+            MathBuiltin{"copysign", llvm::Intrinsic::copysign, 2},
+            MathBuiltin{"cos", llvm::Intrinsic::cos, 1},
+            MathBuiltin{"exp", llvm::Intrinsic::exp, 1},
+            MathBuiltin{"exp2", llvm::Intrinsic::exp2, 1},
+            MathBuiltin{"fabs", llvm::Intrinsic::fabs, 1},
+            MathBuiltin{"floor", llvm::Intrinsic::floor, 1},
+            MathBuiltin{"fma", llvm::Intrinsic::fma, 3},
+            MathBuiltin{"fmax", llvm::Intrinsic::maxnum, 2},
+            MathBuiltin{"fmin", llvm::Intrinsic::minnum, 2},
+            MathBuiltin{"log", llvm::Intrinsic::log, 1},
+            MathBuiltin{"log10", llvm::Intrinsic::log10, 1},
+            MathBuiltin{"log2", llvm::Intrinsic::log2, 1},
+            MathBuiltin{"pow", llvm::Intrinsic::pow, 2},
+            MathBuiltin{"round", llvm::Intrinsic::round, 1},
+            MathBuiltin{"sin", llvm::Intrinsic::sin, 1},
+            MathBuiltin{"sqrt", llvm::Intrinsic::sqrt, 1},
+            MathBuiltin{"trunc", llvm::Intrinsic::trunc, 1},
+        };
+
+        static_assert(std::is_sorted(mathBuiltins.begin(), mathBuiltins.end(), [](auto const &lhs, auto const &rhs)
+                                     { return lhs.name < rhs.name; }));
+    }
+
+    MathBuiltin const *getMathBuiltin(std::string_view name)
+    {
+        auto builtin = std::lower_bound(mathBuiltins.begin(), mathBuiltins.end(), name, [](auto const &builtin, auto name)
+                                        { return builtin.name < name; });
+
+        return builtin != mathBuiltins.end() && builtin->name == name ? &*builtin : nullptr;
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef INCLUDED_KALEIDOSCOPE_MATHBUILTINS_HPP
+#define INCLUDED_KALEIDOSCOPE_MATHBUILTINS_HPP
+
+#include <llvm/IR/Intrinsics.h>
+
+#include <string_view>
+
+namespace kaleidoscope
+{
+    /// MathBuiltin - a libm function that calls lower to an LLVM intrinsic
+    /// instead of an external call, so that LLVM can fold, hoist and
+    /// vectorize them. A definition of the same name takes precedence, an
+    /// extern of it is allowed and changes nothing.
+    struct MathBuiltin
+    {
+        std::string_view name;
+        llvm::Intrinsic::ID intrinsic;
+        unsigned arity;
+    };
+
+    /// the builtin called name, nullptr if there is none
+    MathBuiltin const *getMathBuiltin(std::string_view name);
+}
+
+#endif
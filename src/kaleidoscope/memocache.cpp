@@ -0,0 +1,177 @@
+#include "memocache.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        struct MemoRegistry
+        {
+            std::mutex mutex;
+            std::vector<std::unique_ptr<MemoCache>> caches;
+        };
+
+        MemoRegistry &registry()
+        {
+            static MemoRegistry instance;
+            return instance;
+        }
+    }
+
+    MemoCache::MemoCache(std::string name, std::size_t arity, MemoOptions const &options)
+        : arity_(arity),
+          slotWords_(arity + 2),
+          mask_(std::bit_ceil(std::max<std::size_t>(options.capacity, probeLength)) - 1),
+          eviction_(options.eviction),
+          slots_((mask_ + 1) * slotWords_)
+    {
+        statistics_.name = std::move(name);
+        statistics_.capacity = mask_ + 1;
+    }
+
+    std::size_t MemoCache::hash(double const *args) const
+    {
+        std::uint64_t h = arity_;
+
+        for (std::size_t i = 0; i < arity_; ++i)
+        {
+            h = std::rotl(h, 31) ^ std::bit_cast<std::uint64_t>(args[i]);
+        }
+
+        // the low mantissa bits of small integers are all 0, so mix every bit
+        // into the low ones used as the slot index (MurmurHash3 finalizer)
+        h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdu;
+        h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53u;
+        return static_cast<std::size_t>(h ^ (h >> 33));
+    }
+
+    bool MemoCache::matches(std::uint64_t const *entry, double const *args) const
+    {
+        for (std::size_t i = 0; i < arity_; ++i)
+        {
+            if (entry[i + 2] != std::bit_cast<std::uint64_t>(args[i]))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool MemoCache::lookup(double const *args, double &result)
+    {
+        std::lock_guard lock(mutex_);
+        auto home = hash(args);
+
+        for (std::size_t i = 0; i < probeLength; ++i)
+        {
+            auto entry = slot((home + i) & mask_);
+
+            // entries are never removed, only replaced, so the window ends at an empty slot
+            if (entry[0] == 0)
+            {
+                break;
+            }
+
+            if (matches(entry, args))
+            {
+                if (eviction_ == MemoEviction::LeastRecentlyUsed)
+                {
+                    entry[0] = ++clock_;
+                }
+
+                result = std::bit_cast<double>(entry[1]);
+                ++statistics_.hits;
+                return true;
+            }
+        }
+
+        ++statistics_.misses;
+        return false;
+    }
+
+    void MemoCache::store(double const *args, double result)
+    {
+        std::lock_guard lock(mutex_);
+        auto home = hash(args);
+
+        auto write = [&](std::uint64_t *entry)
+        {
+            entry[0] = ++clock_;
+            entry[1] = std::bit_cast<std::uint64_t>(result);
+            std::transform(args, args + arity_, entry + 2, [](double arg)
+                           { return std::bit_cast<std::uint64_t>(arg); });
+        };
+
+        std::uint64_t *victim = nullptr;
+
+        for (std::size_t i = 0; i < probeLength; ++i)
+        {
+            auto entry = slot((home + i) & mask_);
+
+            if (entry[0] == 0 || matches(entry, args))
+            {
+                statistics_.size += entry[0] == 0;
+                return write(entry);
+            }
+
+            // the smallest stamp is the oldest or least recently used entry
+            if (victim == nullptr || entry[0] < victim[0])
+            {
+                victim = entry;
+            }
+        }
+
+        if (eviction_ != MemoEviction::None)
+        {
+            ++statistics_.evictions;
+            write(victim);
+        }
+    }
+
+    MemoStatistics MemoCache::getStatistics() const
+    {
+        std::lock_guard lock(mutex_);
+        return statistics_;
+    }
+
+    std::vector<MemoStatistics> getMemoStatistics()
+    {
+        auto &memoRegistry = registry();
+        std::lock_guard lock(memoRegistry.mutex);
+
+        std::vector<MemoStatistics> result;
+        for (auto const &cache : memoRegistry.caches)
+        {
+            result.push_back(cache->getStatistics());
+        }
+
+        return result;
+    }
+
+    MemoCache &getMemoCache(MemoDescriptor &descriptor)
+    {
+        std::atomic_ref<MemoCache *> cache(descriptor.cache);
+
+        if (auto existing = cache.load(std::memory_order_acquire))
+        {
+            return *existing;
+        }
+
+        auto &memoRegistry = registry();
+        std::lock_guard lock(memoRegistry.mutex);
+
+        if (cache.load(std::memory_order_relaxed) == nullptr)
+        {
+            MemoOptions options{descriptor.capacity, static_cast<MemoEviction>(descriptor.eviction)};
+            memoRegistry.caches.push_back(std::make_unique<MemoCache>(descriptor.name, descriptor.arity, options));
+            cache.store(memoRegistry.caches.back().get(), std::memory_order_release);
+        }
+
+        return *cache.load(std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef INCLUDED_KALEIDOSCOPE_MEMOCACHE_HPP
+#define INCLUDED_KALEIDOSCOPE_MEMOCACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// What a MemoCache does with a new result when all slots it may occupy are taken.
+    enum class MemoEviction : std::uint32_t
+    {
+        /// the result is not cached
+        None,
+        /// replaces the entry stored first
+        Oldest,
+        /// replaces the entry that was looked up least recently
+        LeastRecentlyUsed
+    };
+
+    struct MemoOptions
+    {
+        /// number of entries, rounded up to a power of two
+        std::uint32_t capacity = 4096;
+        MemoEviction eviction = MemoEviction::LeastRecentlyUsed;
+    };
+
+    struct MemoStatistics
+    {
+        std::string name;
+        std::uint64_t hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::size_t size = 0;
+        std::size_t capacity = 0;
+    };
+
+    /// MemoCache - the result cache of one 'memo def' function. A fixed-capacity
+    /// open addressing table: an entry is searched for in a window of
+    /// probeLength consecutive slots starting at the hash of the arguments, and
+    /// the arguments and result of an entry are stored next to each other, so a
+    /// lookup touches one or two cache lines. Arguments are compared bitwise.
+    class MemoCache
+    {
+    public:
+        static constexpr std::size_t probeLength = 8;
+
+        MemoCache(std::string name, std::size_t arity, MemoOptions const &options);
+
+        /// stores the cached result for args in result if there is one
+        bool lookup(double const *args, double &result);
+        void store(double const *args, double result);
+
+        MemoStatistics getStatistics() const;
+
+    private:
+        // slot layout: stamp, result, arguments; a stamp of 0 marks an empty slot
+        std::uint64_t *slot(std::size_t index) { return &slots_[index * slotWords_]; }
+        std::size_t hash(double const *args) const;
+        bool matches(std::uint64_t const *entry, double const *args) const;
+
+        std::size_t arity_;
+        std::size_t slotWords_;
+        std::size_t mask_;
+        MemoEviction eviction_;
+        std::vector<std::uint64_t> slots_;
+
+        mutable std::mutex mutex_;
+        std::uint64_t clock_ = 0;
+        MemoStatistics statistics_;
+    };
+
+    /// MemoDescriptor - the global CodeGenerator emits for every memo function,
+    /// with the same layout. The cache is null until the first call.
+    struct MemoDescriptor
+    {
+        MemoCache *cache;
+        char const *name;
+        std::uint32_t arity;
+        std::uint32_t capacity;
+        std::uint32_t eviction;
+    };
+
+    /// creates the cache of descriptor on first use; safe to call from several threads
+    MemoCache &getMemoCache(MemoDescriptor &descriptor);
+
+    /// statistics of the caches of all memo functions called so far, oldest first
+    std::vector<MemoStatistics> getMemoStatistics();
+}
+
+#endif
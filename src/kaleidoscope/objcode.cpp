@@ -1,5 +1,7 @@
 #include "objcode.hpp"
 
+#include "optimizer.hpp"
+
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Host.h>
@@ -48,18 +50,37 @@ namespace kaleidoscope
         }
     }
 
+    void ObjCodeWriter::setProfileOptions(ProfileOptions const &options)
+    {
+        profile_ = options;
+
+        if (!profile_.useFile.empty())
+        {
+            enableColdCodeSplitting(targetMachine_->Options);
+        }
+    }
+
     void ObjCodeWriter::writeModuleToStream(llvm::raw_pwrite_stream &dest,
                                             llvm::Module &module,
                                             llvm::CodeGenFileType fileType)
     {
         llvm::legacy::PassManager passManager;
 
+        // lets the code generator call vector math functions for vector intrinsics
+        passManager.add(new llvm::TargetLibraryInfoWrapperPass(createTargetLibraryInfo(targetMachine_->getTargetTriple())));
+
         if (targetMachine_->addPassesToEmitFile(passManager, dest, nullptr, fileType))
         {
             throw ObjCodeError("TheTargetMachine can't emit a file of this type");
         }
 
         module.setDataLayout(targetMachine_->createDataLayout());
+
+        if (profile_.enabled())
+        {
+            optimizeModule(module, targetMachine_.get(), profile_);
+        }
+
         passManager.run(module);
         dest.flush();
     }
@@ -2,6 +2,7 @@
 #define INCLUDED_KALEIDOSCOPE_OBJCODE_HPP
 
 #include "error.hpp"
+#include "optimizer.hpp"
 
 #include <llvm/IR/Module.h>
 #include <llvm/MC/TargetRegistry.h>
@@ -33,12 +34,17 @@ namespace kaleidoscope
 
         auto getDataLayout() const { return targetMachine_->createDataLayout(); }
 
+        /// With profile options, modules are optimised with them before they
+        /// are written, otherwise they are written as they are.
+        void setProfileOptions(ProfileOptions const &options);
+
         void writeModuleToStream(llvm::raw_pwrite_stream &dest,
                                  llvm::Module &module,
                                  llvm::CodeGenFileType fileType = llvm::CGFT_ObjectFile);
 
     private:
         std::unique_ptr<llvm::TargetMachine> targetMachine_;
+        ProfileOptions profile_;
     };
 }
 
@@ -1,18 +1,67 @@
 #include "optimizer.hpp"
 
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/PGOOptions.h>
 
 namespace kaleidoscope
 {
-    void optimizeModule(llvm::Module &module)
+    llvm::TargetLibraryInfoImpl::VectorLibrary getVectorLibrary(llvm::Triple const &triple)
     {
-        llvm::PassBuilder builder;
+        if (triple.getArch() == llvm::Triple::x86_64 && triple.isOSLinux() && triple.isGNUEnvironment())
+        {
+            return llvm::TargetLibraryInfoImpl::LIBMVEC_X86;
+        }
+
+        return llvm::TargetLibraryInfoImpl::NoLibrary;
+    }
+
+    llvm::TargetLibraryInfoImpl createTargetLibraryInfo(llvm::Triple const &triple,
+                                                        std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary> vectorLibrary)
+    {
+        llvm::TargetLibraryInfoImpl libraryInfo(triple);
+        libraryInfo.addVectorizableFunctionsFromVecLib(vectorLibrary.value_or(getVectorLibrary(triple)));
+
+        return libraryInfo;
+    }
+
+    void enableColdCodeSplitting(llvm::TargetOptions &options)
+    {
+        options.EnableMachineFunctionSplitter = true;
+    }
+
+    void optimizeModule(llvm::Module &module, llvm::TargetMachine *targetMachine, ProfileOptions const &profile,
+                        std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary> vectorLibrary)
+    {
+        llvm::Optional<llvm::PGOOptions> pgoOptions;
+
+        if (profile.instrument)
+        {
+            // the lowering of the counters depends on the target's profile runtime
+            if (module.getTargetTriple().empty() && targetMachine != nullptr)
+            {
+                module.setTargetTriple(targetMachine->getTargetTriple().str());
+            }
+
+            pgoOptions = llvm::PGOOptions("", "", "", llvm::PGOOptions::IRInstr);
+        }
+        else if (!profile.useFile.empty())
+        {
+            pgoOptions = llvm::PGOOptions(profile.useFile, "", "", llvm::PGOOptions::IRUse);
+        }
+
+        llvm::PassBuilder builder(targetMachine, llvm::PipelineTuningOptions(), pgoOptions);
 
         llvm::LoopAnalysisManager lam;
         llvm::FunctionAnalysisManager fam;
         llvm::CGSCCAnalysisManager cgam;
         llvm::ModuleAnalysisManager mam;
 
+        // registered first, so that registerFunctionAnalyses keeps it
+        auto libraryInfo = createTargetLibraryInfo(targetMachine != nullptr ? targetMachine->getTargetTriple() : llvm::Triple(module.getTargetTriple()),
+                                                   vectorLibrary);
+        fam.registerPass([&libraryInfo]()
+                         { return llvm::TargetLibraryAnalysis(libraryInfo); });
+
         builder.registerModuleAnalyses(mam);
         builder.registerCGSCCAnalyses(cgam);
         builder.registerFunctionAnalyses(fam);
@@ -23,4 +72,4 @@ namespace kaleidoscope
 
         mpm.run(module, mam);
     }
-}
\ No newline at end of file
+}
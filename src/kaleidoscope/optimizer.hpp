@@ -1,11 +1,54 @@
 #ifndef INCLUDED_KALEIDOSCOPE_OPTIMIZER_HPP
 #define INCLUDED_KALEIDOSCOPE_OPTIMIZER_HPP
 
+#include <llvm/ADT/Triple.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <optional>
+#include <string>
 
 namespace kaleidoscope
 {
-    void optimizeModule(llvm::Module &module);
+    /// ProfileOptions - profile-guided optimisation in optimizeModule(). A
+    /// profile is collected and applied at the same point of the pipeline, so
+    /// a function must be generated and imported alike in both compiles for
+    /// its profile to match.
+    struct ProfileOptions
+    {
+        /// Counts the edges and calls of the module's functions with LLVM's
+        /// IR instrumentation. Object files need compiler-rt's profile runtime
+        /// to write the counts, which llvm-profdata merges into an indexed
+        /// profile; for the JIT, see ProfileCollector.
+        bool instrument = false;
+        /// indexed profile to optimise with: it guides inlining and block
+        /// placement, see also enableColdCodeSplitting()
+        std::string useFile;
+
+        bool enabled() const { return instrument || !useFile.empty(); }
+    };
+
+    /// The vector versions of math functions code for triple may call: those
+    /// of glibc's libmvec on x86-64 Linux, none on other targets.
+    llvm::TargetLibraryInfoImpl::VectorLibrary getVectorLibrary(llvm::Triple const &triple);
+
+    /// library info for triple, with vectorLibrary or else the vector library
+    /// of getVectorLibrary
+    llvm::TargetLibraryInfoImpl createTargetLibraryInfo(llvm::Triple const &triple,
+                                                        std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary> vectorLibrary = std::nullopt);
+
+    /// Lets the code generator move the blocks a profile finds cold out of
+    /// their function into a section of their own, so the hot code is dense.
+    /// Functions without a profile are left as they are.
+    void enableColdCodeSplitting(llvm::TargetOptions &options);
+
+    /// Runs the O2 pipeline. Without the target machine the code will be
+    /// compiled for, the loop vectorizer assumes there are no vector registers
+    /// and the module's triple selects the vector library. vectorLibrary
+    /// overrides that choice, e.g. where the library cannot be loaded.
+    void optimizeModule(llvm::Module &module, llvm::TargetMachine *targetMachine = nullptr, ProfileOptions const &profile = {},
+                        std::optional<llvm::TargetLibraryInfoImpl::VectorLibrary> vectorLibrary = std::nullopt);
 }
 
 #endif
@@ -0,0 +1,401 @@
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <utility>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        // the pool and index of the worker running on this thread
+        thread_local ThreadPool const *currentPool = nullptr;
+        thread_local std::size_t currentWorker = 0;
+
+        // the output buffer of the parfor chunk running on this thread
+        thread_local std::string *chunkOutput = nullptr;
+
+        struct PoolRegistry
+        {
+            std::mutex mutex;
+            ParallelOptions options;
+            std::unique_ptr<ThreadPool> pool;
+        };
+
+        PoolRegistry &registry()
+        {
+            static PoolRegistry instance;
+            return instance;
+        }
+
+        unsigned threadCount(ParallelOptions const &options)
+        {
+            return options.threads != 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // Iterations per block of an ordered reduction. Blocks of unordered
+        // ones are not smaller, so that their loops amortise the call.
+        constexpr std::int64_t reductionBlockSize = 4096;
+
+        struct ParallelReduction
+        {
+            ReductionBody body;
+            void *context;
+            std::int64_t count;
+            std::int64_t blockSize;
+            std::vector<double> partials;
+
+            static void reduceBlocks(void *reduction, std::int64_t begin, std::int64_t end)
+            {
+                auto &self = *static_cast<ParallelReduction *>(reduction);
+
+                for (auto block = begin; block < end; ++block)
+                {
+                    auto first = block * self.blockSize;
+                    self.partials[block] = self.body(self.context, first, std::min(first + self.blockSize, self.count));
+                }
+            }
+        };
+
+        /// ParallelLoop - the state shared by the threads running one parfor loop.
+        /// Participant p runs share p of the iterations, see participate().
+        struct ParallelLoop
+        {
+            ParallelLoop(ParallelBody body, void *context, std::int64_t count, std::int64_t chunk, ParallelSchedule schedule, std::size_t participants)
+                : body(body), context(context), count(count), chunk(chunk), schedule(schedule), participants(participants)
+            {
+            }
+
+            void participate(std::size_t p)
+            {
+                switch (schedule)
+                {
+                case ParallelSchedule::Static:
+                    for (auto begin = static_cast<std::int64_t>(p) * chunk; begin < count; begin += static_cast<std::int64_t>(participants) * chunk)
+                    {
+                        runChunk(begin, std::min(begin + chunk, count));
+                    }
+                    break;
+                case ParallelSchedule::Dynamic:
+                    for (auto begin = next.fetch_add(chunk); begin < count; begin = next.fetch_add(chunk))
+                    {
+                        runChunk(begin, std::min(begin + chunk, count));
+                    }
+                    break;
+                case ParallelSchedule::Guided:
+                    for (auto begin = next.load(); begin < count;)
+                    {
+                        auto size = std::max(chunk, (count - begin) / static_cast<std::int64_t>(2 * participants));
+                        auto end = std::min(begin + size, count);
+
+                        // on failure begin is reloaded
+                        if (next.compare_exchange_weak(begin, end))
+                        {
+                            runChunk(begin, end);
+                            begin = next.load();
+                        }
+                    }
+                    break;
+                }
+            }
+
+            void runChunk(std::int64_t begin, std::int64_t end)
+            {
+                std::string output;
+                auto enclosingOutput = std::exchange(chunkOutput, &output);
+
+                body(context, begin, end);
+
+                chunkOutput = enclosingOutput;
+
+                if (!output.empty())
+                {
+                    std::lock_guard lock(outputMutex);
+                    outputs.emplace_back(begin, std::move(output));
+                }
+            }
+
+            ParallelBody body;
+            void *context;
+            std::int64_t count;
+            std::int64_t chunk;
+            ParallelSchedule schedule;
+            std::size_t participants;
+
+            /// first iteration not taken yet, for Dynamic and Guided
+            std::atomic<std::int64_t> next = 0;
+            /// participants run by the pool that have not finished
+            std::atomic<std::size_t> running = 0;
+
+            std::mutex outputMutex;
+            /// output of the chunks by first iteration
+            std::vector<std::pair<std::int64_t, std::string>> outputs;
+        };
+    }
+
+    ThreadPool::ThreadPool(unsigned workers)
+    {
+        for (unsigned i = 0; i < workers; ++i)
+        {
+            queues_.push_back(std::make_unique<Queue>());
+        }
+
+        for (unsigned i = 0; i < workers; ++i)
+        {
+            threads_.emplace_back([this, i]()
+                                  { work(i); });
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard lock(idleMutex_);
+            stopping_ = true;
+        }
+
+        wakeUp_.notify_all();
+
+        for (auto &thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    void ThreadPool::submit(std::size_t worker, Task task)
+    {
+        {
+            std::lock_guard lock(queues_[worker]->mutex);
+            queues_[worker]->tasks.push_back(std::move(task));
+        }
+
+        // counted under the lock the idle workers wait with, so none misses the task
+        {
+            std::lock_guard lock(idleMutex_);
+            ++queued_;
+        }
+
+        wakeUp_.notify_one();
+    }
+
+    bool ThreadPool::tryPop(std::size_t index, bool newest, Task &task)
+    {
+        {
+            std::lock_guard lock(queues_[index]->mutex);
+            auto &tasks = queues_[index]->tasks;
+
+            if (tasks.empty())
+            {
+                return false;
+            }
+
+            if (newest)
+            {
+                task = std::move(tasks.back());
+                tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+        }
+
+        std::lock_guard lock(idleMutex_);
+        --queued_;
+
+        return true;
+    }
+
+    bool ThreadPool::runQueuedTask()
+    {
+        Task task;
+        bool isWorker = currentPool == this;
+
+        bool found = isWorker && tryPop(currentWorker, true, task);
+
+        // steal, starting with the next worker so that thieves spread out
+        for (std::size_t i = 0; !found && i < queues_.size(); ++i)
+        {
+            found = tryPop((isWorker ? currentWorker + 1 + i : i) % queues_.size(), false, task);
+        }
+
+        if (found)
+        {
+            task();
+        }
+
+        return found;
+    }
+
+    void ThreadPool::work(std::size_t index)
+    {
+        currentPool = this;
+        currentWorker = index;
+
+        while (true)
+        {
+            if (runQueuedTask())
+            {
+                continue;
+            }
+
+            std::unique_lock lock(idleMutex_);
+            wakeUp_.wait(lock, [this]()
+                         { return stopping_ || queued_ > 0; });
+
+            if (stopping_ && queued_ == 0)
+            {
+                return;
+            }
+        }
+    }
+
+    void setParallelOptions(ParallelOptions const &options)
+    {
+        auto &poolRegistry = registry();
+        std::lock_guard lock(poolRegistry.mutex);
+
+        // the pool is created again on demand with the new number of threads
+        if (poolRegistry.pool && poolRegistry.pool->size() + 1 != threadCount(options))
+        {
+            poolRegistry.pool.reset();
+        }
+
+        poolRegistry.options = options;
+    }
+
+    ParallelOptions getParallelOptions()
+    {
+        auto &poolRegistry = registry();
+        std::lock_guard lock(poolRegistry.mutex);
+
+        return poolRegistry.options;
+    }
+
+    void parallelFor(std::int64_t count, ParallelBody body, void *context)
+    {
+        if (count <= 0)
+        {
+            return;
+        }
+
+        ParallelOptions options;
+        ThreadPool *pool = nullptr;
+
+        {
+            auto &poolRegistry = registry();
+            std::lock_guard lock(poolRegistry.mutex);
+
+            options = poolRegistry.options;
+            auto threads = threadCount(options);
+
+            if (!poolRegistry.pool && threads > 1)
+            {
+                poolRegistry.pool = std::make_unique<ThreadPool>(threads - 1);
+            }
+
+            pool = poolRegistry.pool.get();
+        }
+
+        // the calling thread is participant 0
+        auto participants = static_cast<std::int64_t>(pool != nullptr ? pool->size() + 1 : 1);
+        participants = std::min(participants, count);
+
+        auto chunk = options.chunkSize;
+        if (chunk <= 0)
+        {
+            switch (options.schedule)
+            {
+            case ParallelSchedule::Static:
+                chunk = (count + participants - 1) / participants;
+                break;
+            case ParallelSchedule::Dynamic:
+                chunk = std::max<std::int64_t>(1, count / (participants * 8));
+                break;
+            case ParallelSchedule::Guided:
+                chunk = 1;
+                break;
+            }
+        }
+
+        if (participants == 1)
+        {
+            body(context, 0, count);
+            return;
+        }
+
+        ParallelLoop loop(body, context, count, chunk, options.schedule, static_cast<std::size_t>(participants));
+        loop.running = loop.participants - 1;
+
+        for (std::size_t p = 1; p < loop.participants; ++p)
+        {
+            pool->submit(p - 1, [&loop, p]()
+                         {
+                             loop.participate(p);
+                             loop.running.fetch_sub(1, std::memory_order_release); });
+        }
+
+        loop.participate(0);
+
+        while (loop.running.load(std::memory_order_acquire) > 0)
+        {
+            if (!pool->runQueuedTask())
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        std::sort(loop.outputs.begin(), loop.outputs.end());
+
+        for (auto const &output : loop.outputs)
+        {
+            writeOutput(output.second);
+        }
+    }
+
+    double parallelReduce(std::int64_t count, ReductionBody body, void *context, double identity, ReductionCombine combine, bool ordered)
+    {
+        if (count <= 0)
+        {
+            return identity;
+        }
+
+        auto blockSize = reductionBlockSize;
+
+        if (!ordered)
+        {
+            // about as many blocks as parallelFor makes chunks by default
+            auto blocksPerThread = static_cast<std::int64_t>(8 * threadCount(getParallelOptions()));
+            blockSize = std::max(blockSize, (count + blocksPerThread - 1) / blocksPerThread);
+        }
+
+        auto blocks = (count + blockSize - 1) / blockSize;
+        ParallelReduction reduction{body, context, count, blockSize, std::vector<double>(static_cast<std::size_t>(blocks))};
+
+        parallelFor(blocks, &ParallelReduction::reduceBlocks, &reduction);
+
+        auto result = reduction.partials.front();
+        for (auto partial = std::next(reduction.partials.begin()); partial != reduction.partials.end(); ++partial)
+        {
+            result = combine(result, *partial);
+        }
+
+        return result;
+    }
+
+    void writeOutput(std::string_view text)
+    {
+        if (chunkOutput != nullptr)
+        {
+            chunkOutput->append(text);
+        }
+        else
+        {
+            std::cerr << text << std::flush;
+        }
+    }
+}
@@ -0,0 +1,105 @@
+#ifndef INCLUDED_KALEIDOSCOPE_PARALLEL_HPP
+#define INCLUDED_KALEIDOSCOPE_PARALLEL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// How the iterations of a parfor loop are divided into chunks.
+    enum class ParallelSchedule : std::uint32_t
+    {
+        /// each thread gets every n-th chunk, decided up front
+        Static,
+        /// threads take the next chunk of a fixed size when they are done
+        Dynamic,
+        /// like Dynamic, with chunks shrinking as fewer iterations remain
+        Guided
+    };
+
+    struct ParallelOptions
+    {
+        /// threads running iterations, including the one starting the loop; 0 for one per hardware thread
+        unsigned threads = 0;
+        /// iterations per chunk, the smallest one for Guided; 0 picks one from the loop size
+        std::int64_t chunkSize = 0;
+        ParallelSchedule schedule = ParallelSchedule::Dynamic;
+    };
+
+    /// ThreadPool - worker threads with a deque of tasks each. A worker takes
+    /// its newest task first and steals the oldest task of another worker
+    /// when its own deque is empty. Threads waiting for their tasks to finish
+    /// run queued tasks meanwhile, so tasks can wait for tasks they queued.
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+
+        explicit ThreadPool(unsigned workers);
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool &operator=(ThreadPool const &) = delete;
+
+        std::size_t size() const noexcept { return queues_.size(); }
+
+        void submit(std::size_t worker, Task task);
+        /// runs one queued task, if there is one
+        bool runQueuedTask();
+
+    private:
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void work(std::size_t index);
+        bool tryPop(std::size_t index, bool newest, Task &task);
+
+        std::vector<std::unique_ptr<Queue>> queues_;
+        std::vector<std::thread> threads_;
+
+        std::mutex idleMutex_;
+        std::condition_variable wakeUp_;
+        std::size_t queued_ = 0;
+        bool stopping_ = false;
+    };
+
+    /// applies to the parfor loops started afterwards; not to be called while one runs
+    void setParallelOptions(ParallelOptions const &options);
+    ParallelOptions getParallelOptions();
+
+    /// runs the iterations [begin, end) of a loop
+    using ParallelBody = void (*)(void *context, std::int64_t begin, std::int64_t end);
+
+    /// Runs iterations [0, count) of body in chunks on the thread pool and
+    /// returns when all are done. Output of the iterations (see writeOutput)
+    /// is buffered per chunk and written in iteration order afterwards, so it
+    /// is the same as that of a sequential loop.
+    void parallelFor(std::int64_t count, ParallelBody body, void *context);
+
+    /// returns the partial result of a reduction over the iterations [begin, end)
+    using ReductionBody = double (*)(void *context, std::int64_t begin, std::int64_t end);
+    using ReductionCombine = double (*)(double lhs, double rhs);
+
+    /// Divides iterations [0, count) into blocks, reduces them with body on
+    /// the thread pool and combines the partial results of the blocks in
+    /// order. The blocks depend on the number of threads, unless ordered is
+    /// set: then they have a fixed size and the result is reproducible.
+    double parallelReduce(std::int64_t count, ReductionBody body, void *context, double identity, ReductionCombine combine, bool ordered);
+
+    /// writes the output of putchard and printd: to std::cerr, or to the
+    /// buffer of the parfor chunk the thread is running
+    void writeOutput(std::string_view text);
+}
+
+#endif
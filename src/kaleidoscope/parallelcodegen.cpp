@@ -0,0 +1,190 @@
+#include "parallelcodegen.hpp"
+
+#include "simplifier.hpp"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        /// runs work(worker) for workers [0, threadCount), worker 0 on the
+        /// calling thread, and rethrows the first exception of any
+        template <typename Work>
+        void runWorkers(unsigned threadCount, Work const &work)
+        {
+            std::mutex failureMutex;
+            std::exception_ptr failure;
+
+            auto run = [&](unsigned worker)
+            {
+                try
+                {
+                    work(worker);
+                }
+                catch (...)
+                {
+                    std::lock_guard lock(failureMutex);
+
+                    if (!failure)
+                    {
+                        failure = std::current_exception();
+                    }
+                }
+            };
+
+            {
+                std::vector<std::jthread> threads;
+
+                for (unsigned i = 1; i < threadCount; ++i)
+                {
+                    threads.emplace_back(run, i);
+                }
+
+                run(0);
+            }
+
+            if (failure)
+            {
+                std::rethrow_exception(failure);
+            }
+        }
+
+        bool isFunction(ParsedItem const &item)
+        {
+            return item.kind == ParsedItem::Definition || item.kind == ParsedItem::TopLevelExpression;
+        }
+    }
+
+    std::vector<std::string> generateParallel(CodeGenerator &codegen, std::vector<ParsedItem> const &items, unsigned threadCount)
+    {
+        threadCount = std::max(threadCount, 1u);
+
+        std::vector<std::optional<FunctionAST>> simplified(items.size());
+        std::atomic<std::size_t> nextItem{0};
+
+        runWorkers(std::min<std::size_t>(threadCount, items.size()), [&](unsigned)
+                   {
+                       for (std::size_t i; (i = nextItem.fetch_add(1)) < items.size();)
+                       {
+                           if (isFunction(items[i]))
+                           {
+                               simplified[i] = simplify(std::get<FunctionAST>(items[i].ast), codegen.precision_);
+                           }
+                       } });
+
+        // the snapshot, the items of each function name in source order and
+        // the item first declaring each name new to codegen
+        std::vector<std::vector<std::size_t>> groups;
+        std::unordered_map<std::uint32_t, std::size_t> groupOfName;
+        std::vector<std::size_t> declaredAt;
+
+        auto declare = [&](Symbol name, std::size_t item)
+        {
+            if (codegen.getPrototype(name) == nullptr)
+            {
+                declaredAt.resize(std::max<std::size_t>(declaredAt.size(), name.id() + 1), 0);
+                declaredAt[name.id()] = item;
+            }
+        };
+
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+            if (items[i].kind == ParsedItem::Extern)
+            {
+                declare(std::get<PrototypeAST>(items[i].ast).getName(), i);
+                codegen.registerExtern(std::get<PrototypeAST>(items[i].ast));
+            }
+            else if (isFunction(items[i]))
+            {
+                auto const &proto = std::get<FunctionAST>(items[i].ast).getProto();
+                declare(proto.getName(), i);
+
+                codegen.effects_.addDefinition(*simplified[i]);
+                codegen.registerDefinition(proto);
+
+                auto [group, added] = groupOfName.try_emplace(proto.getName().id(), groups.size());
+                if (added)
+                {
+                    groups.emplace_back();
+                }
+
+                groups[group->second].push_back(i);
+            }
+        }
+
+        auto workerCount = static_cast<unsigned>(std::min<std::size_t>(threadCount, groups.size()));
+        auto moduleName = codegen.TheModule->getName().str();
+
+        std::vector<std::string> errors(items.size());
+        std::vector<std::string> bitcode(workerCount);
+        std::atomic<std::size_t> nextGroup{0};
+
+        runWorkers(workerCount, [&](unsigned worker)
+                   {
+                       CodeGenerator generator(codegen, moduleName + "." + std::to_string(worker));
+                       generator.declaredAt_ = declaredAt;
+
+                       for (std::size_t group; (group = nextGroup.fetch_add(1)) < groups.size();)
+                       {
+                           for (auto i : groups[group])
+                           {
+                               try
+                               {
+                                   generator.currentItem_ = i;
+                                   generator.generateDefinition(std::get<FunctionAST>(items[i].ast), *simplified[i]);
+                               }
+                               catch (CodeGenerationError const &e)
+                               {
+                                   errors[i] = e.what();
+                               }
+                           }
+                       }
+
+                       auto module = generator.finalizeModule();
+                       llvm::raw_string_ostream out(bitcode[worker]);
+                       llvm::WriteBitcodeToFile(*module.getModuleUnlocked(), out);
+                       out.flush(); });
+
+        // as after an error in operator()(FunctionAST)
+        for (std::size_t i = 0; i < items.size(); ++i)
+        {
+            if (!errors[i].empty())
+            {
+                codegen.effects_.removeDefinition(std::get<FunctionAST>(items[i].ast).getProto().getName());
+            }
+        }
+
+        auto lock = codegen.context_.getLock();
+
+        for (auto const &workerBitcode : bitcode)
+        {
+            auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(workerBitcode, moduleName), *codegen.TheContext);
+
+            if (!module)
+            {
+                throw CodeGenerationError(llvm::toString(module.takeError()));
+            }
+
+            if (llvm::Linker::linkModules(*codegen.TheModule, std::move(*module)))
+            {
+                throw CodeGenerationError("cannot link the modules of the code generation workers");
+            }
+        }
+
+        return errors;
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef INCLUDED_KALEIDOSCOPE_PARALLELCODEGEN_HPP
+#define INCLUDED_KALEIDOSCOPE_PARALLELCODEGEN_HPP
+
+#include "codegen.hpp"
+#include "parallelparser.hpp"
+
+#include <string>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// Generates the IR of items, as returned by parseParallel(), on
+    /// threadCount workers and links it into the module codegen is
+    /// generating. Returns the code generation error of each item, empty
+    /// where there is none.
+    ///
+    /// The definitions are simplified in parallel. Their effects and
+    /// prototypes, and the externs, are then registered with codegen in
+    /// source order. Each worker starts from a copy of that snapshot and
+    /// generates into a context and module of its own; the items of one
+    /// function name go to the same worker in source order, so a
+    /// redefinition is handled as in a single module. The worker modules
+    /// are linked through bitcode, since modules of different contexts
+    /// cannot be linked directly. As in the sequential frontends, an item
+    /// cannot call a function declared only after it.
+    std::vector<std::string> generateParallel(CodeGenerator &codegen, std::vector<ParsedItem> const &items, unsigned threadCount);
+} // namespace kaleidoscope
+
+#endif
@@ -0,0 +1,272 @@
+#include "parallelparser.hpp"
+
+#include "charscan.hpp"
+#include "keywords.hpp"
+#include "lexer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        /// Slice - a run of complete top-level items, parsed by one worker.
+        struct Slice
+        {
+            std::string_view text;
+            SourceLocation start;
+            /// precedences declared by the items in front of the slice
+            std::shared_ptr<OperatorPrecedence const> precedence;
+        };
+
+        /// Parses the prototype of a binary operator definition with the real
+        /// parser and adds the operator to the precedence table.
+        std::shared_ptr<OperatorPrecedence const> declareOperator(Slice const &slice)
+        {
+            Lexer lexer(slice.text, slice.start);
+            Parser parser(lexer);
+            parser.setOperatorPrecedence(*slice.precedence);
+
+            parser.getNextToken();
+
+            try
+            {
+                parser.registerOperator(parser.ParseDefinitionPrototype());
+            }
+            catch (ParseError const &)
+            {
+                // reported by the worker parsing the slice
+                return slice.precedence;
+            }
+
+            return std::make_shared<OperatorPrecedence const>(parser.getOperatorPrecedence());
+        }
+
+        /// Splits text into slices without building tokens: only keywords are
+        /// looked up, identifiers are not interned and numbers are not converted.
+        std::vector<Slice> prescan(std::string_view text)
+        {
+            std::vector<Slice> slices;
+
+            char const *pos = text.data();
+            char const *end = pos + text.size();
+
+            Slice current{std::string_view(pos, 0), SourceLocation(), std::make_shared<OperatorPrecedence const>(Parser::defaultOperatorPrecedence())};
+            bool afterDef = false;
+            // after 'memo' or 'fastmath', or inside the flags of 'fastmath(...)'
+            bool afterAnnotation = false;
+            bool afterFastMath = false;
+            bool inFastMathFlags = false;
+            bool definesOperator = false;
+
+            auto split = [&](char const *at)
+            {
+                if (at == current.text.data())
+                {
+                    return;
+                }
+
+                current.text = std::string_view(current.text.data(), at - current.text.data());
+                slices.push_back(current);
+
+                if (definesOperator)
+                {
+                    current.precedence = declareOperator(current);
+                    definesOperator = false;
+                }
+
+                current.start.advance(current.text);
+                current.text = std::string_view(at, 0);
+            };
+
+            while (pos != end)
+            {
+                unsigned char c = static_cast<unsigned char>(*pos);
+
+                if (std::isspace(c))
+                {
+                    pos = skipWhitespace(pos, end);
+                }
+                else if (c == '#')
+                {
+                    auto newline = static_cast<char const *>(std::memchr(pos, '\n', end - pos));
+                    pos = newline != nullptr ? newline + 1 : end;
+                }
+                else if (std::isalpha(c))
+                {
+                    char const *wordEnd = skipAlnum(pos + 1, end);
+                    auto keyword = lookupKeyword(std::string_view(pos, wordEnd - pos));
+
+                    // 'memo fastmath(nnan) def' starts one item
+                    bool startsDefinition = keyword == tok_def || keyword == tok_memo || keyword == tok_fastmath;
+                    if ((startsDefinition && !afterAnnotation) || keyword == tok_extern)
+                    {
+                        split(pos);
+                    }
+
+                    definesOperator = definesOperator || (afterDef && keyword == tok_binary);
+                    // 'def float32 binary' defines an operator too
+                    afterDef = keyword == tok_def || (afterDef && (keyword == tok_float32 || keyword == tok_float64));
+                    afterAnnotation = inFastMathFlags || keyword == tok_memo || keyword == tok_fastmath;
+                    afterFastMath = keyword == tok_fastmath;
+                    pos = wordEnd;
+                }
+                else if (std::isdigit(c) || c == '.')
+                {
+                    pos = skipNumberChars(pos + 1, end);
+                    afterDef = false;
+                    afterAnnotation = false;
+                    afterFastMath = false;
+                    inFastMathFlags = false;
+                }
+                else if (c == '(' && afterFastMath)
+                {
+                    ++pos;
+                    afterFastMath = false;
+                    inFastMathFlags = true;
+                }
+                else if (c == ')' && inFastMathFlags)
+                {
+                    ++pos;
+                    inFastMathFlags = false;
+                }
+                else
+                {
+                    ++pos;
+                    afterDef = false;
+                    afterAnnotation = false;
+                    afterFastMath = false;
+                    inFastMathFlags = false;
+
+                    if (c == ';')
+                    {
+                        split(pos);
+                    }
+                }
+            }
+
+            split(end);
+
+            return slices;
+        }
+
+        /// top ::= definition | external | expression | ';'
+        std::vector<ParsedItem> parseSlice(Slice const &slice, std::string const &topLevelSymbolName)
+        {
+            std::vector<ParsedItem> items;
+
+            Lexer lexer(slice.text, slice.start);
+            Parser parser(lexer, topLevelSymbolName);
+            parser.setOperatorPrecedence(*slice.precedence);
+            parser.getNextToken();
+
+            while (true)
+            {
+                try
+                {
+                    switch (parser.getCurrentToken().getType())
+                    {
+                    case tok_eof:
+                        return items;
+                    case tok_memo:
+                    case tok_fastmath:
+                    case tok_def:
+                    {
+                        auto ast = parser.ParseDefinition();
+                        // items after the body that are not split off, e.g. "def f(x) x 4"
+                        parser.registerOperator(ast.getProto());
+                        items.push_back({ParsedItem::Definition, std::move(ast)});
+                        break;
+                    }
+                    case tok_extern:
+                        items.push_back({ParsedItem::Extern, parser.ParseExtern()});
+                        break;
+                    case tok_char: // ignore top-level semicolons.
+                        if (parser.getCurrentToken().getCharValue() == ';')
+                        {
+                            parser.getNextToken();
+                            break;
+                        }
+                        // Fall-through
+                    default:
+                        items.push_back({ParsedItem::TopLevelExpression, parser.ParseTopLevelExpr()});
+                        break;
+                    }
+                }
+                catch (ParseError const &e)
+                {
+                    items.push_back({ParsedItem::Error, std::string(e.what())});
+                    // Skip token for error recovery.
+                    parser.getNextToken();
+                }
+            }
+        }
+    }
+
+    std::vector<ParsedItem> parseParallel(std::string_view text,
+                                          unsigned threadCount,
+                                          std::string const &topLevelSymbolName)
+    {
+        auto slices = prescan(text);
+
+        std::vector<std::vector<ParsedItem>> sliceItems(slices.size());
+        std::atomic<std::size_t> nextSlice{0};
+
+        std::mutex failureMutex;
+        std::exception_ptr failure;
+
+        auto work = [&]
+        {
+            for (std::size_t i; (i = nextSlice.fetch_add(1)) < slices.size();)
+            {
+                try
+                {
+                    sliceItems[i] = parseSlice(slices[i], topLevelSymbolName);
+                }
+                catch (...)
+                {
+                    std::lock_guard lock(failureMutex);
+
+                    if (!failure)
+                    {
+                        failure = std::current_exception();
+                    }
+                }
+            }
+        };
+
+        {
+            std::vector<std::jthread> workers;
+
+            for (unsigned i = 1; i < std::min<std::size_t>(threadCount, slices.size()); ++i)
+            {
+                workers.emplace_back(work);
+            }
+
+            work();
+        }
+
+        if (failure)
+        {
+            std::rethrow_exception(failure);
+        }
+
+        std::vector<ParsedItem> items;
+
+        for (auto &slice : sliceItems)
+        {
+            std::move(slice.begin(), slice.end(), std::back_inserter(items));
+        }
+
+        return items;
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef INCLUDED_KALEIDOSCOPE_PARALLELPARSER_HPP
+#define INCLUDED_KALEIDOSCOPE_PARALLELPARSER_HPP
+
+#include "ast.hpp"
+#include "parser.hpp"
+
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// ParsedItem - one top-level item of a file, or the parse error reported
+    /// at that point.
+    struct ParsedItem
+    {
+        enum Kind
+        {
+            Definition,
+            Extern,
+            TopLevelExpression,
+            Error
+        };
+
+        Kind kind;
+        /// FunctionAST for definitions and top-level expressions, PrototypeAST
+        /// for externs, the error message for errors
+        std::variant<FunctionAST, PrototypeAST, std::string> ast;
+    };
+
+    /// Parses all top-level items of text on threadCount worker threads and
+    /// returns them in source order.
+    ///
+    /// A sequential prescan splits the text in front of every 'def' and 'extern'
+    /// and after every top-level ';' and parses the prototypes of binary operator
+    /// definitions, so each slice is parsed with the operator precedences
+    /// declared before it. As in the code generating frontends, an operator is
+    /// usable from the item following its definition. Error recovery skips a
+    /// single token, like the interactive loop, but never past a slice boundary.
+    std::vector<ParsedItem> parseParallel(std::string_view text,
+                                          unsigned threadCount,
+                                          std::string const &topLevelSymbolName = "__anon_expr");
+} // namespace kaleidoscope
+
+#endif
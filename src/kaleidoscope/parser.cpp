@@ -1,8 +1,16 @@
 #include "parser.hpp"
 
+#include <bit>
+#include <cmath>
 #include <iostream>
+#include <optional>
 #include <sstream>
 #include <cctype>
+#include <span>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace kaleidoscope
 {
@@ -14,11 +22,18 @@ namespace kaleidoscope
     Parser::Parser(Lexer &lexer, std::string const &topLevelSymbolName)
         : lexer_(lexer),
           topLevelSymbolName_(topLevelSymbolName),
-          binOpPrecedence{
-              {'=', 2}, {'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}, {'/', 40}}
+          binOpPrecedence(defaultOperatorPrecedence())
     {
     }
 
+    OperatorPrecedence const &Parser::defaultOperatorPrecedence()
+    {
+        static OperatorPrecedence const builtins{
+            {'=', 2}, {op_or, 5}, {op_and, 6}, {'<', 10}, {'+', 20}, {'-', 20}, {'*', 40}, {'/', 40}};
+
+        return builtins;
+    }
+
     int Parser::GetTokPrecedence() const
     {
         if (CurTok.getType() == tok_char)
@@ -60,14 +75,14 @@ namespace kaleidoscope
         }
     }
 
-    std::string Parser::expectIdentifier(std::string const &errMsg)
+    Symbol Parser::expectIdentifier(std::string const &errMsg)
     {
         if (CurTok.getType() != tok_identifier)
         {
             throw ParseError(errMsg);
         }
 
-        std::string result = CurTok.getIdentifierValue();
+        Symbol result = CurTok.getIdentifierValue();
         getNextToken();
 
         return result;
@@ -102,217 +117,556 @@ namespace kaleidoscope
         }
     }
 
-    NumberExprAST Parser::ParseNumberExpr()
+    namespace
     {
-        NumberExprAST Result(lexer_.getLocation(), CurTok.getNumValue());
-        getNextToken(); // consume the number
-        return Result;
-    }
+        // What the expression currently being parsed belongs to, i.e. what to do
+        // with it once it is complete.
+        enum class ExprContext
+        {
+            TopLevel,
+            Paren,
+            CallArgument,
+            Index,
+            IfCondition,
+            IfThen,
+            IfElse,
+            ForStart,
+            ForEnd,
+            ForStep,
+            ForBody,
+            VarInit,
+            VarBody
+        };
+
+        struct ParseFrame
+        {
+            ParseFrame(ExprContext context, SourceLocation const &loc, std::size_t operatorBase)
+                : context(context), loc(loc), operatorBase(operatorBase)
+            {
+            }
 
-    ExprAST Parser::ParseParenExpr()
-    {
-        getNextToken(); // eat (.
-        auto V = ParseExpression();
+            ExprContext context;
+            SourceLocation loc;
+            // operators below this index belong to enclosing expressions
+            std::size_t operatorBase;
+            // call arguments / var declarations collected so far start here
+            std::size_t listBase = 0;
+            // callee, loop variable or the variable whose initialiser is being parsed
+            Symbol name;
+            SourceLocation nameLoc;
+            // Index: first is the array
+            ExprRef first, second, third;
+            LoopHints hints;
+            // For*: the loop is a parfor, or a reduction if one is set
+            bool parallel = false;
+            std::optional<ReductionKind> reduction;
+        };
+
+        // sum, product, min and max only start a reduction when the loop
+        // variable follows them, so they remain available as names
+        std::optional<ReductionKind> getReductionKind(Symbol name)
+        {
+            static constexpr std::pair<std::string_view, ReductionKind> reductions[] = {
+                {"sum", ReductionKind::Sum}, {"product", ReductionKind::Product}, {"min", ReductionKind::Min}, {"max", ReductionKind::Max}};
+
+            for (auto const &[keyword, kind] : reductions)
+            {
+                if (name.str() == keyword)
+                {
+                    return kind;
+                }
+            }
 
-        expectChar(')', "expected ')'");
+            return std::nullopt;
+        }
 
-        return V;
+        struct PendingOperator
+        {
+            char op;
+            int precedence;
+            SourceLocation loc;
+            bool unary;
+        };
     }
 
-    ExprAST Parser::ParseIdentifierExpr()
+    // Operator precedence parsing with explicit stacks instead of recursion, so
+    // that neither long operator chains nor deep nesting of parentheses, calls,
+    // if/for/var or unary operators grow the native stack. Constructs with
+    // sub-expressions push a ParseFrame and continue when the sub-expression ends.
+    ExprRef Parser::ParseExpression()
     {
-        SourceLocation loc = lexer_.getLocation();
-        std::string IdName = CurTok.getIdentifierValue();
+        std::vector<ParseFrame> frames;
+        std::vector<PendingOperator> operators;
+        std::vector<ExprRef> operands;
+        std::vector<ExprRef> args;
+        std::vector<VariableDeclarationAST> declarations;
 
-        getNextToken(); // eat identifier.
-
-        if (!tryConsumeChar('(')) // Simple variable ref.
+        auto openFrame = [&](ExprContext context, SourceLocation const &loc) -> ParseFrame &
         {
-            return VariableExprAST(loc, IdName);
-        }
+            return frames.emplace_back(context, loc, operators.size());
+        };
 
-        // Call.
-        std::vector<ExprAST> Args;
-        if (CurTok != ')')
+        auto reduce = [&]()
         {
-            while (true)
-            {
-                Args.push_back(ParseExpression());
+            auto op = operators.back();
+            operators.pop_back();
 
-                if (CurTok == ')')
-                    break;
+            auto rhs = operands.back();
+            operands.pop_back();
 
-                expectChar(',', "Expected ')' or ',' in argument list");
+            if (op.unary)
+            {
+                operands.push_back(arena_.add(UnaryExprAST(op.loc, op.op, rhs)));
             }
-        }
+            else
+            {
+                operands.back() = arena_.add(BinaryExprAST(op.loc, op.op, operands.back(), rhs));
+            }
+        };
 
-        // Eat the ')'.
-        getNextToken();
+        // a complete operand binds to the unary operators directly in front of it
+        auto pushOperand = [&](ExprRef operand)
+        {
+            operands.push_back(operand);
 
-        return CallExprAST(loc, IdName, std::move(Args));
-    }
+            while (operators.size() > frames.back().operatorBase && operators.back().unary)
+            {
+                reduce();
+            }
+        };
 
-    ExprAST Parser::ParsePrimary()
-    {
-        switch (CurTok.getType())
+        // var a = 1, b, c = 2 in ...: declarations without initialiser are finished
+        // right here, for the others the frame waits for the initialiser expression.
+        auto parseVarDeclarations = [&](ParseFrame &frame)
         {
-        case tok_identifier:
-            return ParseIdentifierExpr();
-        case tok_number:
-            return ParseNumberExpr();
-        case tok_if:
-            return ParseIfExpr();
-        case tok_for:
-            return ParseForExpr();
-        case tok_var:
-            return ParseVarExpr();
-        default:
-            if (CurTok == '(')
+            do
             {
-                return ParseParenExpr();
-            }
-            break;
-        }
+                SourceLocation identLoc = lexer_.getLocation();
+                Symbol name = expectIdentifier("Expected identifier list after 'var'");
 
-        throw ParseError("unknown token when expecting an expression");
-    }
+                if (tryConsumeChar('='))
+                {
+                    frame.name = name;
+                    frame.nameLoc = identLoc;
+                    frame.context = ExprContext::VarInit;
+                    return;
+                }
 
-    ExprAST Parser::ParseExpression()
-    {
-        auto LHS = ParseUnary();
+                declarations.emplace_back(identLoc, name, arena_.add(NumberExprAST(lexer_.getLocation(), 0.0)));
+            } while (tryConsumeChar(','));
 
-        return ParseBinOpRHS(0, std::move(LHS));
-    }
+            expectKeyword(tok_in, "expected 'in' keyword after 'var'");
+            frame.context = ExprContext::VarBody;
+        };
 
-    ExprAST Parser::ParseUnary()
-    {
-        SourceLocation loc = lexer_.getLocation();
+        openFrame(ExprContext::TopLevel, lexer_.getLocation());
+        bool expectOperand = true;
 
-        if (CurTok == '(' ||
-            CurTok == ',' ||
-            CurTok.getType() != tok_char)
+        while (true)
         {
-            return ParsePrimary();
-        }
+            if (expectOperand)
+            {
+                while (CurTok.getType() == tok_char && CurTok != '(' && CurTok != ',')
+                {
+                    SourceLocation loc = lexer_.getLocation();
+                    char op = expectAscii("invalid unary operator %1%");
+                    operators.push_back({op, 0, loc, true});
+                }
+
+                SourceLocation loc = lexer_.getLocation();
+                // stays invalid if a construct with sub-expressions was opened instead
+                ExprRef operand;
+
+                switch (CurTok.getType())
+                {
+                case tok_identifier:
+                {
+                    Symbol name = CurTok.getIdentifierValue();
+                    getNextToken(); // eat identifier.
+
+                    auto reduction = getReductionKind(name);
+
+                    if (reduction && CurTok.getType() == tok_identifier)
+                    {
+                        Symbol varName = CurTok.getIdentifierValue();
+                        getNextToken();
+                        expectChar('=', "expected = after " + std::string(name.str()) + " " + std::string(varName.str()));
+
+                        auto &frame = openFrame(ExprContext::ForStart, loc);
+                        frame.name = varName;
+                        frame.reduction = reduction;
+                    }
+                    else if (tryConsumeChar('['))
+                    {
+                        openFrame(ExprContext::Index, loc).first = arena_.add(VariableExprAST(loc, name));
+                    }
+                    else if (!tryConsumeChar('(')) // Simple variable ref.
+                    {
+                        operand = arena_.add(VariableExprAST(loc, name));
+                    }
+                    else if (tryConsumeChar(')'))
+                    {
+                        operand = arena_.add(CallExprAST(loc, name, ASTRange{}));
+                    }
+                    else
+                    {
+                        auto &frame = openFrame(ExprContext::CallArgument, loc);
+                        frame.name = name;
+                        frame.listBase = args.size();
+                    }
+                    break;
+                }
+                case tok_number:
+                    operand = arena_.add(NumberExprAST(loc, CurTok.getNumValue()));
+                    getNextToken(); // consume the number
+                    break;
+                case tok_if:
+                    getNextToken();
+                    openFrame(ExprContext::IfCondition, loc);
+                    break;
+                case tok_for:
+                case tok_parfor:
+                {
+                    bool parallel = CurTok.getType() == tok_parfor;
+                    getNextToken(); // consume for
+
+                    Symbol varName = expectIdentifier("expected identifier after for");
+                    expectChar('=', "expected = after for");
+
+                    auto &frame = openFrame(ExprContext::ForStart, loc);
+                    frame.name = varName;
+                    frame.parallel = parallel;
+                    break;
+                }
+                case tok_var:
+                {
+                    getNextToken();
+
+                    auto &frame = openFrame(ExprContext::VarInit, loc);
+                    frame.listBase = declarations.size();
+                    parseVarDeclarations(frame);
+                    break;
+                }
+                default:
+                    if (CurTok == '(')
+                    {
+                        getNextToken(); // eat (.
+                        openFrame(ExprContext::Paren, loc);
+                        break;
+                    }
+
+                    throw ParseError("unknown token when expecting an expression");
+                }
+
+                if (operand.isValid())
+                {
+                    pushOperand(operand);
+                    expectOperand = false;
+                }
+
+                continue;
+            }
 
-        char op = expectAscii("invalid unary operator %1%");
-        auto opd = ParseUnary();
+            int TokPrec = GetTokPrecedence();
 
-        return UnaryExprAST(loc, op, std::move(opd));
-    }
+            if (TokPrec >= 0)
+            {
+                // left associative: everything that binds at least as tightly is complete
+                while (operators.size() > frames.back().operatorBase && operators.back().precedence >= TokPrec)
+                {
+                    reduce();
+                }
 
-    ExprAST Parser::ParseBinOpRHS(int ExprPrec,
-                                  ExprAST &&LHS)
-    {
-        // If this is a binop, find its precedence.
-        while (1)
-        {
-            int TokPrec = GetTokPrecedence();
+                operators.push_back({CurTok.getCharValue(), TokPrec, lexer_.getLocation(), false});
+                getNextToken(); // eat binop
+
+                expectOperand = true;
+                continue;
+            }
 
-            // If this is a binop that binds at least as tightly as the current binop,
-            // consume it, otherwise we are done.
-            if (TokPrec < ExprPrec)
+            // no more operators: the expression of the innermost frame is complete.
+            while (operators.size() > frames.back().operatorBase)
             {
-                return std::move(LHS);
+                reduce();
             }
-            // Okay, we know this is a binop.
 
-            int BinOp = CurTok.getCharValue();
-            SourceLocation loc = lexer_.getLocation();
+            ExprRef result = operands.back();
+            operands.pop_back();
 
-            getNextToken(); // eat binop
+            auto &frame = frames.back();
+            expectOperand = true;
 
-            // Parse the primary expression after the binary operator.
-            auto RHS = ParseUnary();
-            int NextPrec = GetTokPrecedence();
-            if (TokPrec < NextPrec)
+            switch (frame.context)
+            {
+            case ExprContext::TopLevel:
+                return result;
+            case ExprContext::Paren:
+                expectChar(')', "expected ')'");
+                frames.pop_back();
+                pushOperand(result);
+                expectOperand = false;
+                break;
+            case ExprContext::CallArgument:
+                args.push_back(result);
+
+                if (tryConsumeChar(')'))
+                {
+                    auto callArgs = std::span<ExprRef const>(args).subspan(frame.listBase);
+                    auto call = arena_.add(CallExprAST(frame.loc, frame.name, arena_.addArgs(callArgs)));
+
+                    args.resize(frame.listBase);
+                    frames.pop_back();
+                    pushOperand(call);
+                    expectOperand = false;
+                }
+                else
+                {
+                    expectChar(',', "Expected ')' or ',' in argument list");
+                }
+                break;
+            case ExprContext::Index:
             {
-                RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
+                expectChar(']', "expected ']' after index");
+                auto element = arena_.add(IndexExprAST(frame.loc, frame.first, result));
+
+                // a[i][j]: the element is an array itself
+                if (tryConsumeChar('['))
+                {
+                    frame.first = element;
+                    break;
+                }
+
+                frames.pop_back();
+                pushOperand(element);
+                expectOperand = false;
+                break;
             }
+            case ExprContext::IfCondition:
+                frame.first = result;
+                expectKeyword(tok_then, "expected then");
+                frame.context = ExprContext::IfThen;
+                break;
+            case ExprContext::IfThen:
+                frame.second = result;
+                expectKeyword(tok_else, "expected else");
+                frame.context = ExprContext::IfElse;
+                break;
+            case ExprContext::IfElse:
+            {
+                auto ifExpr = arena_.add(IfExprAST(frame.loc, frame.first, frame.second, result));
 
-            // Merge LHS/RHS.
-            LHS = BinaryExprAST(loc, BinOp, std::move(LHS), std::move(RHS));
-        } // loop around to the top of the while loop.
+                frames.pop_back();
+                pushOperand(ifExpr);
+                expectOperand = false;
+                break;
+            }
+            case ExprContext::ForStart:
+                frame.first = result;
+                expectChar(',', "expected ',' after for start value");
+                frame.context = ExprContext::ForEnd;
+                break;
+            case ExprContext::ForEnd:
+                frame.second = result;
+
+                if (tryConsumeChar(','))
+                {
+                    frame.context = ExprContext::ForStep;
+                }
+                else
+                {
+                    frame.hints = ParseLoopHints();
+                    expectKeyword(tok_in, "expected 'in' after for");
+                    frame.context = ExprContext::ForBody;
+                }
+                break;
+            case ExprContext::ForStep:
+                frame.third = result;
+                frame.hints = ParseLoopHints();
+                expectKeyword(tok_in, "expected 'in' after for");
+                frame.context = ExprContext::ForBody;
+                break;
+            case ExprContext::ForBody:
+            {
+                ExprRef forExpr;
+
+                if (frame.reduction)
+                {
+                    forExpr = arena_.add(ReductionExprAST(frame.loc, frame.name, frame.first, frame.second, frame.third, result));
+                    arena_.setReductionKind(forExpr, *frame.reduction);
+                }
+                else if (frame.parallel)
+                {
+                    forExpr = arena_.add(ParForExprAST(frame.loc, frame.name, frame.first, frame.second, frame.third, result));
+                }
+                else
+                {
+                    forExpr = arena_.add(ForExprAST(frame.loc, frame.name, frame.first, frame.second, frame.third, result));
+                }
+
+                arena_.setLoopHints(forExpr, frame.hints);
+
+                frames.pop_back();
+                pushOperand(forExpr);
+                expectOperand = false;
+                break;
+            }
+            case ExprContext::VarInit:
+                declarations.emplace_back(frame.nameLoc, frame.name, result);
+
+                if (tryConsumeChar(','))
+                {
+                    parseVarDeclarations(frame);
+                }
+                else
+                {
+                    expectKeyword(tok_in, "expected 'in' keyword after 'var'");
+                    frame.context = ExprContext::VarBody;
+                }
+                break;
+            case ExprContext::VarBody:
+            {
+                auto varDecls = std::span<VariableDeclarationAST const>(declarations).subspan(frame.listBase);
+                auto varExpr = arena_.add(VarExprAST(frame.loc, arena_.addDeclarations(varDecls), result));
+
+                declarations.erase(declarations.begin() + frame.listBase, declarations.end());
+                frames.pop_back();
+                pushOperand(varExpr);
+                expectOperand = false;
+                break;
+            }
+            }
+        }
     }
 
-    IfExprAST Parser::ParseIfExpr()
+    /// hints ::= (identifier '(' number ')')*
+    /// The limits of vectorize and interleave are the ones LLVM's loop vectorizer accepts.
+    LoopHints Parser::ParseLoopHints()
     {
-        SourceLocation loc = lexer_.getLocation();
+        LoopHints hints;
 
-        getNextToken();
+        while (CurTok.getType() == tok_identifier)
+        {
+            std::string name(CurTok.getIdentifierValue().str());
+            getNextToken();
 
-        // condition.
-        auto Cond = ParseExpression();
+            expectChar('(', "expected '(' after loop hint '" + name + "'");
 
-        expectKeyword(tok_then, "expected then");
-        auto Then = ParseExpression();
+            if (CurTok.getType() != tok_number)
+            {
+                throw ParseError("expected a number in loop hint '" + name + "'");
+            }
 
-        expectKeyword(tok_else, "expected else");
-        auto Else = ParseExpression();
+            double value = CurTok.getNumValue();
+            getNextToken();
 
-        return {loc, std::move(Cond), std::move(Then), std::move(Else)};
-    }
+            expectChar(')', "expected ')' after the value of loop hint '" + name + "'");
 
-    ForExprAST Parser::ParseForExpr()
-    {
-        SourceLocation loc = lexer_.getLocation();
-        getNextToken(); // consume for
+            std::uint32_t *hint;
+            std::uint32_t limit;
+
+            if (name == "unroll")
+            {
+                hint = &hints.unroll;
+                limit = 1u << 16;
+            }
+            else if (name == "vectorize")
+            {
+                hint = &hints.vectorize;
+                limit = 64;
+            }
+            else if (name == "interleave")
+            {
+                hint = &hints.interleave;
+                limit = 16;
+            }
+            else
+            {
+                throw ParseError("unknown loop hint '" + name + "', expected unroll, vectorize or interleave");
+            }
 
-        std::string varName = expectIdentifier("expected identifier after for");
-        expectChar('=', "expected = after for");
+            if (*hint != 0)
+            {
+                throw ParseError("duplicate loop hint '" + name + "'");
+            }
 
-        auto start = ParseExpression();
-        expectChar(',', "expected ',' after for start value");
-        auto end = ParseExpression();
+            if (!(value >= 1 && value <= limit) || std::trunc(value) != value)
+            {
+                throw ParseError("loop hint '" + name + "' must be an integer from 1 to " + std::to_string(limit));
+            }
 
-        std::unique_ptr<ExprAST> step;
-        if (tryConsumeChar(','))
-        {
-            step = std::make_unique<ExprAST>(ParseExpression());
-        }
+            *hint = static_cast<std::uint32_t>(value);
 
-        expectKeyword(tok_in, "expected 'in' after for");
-        auto body = ParseExpression();
+            if (hint != &hints.unroll && !std::has_single_bit(*hint))
+            {
+                throw ParseError("loop hint '" + name + "' must be a power of two");
+            }
+        }
 
-        return {loc, varName, std::move(start), std::move(end), std::move(step), std::move(body)};
+        return hints;
     }
 
-    VarExprAST Parser::ParseVarExpr()
+    /// fastmath ::= 'fastmath' ('(' identifier* ')')?
+    /// The flags are named as in LLVM IR.
+    FastMath Parser::ParseFastMath()
     {
-        SourceLocation varLoc = lexer_.getLocation();
-        getNextToken();
+        static std::unordered_map<std::string_view, FastMath> const flagNames{
+            {"reassoc", FastMath::Reassoc},
+            {"contract", FastMath::Contract},
+            {"nnan", FastMath::NoNaNs},
+            {"ninf", FastMath::NoInfs},
+            {"nsz", FastMath::NoSignedZeros},
+            {"arcp", FastMath::AllowReciprocal},
+            {"afn", FastMath::ApproxFunc},
+            {"fast", FastMath::All}};
+
+        expectKeyword(tok_fastmath, "expected 'fastmath'");
+
+        if (!tryConsumeChar('('))
+        {
+            return FastMath::All;
+        }
 
-        std::vector<VariableDeclarationAST> varDecls;
+        auto fastMath = FastMath::None;
 
-        do
+        while (CurTok.getType() == tok_identifier)
         {
-            SourceLocation identLoc = lexer_.getLocation();
-            std::string name = expectIdentifier("Expected identifier list after 'var'");
-            ExprAST initVal = NumberExprAST(lexer_.getLocation(), 0.0);
+            auto name = CurTok.getIdentifierValue().str();
+            auto flag = flagNames.find(name);
 
-            if (tryConsumeChar('='))
+            if (flag == flagNames.end())
             {
-                initVal = ParseExpression();
+                throw ParseError("unknown fastmath flag '" + std::string(name) + "'");
             }
 
-            varDecls.emplace_back(identLoc, name, std::move(initVal));
-        } while (tryConsumeChar(','));
-
-        expectKeyword(tok_in, "expected 'in' keyword after 'var'");
+            fastMath = fastMath | flag->second;
+            getNextToken();
+        }
 
-        auto body = ParseExpression();
+        expectChar(')', "expected ')' after fastmath flags");
 
-        return {varLoc, std::move(varDecls), std::move(body)};
+        return fastMath;
     }
 
-    PrototypeAST Parser::ParsePrototype()
+    /// prototype ::= precision? (identifier | 'unary' op | 'binary' op number?) '(' argument* ')' '[]'?
+    /// precision ::= 'float32' | 'float64'
+    PrototypeAST Parser::ParsePrototype(bool isMemoized, FastMath fastMath)
     {
         SourceLocation loc = lexer_.getLocation();
 
         std::size_t opArgsCount;
-        std::string FnName;
+        Symbol FnName;
         int binprecedence = 30;
 
+        auto precision = Precision::Default;
+        if (tryConsumeKeyword(tok_float32))
+        {
+            precision = Precision::Single;
+        }
+        else if (tryConsumeKeyword(tok_float64))
+        {
+            precision = Precision::Double;
+        }
+
         switch (CurTok.getType())
         {
         case tok_identifier:
@@ -322,14 +676,12 @@ namespace kaleidoscope
             break;
         case tok_unary:
             getNextToken();
-            FnName = "unary";
-            FnName += expectAscii("Expected unary operator");
+            FnName = Symbol(std::string("unary") + expectAscii("Expected unary operator"));
             opArgsCount = 1;
             break;
         case tok_binary:
             getNextToken();
-            FnName = "binary";
-            FnName += expectAscii("Expected binary operator");
+            FnName = Symbol(std::string("binary") + expectAscii("Expected binary operator"));
             opArgsCount = 2;
 
             if (CurTok.getType() == tok_number)
@@ -344,34 +696,76 @@ namespace kaleidoscope
 
         expectChar('(', "Expected '(' in prototype");
 
-        // Read the list of argument names.
-        std::vector<std::string> ArgNames;
+        // Read the list of argument names, each one optionally marked as array.
+        std::vector<Symbol> ArgNames;
+        std::vector<bool> arrayArgs;
         while (CurTok.getType() == tok_identifier)
         {
-            ArgNames.push_back(CurTok.getIdentifierValue());
+            ArgNames.emplace_back(CurTok.getIdentifierValue());
             getNextToken();
+
+            arrayArgs.push_back(tryConsumeChar('['));
+            if (arrayArgs.back())
+            {
+                expectChar(']', "expected ']' after '[' in prototype");
+            }
         }
         expectChar(')', "Expected ')' in prototype");
 
+        bool returnsArray = tryConsumeChar('[');
+        if (returnsArray)
+        {
+            expectChar(']', "expected ']' after '[' in prototype");
+        }
+
         if (opArgsCount != 0 && ArgNames.size() != opArgsCount)
         {
             throw ParseError("Invalid number of operands for operator");
         }
 
+        PrototypeAST proto{loc, FnName, std::move(ArgNames), opArgsCount != 0, binprecedence, isMemoized, std::move(arrayArgs), returnsArray, fastMath, precision};
+
         // success.
 
-        return {loc, FnName, std::move(ArgNames), opArgsCount != 0, binprecedence};
+        return proto;
+    }
+
+    /// definitionprototype ::= ('memo' | fastmath)* 'def' prototype
+    PrototypeAST Parser::ParseDefinitionPrototype()
+    {
+        bool isMemoized = false;
+        auto fastMath = FastMath::None;
+
+        while (CurTok.getType() != tok_def)
+        {
+            if (tryConsumeKeyword(tok_memo))
+            {
+                isMemoized = true;
+            }
+            else if (CurTok.getType() == tok_fastmath)
+            {
+                fastMath = fastMath | ParseFastMath();
+            }
+            else
+            {
+                throw ParseError("expected 'def' after 'memo' or 'fastmath'");
+            }
+        }
+
+        getNextToken(); // eat def.
+
+        return ParsePrototype(isMemoized, fastMath);
     }
 
     FunctionAST Parser::ParseDefinition()
     {
         SourceLocation loc = lexer_.getLocation();
 
-        getNextToken(); // eat def.
-        auto Proto = ParsePrototype();
+        arena_.clear();
+        auto Proto = ParseDefinitionPrototype();
         auto E = ParseExpression();
 
-        return {loc, std::move(Proto), std::move(E)};
+        return {loc, std::move(Proto), std::exchange(arena_, ASTArena()), E};
     }
 
     PrototypeAST Parser::ParseExtern()
@@ -383,10 +777,11 @@ namespace kaleidoscope
     FunctionAST Parser::ParseTopLevelExpr()
     {
         SourceLocation loc = lexer_.getLocation();
+        arena_.clear();
         auto E = ParseExpression();
         // Make an anonymous proto.
-        PrototypeAST Proto{loc, topLevelSymbolName_, std::vector<std::string>()};
-        return {loc, std::move(Proto), std::move(E)};
+        PrototypeAST Proto{loc, topLevelSymbolName_, std::vector<Symbol>()};
+        return {loc, std::move(Proto), std::exchange(arena_, ASTArena()), E};
     }
 
     void Parser::registerOperator(PrototypeAST const &operatorProto)
@@ -8,6 +8,7 @@
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
+#include <utility>
 
 namespace kaleidoscope
 {
@@ -17,6 +18,9 @@ namespace kaleidoscope
         ParseError(std::string const &errMsg);
     };
 
+    /// binary operator character -> precedence
+    using OperatorPrecedence = std::unordered_map<char, int>;
+
     class Parser
     {
     public:
@@ -24,20 +28,15 @@ namespace kaleidoscope
 
         Token getNextToken() { return CurTok = lexer_.gettok(); }
         Token getCurrentToken() { return CurTok; }
-        std::string const &getTopLevelSymbolName() const { return topLevelSymbolName_; }
-
-        NumberExprAST ParseNumberExpr();
-        ExprAST ParseParenExpr();
-        ExprAST ParseIdentifierExpr();
-        ExprAST ParsePrimary();
-        ExprAST ParseExpression();
-        ExprAST ParseUnary();
-        ExprAST ParseBinOpRHS(int ExprPrec, ExprAST &&LHS);
-        VarExprAST ParseVarExpr();
-        IfExprAST ParseIfExpr();
-        ForExprAST ParseForExpr();
-
-        PrototypeAST ParsePrototype();
+        Symbol getTopLevelSymbolName() const { return topLevelSymbolName_; }
+
+        // Adds the nodes of the expression to the arena of the top-level item
+        // currently being parsed and returns a reference to its root.
+        ExprRef ParseExpression();
+
+        PrototypeAST ParsePrototype(bool isMemoized = false, FastMath fastMath = FastMath::None);
+        /// the annotations, 'def' and the prototype of a definition
+        PrototypeAST ParseDefinitionPrototype();
         FunctionAST ParseDefinition();
         PrototypeAST ParseExtern();
         FunctionAST ParseTopLevelExpr();
@@ -45,10 +44,16 @@ namespace kaleidoscope
         void registerOperator(PrototypeAST const &operatorProto);
         void removeOperator(PrototypeAST const &operatorProto);
 
+        OperatorPrecedence const &getOperatorPrecedence() const { return binOpPrecedence; }
+        void setOperatorPrecedence(OperatorPrecedence precedence) { binOpPrecedence = std::move(precedence); }
+        static OperatorPrecedence const &defaultOperatorPrecedence();
+
     private:
         int GetTokPrecedence() const;
+        LoopHints ParseLoopHints();
+        FastMath ParseFastMath();
 
-        std::string expectIdentifier(std::string const &errMsg);
+        Symbol expectIdentifier(std::string const &errMsg);
         char expectAscii(std::string const &errMsg);
         void expectChar(char expected, std::string const &errMsg);
         void expectKeyword(TokenType expected, std::string const &errMsg);
@@ -57,10 +62,11 @@ namespace kaleidoscope
         bool tryConsumeKeyword(TokenType expected);
 
         Lexer &lexer_;
-        std::string topLevelSymbolName_;
+        Symbol topLevelSymbolName_;
         Token CurTok{tok_eof};
+        ASTArena arena_;
 
-        std::unordered_map<char, int> binOpPrecedence;
+        OperatorPrecedence binOpPrecedence;
     };
 } // namespace kaleidoscope
 
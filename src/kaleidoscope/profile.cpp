@@ -0,0 +1,191 @@
+#include "profile.hpp"
+
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/GlobalVariable.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/InstrProfReader.h>
+#include <llvm/ProfileData/InstrProfWriter.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+
+#include <unordered_map>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        void removeFromUsedList(llvm::Module &module, bool compilerUsed, llvm::SmallPtrSetImpl<llvm::GlobalValue *> const &removed)
+        {
+            llvm::SmallVector<llvm::GlobalValue *, 16> used;
+            auto list = llvm::collectUsedGlobalVariables(module, used, compilerUsed);
+
+            if (list == nullptr)
+            {
+                return;
+            }
+
+            llvm::erase_if(used, [&removed](llvm::GlobalValue *value)
+                           { return removed.contains(value); });
+            list->eraseFromParent();
+
+            if (compilerUsed)
+            {
+                llvm::appendToCompilerUsed(module, used);
+            }
+            else
+            {
+                llvm::appendToUsed(module, used);
+            }
+        }
+    }
+
+    ProfileError::ProfileError(std::string const &errMsg)
+        : Error("Profile error: " + errMsg)
+    {
+    }
+
+    void ProfileCollector::addModule(llvm::Module &module)
+    {
+        // the descriptions and names of the counters and the profile kind,
+        // for the profile runtime; the JIT cannot merge the comdat of the latter
+        llvm::SmallPtrSet<llvm::GlobalValue *, 16> removed;
+        std::vector<llvm::GlobalVariable *> counters;
+        std::vector<llvm::GlobalVariable *> data;
+        // also of the functions the optimiser removed after inlining them
+        llvm::InstrProfSymtab names;
+
+        for (auto &variable : module.globals())
+        {
+            auto name = variable.getName();
+
+            if (name.startswith(llvm::getInstrProfCountersVarPrefix()))
+            {
+                counters.push_back(&variable);
+                continue;
+            }
+
+            if (name.startswith(llvm::getInstrProfDataVarPrefix()))
+            {
+                data.push_back(&variable);
+            }
+            else if (name == llvm::getInstrProfNamesVarName())
+            {
+                if (auto error = names.create(llvm::cast<llvm::ConstantDataSequential>(variable.getInitializer())->getAsString()))
+                {
+                    throw ProfileError(llvm::toString(std::move(error)));
+                }
+            }
+            else if (!name.startswith(llvm::getInstrProfValuesVarPrefix()) && name != INSTR_PROF_QUOTE(INSTR_PROF_RAW_VERSION_VAR))
+            {
+                continue;
+            }
+
+            removed.insert(&variable);
+        }
+
+        // the name and hash of a function by the name of its data and counters without their prefixes
+        std::unordered_map<std::string, std::pair<std::string, std::uint64_t>> functions;
+
+        for (auto variable : data)
+        {
+            // NameRef and FuncHash, see InstrProfData.inc
+            auto fields = llvm::cast<llvm::ConstantStruct>(variable->getInitializer());
+            auto nameRef = llvm::cast<llvm::ConstantInt>(fields->getOperand(0))->getZExtValue();
+            auto hash = llvm::cast<llvm::ConstantInt>(fields->getOperand(1))->getZExtValue();
+
+            functions[variable->getName().drop_front(llvm::getInstrProfDataVarPrefix().size()).str()] = {names.getFuncName(nameRef).str(), hash};
+        }
+
+        removeFromUsedList(module, false, removed);
+        removeFromUsedList(module, true, removed);
+
+        for (auto value : removed)
+        {
+            value->dropAllReferences();
+        }
+
+        llvm::SmallPtrSet<llvm::Comdat *, 4> comdats;
+
+        for (auto value : removed)
+        {
+            if (auto comdat = value->getComdat())
+            {
+                comdats.insert(comdat);
+            }
+
+            value->eraseFromParent();
+        }
+
+        for (auto &object : module.global_objects())
+        {
+            comdats.erase(object.getComdat());
+        }
+
+        for (auto comdat : comdats)
+        {
+            module.getComdatSymbolTable().erase(comdat->getName());
+        }
+
+        auto int64Type = llvm::Type::getInt64Ty(module.getContext());
+
+        for (auto variable : counters)
+        {
+            auto function = functions.find(variable->getName().drop_front(llvm::getInstrProfCountersVarPrefix().size()).str());
+
+            if (function == functions.end())
+            {
+                continue;
+            }
+
+            auto size = llvm::cast<llvm::ArrayType>(variable->getValueType())->getNumElements();
+            auto &moved = counters_.emplace_back(Counters{function->second.first, function->second.second, std::vector<std::uint64_t>(size)});
+
+            auto address = llvm::ConstantInt::get(int64Type, reinterpret_cast<std::uintptr_t>(moved.counts.data()));
+            variable->replaceAllUsesWith(llvm::ConstantExpr::getIntToPtr(address, variable->getType()));
+            variable->eraseFromParent();
+        }
+    }
+
+    void ProfileCollector::writeProfile(std::string const &fileName) const
+    {
+        llvm::InstrProfWriter writer;
+
+        if (auto error = writer.mergeProfileKind(llvm::InstrProfKind::IR))
+        {
+            throw ProfileError(llvm::toString(std::move(error)));
+        }
+
+        for (auto const &counters : counters_)
+        {
+            // a redefinition with another number of counters is left out
+            writer.addRecord(llvm::NamedInstrProfRecord(counters.name, counters.hash, counters.counts),
+                             [](llvm::Error error)
+                             { llvm::consumeError(std::move(error)); });
+        }
+
+        std::error_code ec;
+        llvm::raw_fd_ostream out(fileName, ec, llvm::sys::fs::OF_None);
+
+        if (ec)
+        {
+            throw ProfileError(ec.message());
+        }
+
+        if (auto error = writer.write(out))
+        {
+            throw ProfileError(llvm::toString(std::move(error)));
+        }
+    }
+
+    void checkProfile(std::string const &fileName)
+    {
+        auto reader = llvm::IndexedInstrProfReader::create(fileName);
+
+        if (!reader)
+        {
+            throw ProfileError(fileName + ": " + llvm::toString(reader.takeError()));
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef INCLUDED_KALEIDOSCOPE_PROFILE_HPP
+#define INCLUDED_KALEIDOSCOPE_PROFILE_HPP
+
+#include "error.hpp"
+
+#include <llvm/IR/Module.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace kaleidoscope
+{
+    class ProfileError : public Error
+    {
+    public:
+        ProfileError(std::string const &errMsg);
+    };
+
+    /// ProfileCollector - the counters of the modules instrumented for the
+    /// JIT, see ProfileOptions::instrument. LLVM lowers the instrumentation
+    /// for compiler-rt's profile runtime, which finds the counters and their
+    /// descriptions in sections of the executable. addModule() moves the
+    /// counters into memory of the collector instead and drops the rest, so
+    /// the counts outlive the module in the JIT, and writeProfile() writes
+    /// them as an indexed profile for ProfileOptions::useFile.
+    class ProfileCollector
+    {
+    public:
+        /// module is instrumented and optimised, and not compiled yet
+        void addModule(llvm::Module &module);
+
+        /// the counts so far; those of a function defined more than once add up
+        void writeProfile(std::string const &fileName) const;
+
+    private:
+        struct Counters
+        {
+            /// as the profile names the function, see llvm::getPGOFuncName()
+            std::string name;
+            /// of the function's control flow graph
+            std::uint64_t hash;
+            /// updated by the generated code
+            std::vector<std::uint64_t> counts;
+        };
+
+        std::vector<Counters> counters_;
+    };
+
+    /// throws a ProfileError unless fileName is an indexed profile
+    void checkProfile(std::string const &fileName);
+}
+
+#endif
@@ -0,0 +1,601 @@
+#include "simplifier.hpp"
+
+#include "token.hpp"
+#include "typeinference.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <concepts>
+#include <deque>
+#include <optional>
+#include <vector>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        bool isBuiltinOperator(char op)
+        {
+            return op == '+' || op == '-' || op == '*' || op == '/' || op == '<' || op == op_and || op == op_or;
+        }
+
+        /// the truth value of a condition, fcmp one 0.0: NaN is false
+        template <std::floating_point T>
+        bool isTrue(T value)
+        {
+            return value < 0 || value > 0;
+        }
+
+        template <std::floating_point T>
+        T foldBinary(char op, T lhs, T rhs)
+        {
+            switch (op)
+            {
+            case '+':
+                return lhs + rhs;
+            case '-':
+                return lhs - rhs;
+            case '*':
+                return lhs * rhs;
+            case '/':
+                return lhs / rhs;
+            case op_and:
+                return isTrue(lhs) && isTrue(rhs) ? 1 : 0;
+            case op_or:
+                return isTrue(lhs) || isTrue(rhs) ? 1 : 0;
+            default:
+                // fcmp ult: true if either operand is NaN
+                return !(lhs >= rhs) ? 1 : 0;
+            }
+        }
+
+        /// Folds a builtin operator exactly like the IR emitted by CodeGenerator
+        /// would compute it: in float for a float32 function, except for
+        /// comparisons of integral constants, which are Ints (see inferTypes()).
+        double foldBinary(char op, double lhs, double rhs, Precision precision)
+        {
+            bool compareInts = op == '<' && isExactInteger(lhs) && isExactInteger(rhs);
+
+            if (precision == Precision::Single && !compareInts)
+            {
+                return foldBinary<float>(op, static_cast<float>(lhs), static_cast<float>(rhs));
+            }
+
+            return foldBinary<double>(op, lhs, rhs);
+        }
+
+        bool isPositiveZero(double value) { return value == 0.0 && !std::signbit(value); }
+        bool isNegativeZero(double value) { return value == 0.0 && std::signbit(value); }
+
+        /// Builds the simplified nodes with an explicit task stack, like
+        /// CodeGenerator does. Every node is added after its children.
+        class Simplifier
+        {
+        public:
+            Simplifier(ASTArena const &in, Precision precision) : in_(in), precision_(precision) {}
+
+            ExprRef operator()(ExprRef expr)
+            {
+                descend(expr);
+
+                while (!tasks_.empty())
+                {
+                    auto &task = tasks_.back();
+                    bool finished = std::visit([this, &task](auto const &node)
+                                               { return step(node, task); },
+                                               in_[task.expr]);
+
+                    if (finished)
+                    {
+                        tasks_.pop_back();
+                    }
+                }
+
+                return popResult();
+            }
+
+            ASTArena const &getArena() const { return out_; }
+
+        private:
+            struct Task
+            {
+                explicit Task(ExprRef expr, std::size_t outBase) : expr(expr), outBase(outBase) {}
+
+                ExprRef expr;
+                std::size_t stage = 0;
+                /// size of the output arena when the task started
+                std::size_t outBase;
+                /// var: size of the output arena after each initialiser
+                std::vector<std::size_t> marks;
+            };
+
+            bool descend(ExprRef child)
+            {
+                tasks_.emplace_back(child, out_.size());
+                return false;
+            }
+
+            bool finish(ExprRef result)
+            {
+                results_.push_back(result);
+                return true;
+            }
+
+            ExprRef popResult()
+            {
+                auto result = results_.back();
+                results_.pop_back();
+                return result;
+            }
+
+            /// the truth value of a constant condition in the precision of the function
+            bool isTrueConstant(double value) const
+            {
+                return precision_ == Precision::Single ? isTrue(static_cast<float>(value)) : isTrue(value);
+            }
+
+            std::optional<double> getConstant(ExprRef ref) const
+            {
+                if (auto number = std::get_if<NumberExprAST>(out_.tryGet(ref)))
+                {
+                    return number->getVal();
+                }
+
+                return std::nullopt;
+            }
+
+            bool step(NumberExprAST const &expr, Task &)
+            {
+                return finish(out_.add(expr));
+            }
+
+            bool step(VariableExprAST const &expr, Task &)
+            {
+                return finish(out_.add(expr));
+            }
+
+            bool step(UnaryExprAST const &expr, Task &task)
+            {
+                if (task.stage++ == 0)
+                {
+                    return descend(expr.getOperand());
+                }
+
+                auto operand = popResult();
+
+                if (auto value = getConstant(operand); value && expr.getOp() == '!')
+                {
+                    return finish(out_.add(NumberExprAST(expr.getLocation(), isTrueConstant(*value) ? 0.0 : 1.0)));
+                }
+
+                return finish(out_.add(UnaryExprAST(expr.getLocation(), expr.getOp(), operand)));
+            }
+
+            bool step(BinaryExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getLHS());
+                case 1:
+                    return descend(expr.getRHS());
+                default:
+                    break;
+                }
+
+                auto RHS = popResult();
+                auto LHS = popResult();
+
+                if (!isBuiltinOperator(expr.getOp()))
+                {
+                    return finish(out_.add(BinaryExprAST(expr.getLocation(), expr.getOp(), LHS, RHS)));
+                }
+
+                auto L = getConstant(LHS);
+                auto R = getConstant(RHS);
+
+                if (L && R)
+                {
+                    return finish(out_.add(NumberExprAST(expr.getLocation(), foldBinary(expr.getOp(), *L, *R, precision_))));
+                }
+
+                switch (expr.getOp())
+                {
+                case op_and:
+                case op_or:
+                    // a left operand that decides the result means the right one is never evaluated
+                    if (L && isTrueConstant(*L) == (expr.getOp() == op_or))
+                    {
+                        return finish(out_.add(NumberExprAST(expr.getLocation(), isTrueConstant(*L) ? 1.0 : 0.0)));
+                    }
+                    break;
+                case '*':
+                    if (R == 1.0)
+                    {
+                        return finish(LHS);
+                    }
+                    if (L == 1.0)
+                    {
+                        return finish(RHS);
+                    }
+                    break;
+                case '/':
+                    if (R == 1.0)
+                    {
+                        return finish(LHS);
+                    }
+                    break;
+                case '-':
+                    if (R && isPositiveZero(*R))
+                    {
+                        return finish(LHS);
+                    }
+                    break;
+                case '+':
+                    if (R && isNegativeZero(*R))
+                    {
+                        return finish(LHS);
+                    }
+                    if (L && isNegativeZero(*L))
+                    {
+                        return finish(RHS);
+                    }
+                    break;
+                default:
+                    break;
+                }
+
+                return finish(out_.add(BinaryExprAST(expr.getLocation(), expr.getOp(), LHS, RHS)));
+            }
+
+            bool step(CallExprAST const &expr, Task &task)
+            {
+                auto args = in_.getArgs(expr);
+
+                if (task.stage < args.size())
+                {
+                    return descend(args[task.stage++]);
+                }
+
+                auto newArgs = out_.addArgs(std::span<ExprRef const>(results_).last(args.size()));
+                results_.resize(results_.size() - args.size());
+
+                return finish(out_.add(CallExprAST(expr.getLocation(), expr.getCallee(), newArgs)));
+            }
+
+            bool step(IndexExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getArray());
+                case 1:
+                    return descend(expr.getIndex());
+                default:
+                    break;
+                }
+
+                auto index = popResult();
+                auto array = popResult();
+
+                return finish(out_.add(IndexExprAST(expr.getLocation(), array, index)));
+            }
+
+            bool step(IfExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getCondition());
+                case 1:
+                    if (auto condition = getConstant(results_.back()))
+                    {
+                        popResult();
+                        task.stage = 4;
+
+                        return descend(isTrueConstant(*condition) ? expr.getThenBranch() : expr.getElseBranch());
+                    }
+
+                    return descend(expr.getThenBranch());
+                case 2:
+                    return descend(expr.getElseBranch());
+                case 3:
+                {
+                    auto elseBranch = popResult();
+                    auto thenBranch = popResult();
+                    auto condition = popResult();
+
+                    return finish(out_.add(IfExprAST(expr.getLocation(), condition, thenBranch, elseBranch)));
+                }
+                default:
+                    // the taken branch's result stays on the stack
+                    return true;
+                }
+            }
+
+            /// for, parfor and reductions
+            template <std::derived_from<ForExprAST> Loop>
+            bool step(Loop const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getStart());
+                case 1:
+                    return descend(expr.getEnd());
+                case 2:
+                    if (expr.getStep().isValid())
+                    {
+                        return descend(expr.getStep());
+                    }
+
+                    results_.emplace_back();
+                    [[fallthrough]];
+                case 3:
+                    task.stage = 4;
+                    return descend(expr.getBody());
+                default:
+                    break;
+                }
+
+                auto body = popResult();
+                auto stepValue = popResult();
+                auto end = popResult();
+                auto start = popResult();
+
+                auto loop = out_.add(Loop(expr.getLocation(), expr.getVarName(), start, end, stepValue, body));
+
+                if constexpr (std::same_as<Loop, ReductionExprAST>)
+                {
+                    out_.setReductionKind(loop, in_.getReductionKind(task.expr));
+                }
+
+                out_.setLoopHints(loop, in_.getLoopHints(task.expr));
+
+                return finish(loop);
+            }
+
+            bool step(VarExprAST const &expr, Task &task)
+            {
+                auto declarations = in_.getDeclarations(expr);
+
+                if (task.stage > 0 && task.stage <= declarations.size())
+                {
+                    task.marks.push_back(out_.size());
+                }
+
+                while (task.stage < declarations.size())
+                {
+                    auto initVal = declarations[task.stage++].getInitVal();
+
+                    if (initVal.isValid())
+                    {
+                        return descend(initVal);
+                    }
+
+                    results_.emplace_back();
+                    task.marks.push_back(out_.size());
+                }
+
+                if (task.stage++ == declarations.size())
+                {
+                    return descend(expr.getBody());
+                }
+
+                auto body = popResult();
+                std::vector<ExprRef> initVals(results_.end() - declarations.size(), results_.end());
+                results_.resize(results_.size() - declarations.size());
+
+                std::vector<VariableDeclarationAST> kept;
+
+                for (std::size_t i = 0; i < declarations.size(); ++i)
+                {
+                    auto name = declarations[i].getName();
+                    auto initBegin = i == 0 ? task.outBase : task.marks[i - 1];
+                    auto initEnd = task.marks[i];
+
+                    // a redefinition in the same block is an error reported by codegen
+                    bool unique = std::count_if(declarations.begin(), declarations.end(), [name](auto const &decl)
+                                                { return decl.getName() == name; }) == 1;
+
+                    if (!unique || !isPure(initBegin, initEnd) || isReferenced(name, initEnd, out_.size()))
+                    {
+                        kept.emplace_back(declarations[i].getLocation(), name, initVals[i]);
+                    }
+                }
+
+                if (kept.empty())
+                {
+                    return finish(body);
+                }
+
+                return finish(out_.add(VarExprAST(expr.getLocation(), out_.addDeclarations(kept), body)));
+            }
+
+            /// No node in the output range [first, last) has side effects. Calls
+            /// and user-defined operators may, and loops need not terminate.
+            bool isPure(std::size_t first, std::size_t last) const
+            {
+                for (auto i = first; i < last; ++i)
+                {
+                    auto const &node = out_[ExprRef(static_cast<std::uint32_t>(i))];
+
+                    if (auto binary = std::get_if<BinaryExprAST>(&node))
+                    {
+                        if (!isBuiltinOperator(binary->getOp()))
+                        {
+                            return false;
+                        }
+                    }
+                    else if (auto unary = std::get_if<UnaryExprAST>(&node))
+                    {
+                        if (unary->getOp() != '!')
+                        {
+                            return false;
+                        }
+                    }
+                    else if (std::holds_alternative<CallExprAST>(node) ||
+                             std::holds_alternative<ForExprAST>(node) ||
+                             std::holds_alternative<ParForExprAST>(node) ||
+                             std::holds_alternative<ReductionExprAST>(node))
+                    {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            /// the output range [first, last) mentions name, including as the target of '='
+            bool isReferenced(Symbol name, std::size_t first, std::size_t last) const
+            {
+                for (auto i = first; i < last; ++i)
+                {
+                    auto variable = std::get_if<VariableExprAST>(&out_[ExprRef(static_cast<std::uint32_t>(i))]);
+
+                    if (variable != nullptr && variable->getName() == name)
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            ASTArena const &in_;
+            ASTArena out_;
+            Precision precision_;
+
+            std::deque<Task> tasks_;
+            std::vector<ExprRef> results_;
+        };
+
+        /// Copies the nodes reachable from root to a new arena. Relies on
+        /// children being stored before their parents, so that both passes are
+        /// plain loops.
+        class Compactor
+        {
+        public:
+            explicit Compactor(ASTArena const &in) : in_(in) {}
+
+            ExprRef operator()(ExprRef root)
+            {
+                std::vector<bool> live(root.index() + 1);
+                live[root.index()] = true;
+
+                for (auto i = root.index() + 1; i-- > 0;)
+                {
+                    if (live[i])
+                    {
+                        in_.forEachChild(in_[ExprRef(i)], [&live](ExprRef child)
+                                         { live[child.index()] = true; });
+                    }
+                }
+
+                remap_.resize(root.index() + 1);
+
+                for (std::uint32_t i = 0; i <= root.index(); ++i)
+                {
+                    if (live[i])
+                    {
+                        remap_[i] = std::visit([this](auto const &node)
+                                               { return relocate(node); },
+                                               in_[ExprRef(i)]);
+
+                        auto const &node = in_[ExprRef(i)];
+
+                        if (std::holds_alternative<ReductionExprAST>(node))
+                        {
+                            out_.setReductionKind(remap_[i], in_.getReductionKind(ExprRef(i)));
+                        }
+
+                        if (std::holds_alternative<ForExprAST>(node) || std::holds_alternative<ParForExprAST>(node) || std::holds_alternative<ReductionExprAST>(node))
+                        {
+                            out_.setLoopHints(remap_[i], in_.getLoopHints(ExprRef(i)));
+                        }
+                    }
+                }
+
+                return remap_[root.index()];
+            }
+
+            ASTArena takeArena() { return std::move(out_); }
+
+        private:
+            ExprRef map(ExprRef ref) const
+            {
+                return ref.isValid() ? remap_[ref.index()] : ExprRef();
+            }
+
+            ExprRef relocate(NumberExprAST const &node) { return out_.add(node); }
+            ExprRef relocate(VariableExprAST const &node) { return out_.add(node); }
+
+            ExprRef relocate(UnaryExprAST const &node)
+            {
+                return out_.add(UnaryExprAST(node.getLocation(), node.getOp(), map(node.getOperand())));
+            }
+
+            ExprRef relocate(BinaryExprAST const &node)
+            {
+                return out_.add(BinaryExprAST(node.getLocation(), node.getOp(), map(node.getLHS()), map(node.getRHS())));
+            }
+
+            ExprRef relocate(CallExprAST const &node)
+            {
+                std::vector<ExprRef> args;
+
+                for (auto arg : in_.getArgs(node))
+                {
+                    args.push_back(map(arg));
+                }
+
+                return out_.add(CallExprAST(node.getLocation(), node.getCallee(), out_.addArgs(args)));
+            }
+
+            ExprRef relocate(IndexExprAST const &node)
+            {
+                return out_.add(IndexExprAST(node.getLocation(), map(node.getArray()), map(node.getIndex())));
+            }
+
+            ExprRef relocate(IfExprAST const &node)
+            {
+                return out_.add(IfExprAST(node.getLocation(), map(node.getCondition()), map(node.getThenBranch()), map(node.getElseBranch())));
+            }
+
+            template <std::derived_from<ForExprAST> Loop>
+            ExprRef relocate(Loop const &node)
+            {
+                return out_.add(Loop(node.getLocation(), node.getVarName(),
+                                           map(node.getStart()), map(node.getEnd()), map(node.getStep()), map(node.getBody())));
+            }
+
+            ExprRef relocate(VarExprAST const &node)
+            {
+                std::vector<VariableDeclarationAST> declarations;
+
+                for (auto const &decl : in_.getDeclarations(node))
+                {
+                    declarations.emplace_back(decl.getLocation(), decl.getName(), map(decl.getInitVal()));
+                }
+
+                return out_.add(VarExprAST(node.getLocation(), out_.addDeclarations(declarations), map(node.getBody())));
+            }
+
+            ASTArena const &in_;
+            ASTArena out_;
+            std::vector<ExprRef> remap_;
+        };
+    }
+
+    FunctionAST simplify(FunctionAST const &function, Precision defaultPrecision)
+    {
+        auto precision = function.getProto().getPrecision();
+        Simplifier simplifier(function.getArena(), precision == Precision::Default ? defaultPrecision : precision);
+        auto body = simplifier(function.getBody());
+
+        Compactor compactor(simplifier.getArena());
+        body = compactor(body);
+
+        return {function.getLocation(), function.getProto(), compactor.takeArena(), body};
+    }
+}
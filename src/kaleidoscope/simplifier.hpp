@@ -0,0 +1,21 @@
+#ifndef INCLUDED_KALEIDOSCOPE_SIMPLIFIER_HPP
+#define INCLUDED_KALEIDOSCOPE_SIMPLIFIER_HPP
+
+#include "ast.hpp"
+
+namespace kaleidoscope
+{
+    /// Returns a copy of function with a simplified body:
+    ///  - builtin arithmetic, comparisons and logical operators on constants are
+    ///    folded in the precision of the function, as are '&&' and '||' whose
+    ///    left operand decides the result,
+    ///  - 'if' with a constant condition is replaced by the taken branch,
+    ///  - x*1, 1*x, x/1, x-0, x+(-0) and (-0)+x are replaced by x (all exact in IEEE 754),
+    ///  - var bindings that are never referenced and whose initialiser has no
+    ///    side effects are dropped.
+    /// Only reachable nodes are copied to the arena of the result.
+    /// defaultPrecision is that of a function that declares none.
+    FunctionAST simplify(FunctionAST const &function, Precision defaultPrecision = Precision::Double);
+} // namespace kaleidoscope
+
+#endif
@@ -0,0 +1,41 @@
+#include "sourcebuffer.hpp"
+
+namespace kaleidoscope
+{
+    SourceBufferError::SourceBufferError(std::string const &errMsg)
+        : Error("Error reading source: " + errMsg)
+    {
+    }
+
+    SourceBuffer::SourceBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer)
+        : buffer_(std::move(buffer))
+    {
+    }
+
+    SourceBuffer SourceBuffer::fromFile(std::string const &fileName)
+    {
+        auto buffer = llvm::MemoryBuffer::getFile(fileName, false, false);
+
+        if (!buffer)
+        {
+            throw SourceBufferError(fileName + ": " + buffer.getError().message());
+        }
+
+        return SourceBuffer(std::move(*buffer));
+    }
+
+    SourceBuffer SourceBuffer::fromString(std::string_view text, std::string const &bufferName)
+    {
+        return SourceBuffer(llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(text.data(), text.size()), bufferName));
+    }
+
+    std::string_view SourceBuffer::getText() const
+    {
+        return {buffer_->getBufferStart(), buffer_->getBufferSize()};
+    }
+
+    std::string SourceBuffer::getName() const
+    {
+        return buffer_->getBufferIdentifier().str();
+    }
+}
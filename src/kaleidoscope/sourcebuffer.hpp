@@ -0,0 +1,38 @@
+#ifndef INCLUDED_KALEIDOSCOPE_SOURCEBUFFER_HPP
+#define INCLUDED_KALEIDOSCOPE_SOURCEBUFFER_HPP
+
+#include "error.hpp"
+
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace kaleidoscope
+{
+    class SourceBufferError : public Error
+    {
+    public:
+        SourceBufferError(std::string const &errMsg);
+    };
+
+    /// Owns the complete text of a source file. Large files are memory-mapped by
+    /// llvm::MemoryBuffer, so a Lexer working on the buffer does not copy the input.
+    class SourceBuffer
+    {
+    public:
+        static SourceBuffer fromFile(std::string const &fileName);
+        static SourceBuffer fromString(std::string_view text, std::string const &bufferName = "<string>");
+
+        std::string_view getText() const;
+        std::string getName() const;
+
+    private:
+        SourceBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+        std::unique_ptr<llvm::MemoryBuffer> buffer_;
+    };
+}
+
+#endif
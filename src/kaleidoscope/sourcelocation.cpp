@@ -1,5 +1,7 @@
 #include "sourcelocation.hpp"
 
+#include <algorithm>
+
 namespace kaleidoscope
 {
     void SourceLocation::advance(char c)
@@ -14,6 +16,21 @@ namespace kaleidoscope
         }
     }
 
+    void SourceLocation::advance(std::string_view text)
+    {
+        auto lastNewline = text.rfind('\n');
+
+        if (lastNewline == std::string_view::npos)
+        {
+            column_ += static_cast<int>(text.size());
+        }
+        else
+        {
+            line_ += static_cast<int>(std::count(text.begin(), text.begin() + lastNewline + 1, '\n'));
+            column_ = static_cast<int>(text.size() - lastNewline - 1);
+        }
+    }
+
     void SourceLocation::advanceLine()
     {
         column_ = 0;
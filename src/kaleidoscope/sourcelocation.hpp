@@ -1,12 +1,15 @@
 #ifndef INCLUDED_KALEIDOSCOPE_SOURCE_LOCATION_HPP
 #define INCLUDED_KALEIDOSCOPE_SOURCE_LOCATION_HPP
 
+#include <string_view>
+
 namespace kaleidoscope
 {
     class SourceLocation
     {
     public:
         void advance(char c);
+        void advance(std::string_view text);
         void advanceLine();
 
         int line() const { return line_; }
@@ -0,0 +1,176 @@
+#include "ssa.hpp"
+
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/Constants.h>
+
+namespace kaleidoscope
+{
+    Variable SSABuilder::declare(Symbol name, llvm::Type *type)
+    {
+        variables_.push_back({name, type});
+        return Variable{static_cast<std::uint32_t>(variables_.size() - 1)};
+    }
+
+    llvm::Type *SSABuilder::getType(Variable variable) const
+    {
+        return variables_[variable.id].type;
+    }
+
+    void SSABuilder::write(Variable variable, llvm::BasicBlock *block, llvm::Value *value)
+    {
+        definitions_[{block, variable.id}] = value;
+    }
+
+    llvm::Value *SSABuilder::read(Variable variable, llvm::BasicBlock *block)
+    {
+        if (auto definition = definitions_.find({block, variable.id}); definition != definitions_.end())
+        {
+            return definition->second;
+        }
+
+        return readRecursive(variable, block);
+    }
+
+    void SSABuilder::openLoopHeader(llvm::BasicBlock *header)
+    {
+        openHeaders_.insert(header);
+    }
+
+    void SSABuilder::seal(llvm::BasicBlock *header)
+    {
+        openHeaders_.erase(header);
+
+        auto incomplete = incompletePhis_.find(header);
+        if (incomplete == incompletePhis_.end())
+        {
+            return;
+        }
+
+        auto phis = std::move(incomplete->second);
+        incompletePhis_.erase(incomplete);
+
+        for (auto [variable, phi] : phis)
+        {
+            addPhiOperands(variable, phi);
+        }
+    }
+
+    void SSABuilder::clear()
+    {
+        variables_.clear();
+        definitions_.clear();
+        incompletePhis_.clear();
+        openHeaders_.clear();
+        phis_.clear();
+    }
+
+    llvm::Value *SSABuilder::readRecursive(Variable variable, llvm::BasicBlock *block)
+    {
+        llvm::Value *value = nullptr;
+
+        if (openHeaders_.contains(block))
+        {
+            // the operands follow once the back edge is there
+            auto phi = createPhi(variable, block);
+            incompletePhis_[block].emplace_back(variable, phi);
+            value = phi;
+        }
+        else if (auto predecessor = block->getSinglePredecessor())
+        {
+            value = read(variable, predecessor);
+        }
+        else if (llvm::pred_empty(block))
+        {
+            // only a variable that is read before it is written
+            value = llvm::UndefValue::get(getType(variable));
+        }
+        else
+        {
+            // written first, so that reads around a cycle end at the phi
+            auto phi = createPhi(variable, block);
+            write(variable, block, phi);
+            value = addPhiOperands(variable, phi);
+        }
+
+        write(variable, block, value);
+        return value;
+    }
+
+    llvm::PHINode *SSABuilder::createPhi(Variable variable, llvm::BasicBlock *block)
+    {
+        auto const &info = variables_[variable.id];
+        llvm::StringRef name(info.name.str());
+
+        // behind the phis of the block, which the code generator may refer to by position
+        auto phi = block->getFirstNonPHI() != nullptr
+                       ? llvm::PHINode::Create(info.type, 2, name, block->getFirstNonPHI())
+                       : llvm::PHINode::Create(info.type, 2, name, block);
+
+        phis_.insert(phi);
+        return phi;
+    }
+
+    llvm::Value *SSABuilder::addPhiOperands(Variable variable, llvm::PHINode *phi)
+    {
+        for (auto predecessor : llvm::predecessors(phi->getParent()))
+        {
+            phi->addIncoming(read(variable, predecessor), predecessor);
+        }
+
+        return tryRemoveTrivialPhi(phi);
+    }
+
+    // A phi is trivial if it merges a single value besides itself. Removing
+    // it can make the phis using it trivial in turn.
+    llvm::Value *SSABuilder::tryRemoveTrivialPhi(llvm::PHINode *phi)
+    {
+        llvm::Value *same = nullptr;
+
+        for (auto &operand : phi->incoming_values())
+        {
+            if (operand == same || operand == phi)
+            {
+                continue;
+            }
+
+            if (same != nullptr)
+            {
+                return phi;
+            }
+
+            same = operand;
+        }
+
+        if (same == nullptr)
+        {
+            same = llvm::UndefValue::get(phi->getType());
+        }
+
+        // only phis of the builder, the code generator may hold on to its own
+        std::vector<llvm::WeakTrackingVH> users;
+        for (auto user : phi->users())
+        {
+            if (auto userPhi = llvm::dyn_cast<llvm::PHINode>(user); userPhi != nullptr && userPhi != phi && phis_.contains(userPhi))
+            {
+                users.emplace_back(userPhi);
+            }
+        }
+
+        phi->replaceAllUsesWith(same);
+        phis_.erase(phi);
+        phi->eraseFromParent();
+
+        // same may be one of the users, which are replaced in turn
+        llvm::WeakTrackingVH result(same);
+
+        for (auto &user : users)
+        {
+            if (auto userPhi = llvm::dyn_cast_or_null<llvm::PHINode>(user); userPhi != nullptr && phis_.contains(userPhi))
+            {
+                tryRemoveTrivialPhi(userPhi);
+            }
+        }
+
+        return result;
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef INCLUDED_KALEIDOSCOPE_SSA_HPP
+#define INCLUDED_KALEIDOSCOPE_SSA_HPP
+
+#include "interner.hpp"
+
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/ValueHandle.h>
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// A variable of the function being generated, see SSABuilder. A
+    /// parameter described by debug info also has a stack slot, which its
+    /// writes are stored to so that debuggers find its value.
+    struct Variable
+    {
+        std::uint32_t id = 0;
+        llvm::AllocaInst *debugSpace = nullptr;
+    };
+
+    /// SSABuilder - builds SSA form for the variables of a function while its
+    /// IR is generated, after Braun et al., "Simple and Efficient Construction
+    /// of Static Single Assignment Form" (CC 2013). A read finds the latest
+    /// write in its block or, through the predecessors, places phis where
+    /// different writes meet; phis merging a single value are removed again.
+    /// Blocks are taken to have all their predecessors, except those opened
+    /// as loop headers: reads there get phis that are completed when the
+    /// header is sealed after the back edge has been added.
+    class SSABuilder
+    {
+    public:
+        Variable declare(Symbol name, llvm::Type *type);
+        llvm::Type *getType(Variable variable) const;
+
+        void write(Variable variable, llvm::BasicBlock *block, llvm::Value *value);
+        llvm::Value *read(Variable variable, llvm::BasicBlock *block);
+
+        /// header gets another predecessor after its code has been generated
+        void openLoopHeader(llvm::BasicBlock *header);
+        /// all predecessors of header are known
+        void seal(llvm::BasicBlock *header);
+
+        /// forgets the variables, e.g. before the next function is generated
+        void clear();
+
+    private:
+        struct VariableInfo
+        {
+            Symbol name;
+            llvm::Type *type;
+        };
+
+        llvm::Value *readRecursive(Variable variable, llvm::BasicBlock *block);
+        llvm::PHINode *createPhi(Variable variable, llvm::BasicBlock *block);
+        llvm::Value *addPhiOperands(Variable variable, llvm::PHINode *phi);
+        llvm::Value *tryRemoveTrivialPhi(llvm::PHINode *phi);
+
+        // indexed by Variable::id
+        std::vector<VariableInfo> variables_;
+        // the value of a variable at the end of a block as generated so far;
+        // the handles follow a removed phi to its replacement
+        llvm::DenseMap<std::pair<llvm::BasicBlock *, std::uint32_t>, llvm::WeakTrackingVH> definitions_;
+        llvm::DenseMap<llvm::BasicBlock *, std::vector<std::pair<Variable, llvm::PHINode *>>> incompletePhis_;
+        llvm::DenseSet<llvm::BasicBlock *> openHeaders_;
+        // the phis created by the builder and not removed
+        llvm::DenseSet<llvm::PHINode *> phis_;
+    };
+}
+
+#endif
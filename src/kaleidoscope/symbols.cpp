@@ -1,5 +1,6 @@
 #include "symbols.hpp"
 
+#include <algorithm>
 #include <cassert>
 
 namespace kaleidoscope
@@ -9,9 +10,10 @@ namespace kaleidoscope
     {
     }
 
-    llvm::AllocaInst *SymbolTable::tryLookup(std::string const &name) const
+    std::optional<Variable> SymbolTable::tryLookup(Symbol name) const
     {
-        auto iter = namedValues_.find(name);
+        auto iter = std::find_if(namedValues_.begin(), namedValues_.end(), [name](auto const &entry)
+                                 { return entry.first == name; });
 
         if (iter != namedValues_.end())
         {
@@ -22,24 +24,38 @@ namespace kaleidoscope
             return surroundingScope_->tryLookup(name);
         }
 
-        return nullptr;
+        return std::nullopt;
     }
 
-    bool SymbolTable::tryDeclare(std::string const &name, llvm::AllocaInst *value)
+    bool SymbolTable::tryDeclare(Symbol name, Variable variable)
     {
-        auto r = namedValues_.insert({name, value});
-        return r.second;
+        auto iter = std::find_if(namedValues_.begin(), namedValues_.end(), [name](auto const &entry)
+                                 { return entry.first == name; });
+
+        if (iter != namedValues_.end())
+        {
+            return false;
+        }
+
+        namedValues_.emplace_back(name, variable);
+        return true;
     }
 
     SymbolScope::SymbolScope(SymbolTable *&guardedPtr)
-        : SymbolTable(guardedPtr),
-          guardedPtr_(guardedPtr)
+        : SymbolScope(guardedPtr, guardedPtr)
+    {
+    }
+
+    SymbolScope::SymbolScope(SymbolTable *&guardedPtr, SymbolTable *surroundingScope)
+        : SymbolTable(surroundingScope),
+          guardedPtr_(guardedPtr),
+          enclosingScope_(guardedPtr)
     {
         guardedPtr_ = this;
     }
 
     SymbolScope::~SymbolScope()
     {
-        guardedPtr_ = surroundingScope_;
+        guardedPtr_ = enclosingScope_;
     }
 }
@@ -1,10 +1,13 @@
 #ifndef INCLUDED_KALEIDOSCOPE_SYMBOLS_HPP
 #define INCLUDED_KALEIDOSCOPE_SYMBOLS_HPP
 
-#include <llvm/IR/Instructions.h>
+#include "interner.hpp"
+#include "ssa.hpp"
 
 #include <memory>
-#include <unordered_map>
+#include <optional>
+#include <utility>
+#include <vector>
 
 namespace kaleidoscope
 {
@@ -13,24 +16,29 @@ namespace kaleidoscope
     public:
         SymbolTable(SymbolTable *surroundingScope);
 
-        llvm::AllocaInst *tryLookup(std::string const &name) const;
-        bool tryDeclare(std::string const &name, llvm::AllocaInst *value);
+        std::optional<Variable> tryLookup(Symbol name) const;
+        bool tryDeclare(Symbol name, Variable variable);
 
     protected:
         SymbolTable *surroundingScope_;
 
     private:
-        std::unordered_map<std::string, llvm::AllocaInst *> namedValues_;
+        // Scopes hold a handful of names, so a linear scan over symbol ids beats hashing.
+        std::vector<std::pair<Symbol, Variable>> namedValues_;
     };
 
     class SymbolScope : public SymbolTable
     {
     public:
         SymbolScope(SymbolTable *&guardedPtr);
+        /// a scope on top of surroundingScope instead of *guardedPtr, e.g. for
+        /// a function outlined from the one whose scopes are active
+        SymbolScope(SymbolTable *&guardedPtr, SymbolTable *surroundingScope);
         ~SymbolScope();
 
     private:
         SymbolTable *&guardedPtr_;
+        SymbolTable *enclosingScope_;
     };
 }
 
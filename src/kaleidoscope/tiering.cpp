@@ -0,0 +1,333 @@
+#include "tiering.hpp"
+
+#include "optimizer.hpp"
+
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/BasicBlockUtils.h>
+
+#include <algorithm>
+#include <limits>
+#include <string>
+
+namespace kaleidoscope
+{
+    namespace
+    {
+        // calls of functions whose tier 0 failed to compile, see takeCallFailures()
+        std::atomic<std::uint64_t> failedCalls = 0;
+
+        // Called instead of a function whose tier 0 failed to compile, e.g.
+        // because it calls an extern that does not exist. The session has
+        // reported the error; the generated caller, which cannot handle one,
+        // gets NaN.
+        double callThroughFailed()
+        {
+            failedCalls.fetch_add(1, std::memory_order_relaxed);
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+
+        llvm::JITSymbolFlags const stubFlags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+    }
+
+    llvm::Expected<std::unique_ptr<TieredCompiler>> TieredCompiler::Create(llvm::orc::ExecutionSession &ES,
+                                                                           llvm::orc::JITDylib &JD,
+                                                                           llvm::orc::MangleAndInterner &Mangle,
+                                                                           llvm::orc::ObjectLayer &objectLayer,
+                                                                           llvm::orc::IRLayer &optimizedLayer,
+                                                                           llvm::orc::JITTargetMachineBuilder JTMB,
+                                                                           TieringOptions options)
+    {
+        auto TM = JTMB.createTargetMachine();
+        if (!TM)
+            return TM.takeError();
+
+        auto callThrough = llvm::orc::createLocalLazyCallThroughManager(JTMB.getTargetTriple(), ES,
+                                                                         llvm::pointerToJITTargetAddress(&callThroughFailed));
+        if (!callThrough)
+            return callThrough.takeError();
+
+        auto stubsManager = llvm::orc::createLocalIndirectStubsManagerBuilder(JTMB.getTargetTriple())();
+
+        // the counters of tier 0 call it
+        llvm::JITEvaluatedSymbol tierUpSymbol(llvm::pointerToJITTargetAddress(&TieredCompiler::tierUp), stubFlags);
+        if (auto Err = JD.define(llvm::orc::absoluteSymbols({{Mangle("kaleidoscope_tier_up"), tierUpSymbol}})))
+            return Err;
+
+        return std::make_unique<TieredCompiler>(ES, JD, Mangle, objectLayer, optimizedLayer, std::move(JTMB), std::move(*TM),
+                                                std::move(stubsManager), std::move(*callThrough), std::move(options));
+    }
+
+    TieredCompiler::TieredCompiler(llvm::orc::ExecutionSession &ES,
+                                   llvm::orc::JITDylib &JD,
+                                   llvm::orc::MangleAndInterner &Mangle,
+                                   llvm::orc::ObjectLayer &objectLayer,
+                                   llvm::orc::IRLayer &optimizedLayer,
+                                   llvm::orc::JITTargetMachineBuilder JTMB,
+                                   std::unique_ptr<llvm::TargetMachine> TM,
+                                   std::unique_ptr<llvm::orc::IndirectStubsManager> stubs,
+                                   std::unique_ptr<llvm::orc::LazyCallThroughManager> callThrough,
+                                   TieringOptions options)
+        : session_(ES), dylib_(JD), mangle_(Mangle),
+          // not CodeGenOpt::None: FastISel, which the code generator selects
+          // instructions with at that level, miscompiles the bitcast of a
+          // double to an i64 that arrays are converted with
+          unoptimizedLayer_(ES, objectLayer,
+                            std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(JTMB.setCodeGenOptLevel(llvm::CodeGenOpt::Less)))),
+          optimizedLayer_(optimizedLayer),
+          targetMachine_(std::move(TM)),
+          stubsManager_(std::move(stubs)),
+          callThrough_(std::move(callThrough)),
+          options_(std::move(options))
+    {
+        worker_ = std::thread([this]()
+                              { work(); });
+    }
+
+    llvm::Error TieredCompiler::takeCallFailures()
+    {
+        auto calls = failedCalls.exchange(0);
+        if (calls == 0)
+            return llvm::Error::success();
+
+        return llvm::make_error<llvm::StringError>(std::to_string(calls) + " call(s) of functions that failed to compile returned NaN",
+                                                   llvm::inconvertibleErrorCode());
+    }
+
+    TieredCompiler::~TieredCompiler()
+    {
+        {
+            std::lock_guard lock(queueMutex_);
+            stopping_ = true;
+        }
+
+        wakeUp_.notify_all();
+        worker_.join();
+    }
+
+    llvm::Error TieredCompiler::addModule(llvm::orc::ThreadSafeModule TSM)
+    {
+        auto &unit = *units_.emplace_back(std::make_unique<Unit>());
+        unit.compiler = this;
+        unit.number = static_cast<unsigned>(units_.size());
+
+        TSM.withModuleDo([&](llvm::Module &module)
+                         {
+            // Both tiers use the state of tier 0, e.g. the cache of a memo
+            // function, so it is visible under a name of its own.
+            for (auto &global : module.globals())
+            {
+                if (global.hasLocalLinkage() && !global.isConstant())
+                {
+                    global.setName(global.getName().str() + "." + std::to_string(unit.number));
+                    global.setLinkage(llvm::GlobalValue::ExternalLinkage);
+                }
+            }
+
+            llvm::raw_string_ostream out(unit.bitcode);
+            llvm::WriteBitcodeToFile(module, out);
+            out.flush();
+
+            instrument(module, unit); });
+
+        if (auto Err = unoptimizedLayer_.add(dylib_.getDefaultResourceTracker(), std::move(TSM)))
+            return Err;
+
+        // tier 0 is compiled when one of its functions is called first
+        for (auto const &name : unit.functions)
+        {
+            auto callThrough = callThrough_->getCallThroughTrampoline(dylib_, mangle_(tierName(name, 0, unit.number)),
+                                                                      [this, &unit, name](llvm::JITTargetAddress address)
+                                                                      { return setStub(name, unit, 0, address); });
+            if (!callThrough)
+                return callThrough.takeError();
+
+            if (auto Err = setStub(name, unit, -1, *callThrough))
+                return Err;
+        }
+
+        return llvm::Error::success();
+    }
+
+    void TieredCompiler::tierUp(Unit *unit)
+    {
+        // the first function of the unit to become hot queues it
+        if (unit->hot.exchange(true))
+        {
+            return;
+        }
+
+        auto &compiler = *unit->compiler;
+
+        {
+            std::lock_guard lock(compiler.queueMutex_);
+            compiler.queue_.push_back(unit);
+        }
+
+        compiler.wakeUp_.notify_one();
+    }
+
+    std::string TieredCompiler::tierName(std::string const &name, int tier, unsigned unit)
+    {
+        return name + ".t" + std::to_string(tier) + "." + std::to_string(unit);
+    }
+
+    void TieredCompiler::instrument(llvm::Module &module, Unit &unit)
+    {
+        llvm::IRBuilder<> builder(module.getContext());
+
+        auto tierUp = module.getOrInsertFunction("kaleidoscope_tier_up", builder.getVoidTy(), builder.getInt8PtrTy());
+        auto unitAddress = llvm::ConstantExpr::getIntToPtr(builder.getInt64(reinterpret_cast<std::uintptr_t>(&unit)), builder.getInt8PtrTy());
+        auto lastColdCall = builder.getInt64(std::max<std::uint64_t>(options_.hotCalls, 1) - 1);
+
+        std::vector<llvm::Function *> functions;
+        for (auto &function : module.functions())
+        {
+            if (!function.isDeclaration() && !function.hasLocalLinkage())
+            {
+                functions.push_back(&function);
+            }
+        }
+
+        for (auto function : functions)
+        {
+            auto name = function->getName().str();
+            unit.functions.push_back(name);
+
+            // calls, also those in the module, go through the stub to the current tier
+            function->setName(tierName(name, 0, unit.number));
+            auto stub = llvm::Function::Create(function->getFunctionType(), llvm::GlobalValue::ExternalLinkage, name, module);
+            stub->copyAttributesFrom(function);
+            function->replaceAllUsesWith(stub);
+
+            auto calls = new llvm::GlobalVariable(module, builder.getInt64Ty(), false, llvm::GlobalValue::InternalLinkage,
+                                                  builder.getInt64(0), name + ".calls");
+
+            // behind the allocas, which stay in the entry block
+            auto insertPoint = function->getEntryBlock().begin();
+            while (llvm::isa<llvm::AllocaInst>(*insertPoint))
+            {
+                ++insertPoint;
+            }
+
+            builder.SetInsertPoint(&*insertPoint);
+            auto previousCalls = builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, calls, builder.getInt64(1), llvm::MaybeAlign(8),
+                                                         llvm::AtomicOrdering::Monotonic);
+            auto isHot = builder.CreateICmpEQ(previousCalls, lastColdCall, "ishot");
+
+            builder.SetInsertPoint(llvm::SplitBlockAndInsertIfThen(isHot, &*insertPoint, false));
+            builder.CreateCall(tierUp, {unitAddress});
+        }
+    }
+
+    llvm::Error TieredCompiler::setStub(std::string const &name, Unit const &unit, int tier, llvm::JITTargetAddress address)
+    {
+        std::lock_guard lock(stubsMutex_);
+
+        auto stub = stubs_.find(name);
+        if (stub == stubs_.end())
+        {
+            if (auto Err = stubsManager_->createStub(name, address, stubFlags))
+                return Err;
+
+            stubs_.emplace(name, Stub{&unit, tier});
+            return dylib_.define(llvm::orc::absoluteSymbols({{mangle_(name), stubsManager_->findStub(name, true)}}));
+        }
+
+        // a new definition always replaces the current one, a tier only its own predecessors
+        if (tier >= 0 && (stub->second.unit != &unit || stub->second.tier >= tier))
+        {
+            return llvm::Error::success();
+        }
+
+        stub->second = Stub{&unit, tier};
+        return stubsManager_->updatePointer(name, address);
+    }
+
+    void TieredCompiler::work()
+    {
+        while (true)
+        {
+            Unit *unit = nullptr;
+
+            {
+                std::unique_lock lock(queueMutex_);
+                wakeUp_.wait(lock, [this]()
+                             { return stopping_ || !queue_.empty(); });
+
+                if (stopping_)
+                {
+                    return;
+                }
+
+                unit = queue_.front();
+                queue_.pop_front();
+            }
+
+            if (auto Err = compileTier1(*unit))
+            {
+                session_.reportError(std::move(Err));
+            }
+        }
+    }
+
+    llvm::Error TieredCompiler::compileTier1(Unit const &unit)
+    {
+        {
+            std::lock_guard lock(stubsMutex_);
+
+            bool isCurrent = std::any_of(unit.functions.begin(), unit.functions.end(), [this, &unit](std::string const &name)
+                                         { return stubs_.at(name).unit == &unit; });
+            if (!isCurrent)
+            {
+                return llvm::Error::success();
+            }
+        }
+
+        // a context of its own, the code generator uses the others meanwhile
+        auto context = std::make_unique<llvm::LLVMContext>();
+        auto module = llvm::parseBitcodeFile(llvm::MemoryBufferRef(unit.bitcode, tierName("module", 1, unit.number)), *context);
+        if (!module)
+            return module.takeError();
+
+        for (auto &global : (*module)->globals())
+        {
+            if (!global.isDeclaration() && !global.hasLocalLinkage() && !global.isConstant())
+            {
+                global.setInitializer(nullptr);
+            }
+        }
+
+        // calls within the module stay direct
+        for (auto const &name : unit.functions)
+        {
+            (*module)->getFunction(name)->setName(tierName(name, 1, unit.number));
+        }
+
+        if (options_.prepare)
+        {
+            options_.prepare(**module);
+        }
+
+        optimizeModule(**module, targetMachine_.get(), {}, options_.vectorLibrary);
+
+        if (auto Err = optimizedLayer_.add(dylib_.getDefaultResourceTracker(),
+                                           llvm::orc::ThreadSafeModule(std::move(*module), std::move(context))))
+            return Err;
+
+        for (auto const &name : unit.functions)
+        {
+            auto symbol = session_.lookup({&dylib_}, mangle_(tierName(name, 1, unit.number)));
+            if (!symbol)
+                return symbol.takeError();
+
+            if (auto Err = setStub(name, unit, 1, symbol->getAddress()))
+                return Err;
+        }
+
+        return llvm::Error::success();
+    }
+}
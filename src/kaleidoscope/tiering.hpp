@@ -0,0 +1,143 @@
+#ifndef INCLUDED_KALEIDOSCOPE_TIERING_HPP
+#define INCLUDED_KALEIDOSCOPE_TIERING_HPP
+
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include <llvm/ExecutionEngine/Orc/IRCompileLayer.h>
+#include <llvm/ExecutionEngine/Orc/IndirectionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LazyReexports.h>
+#include <llvm/ExecutionEngine/Orc/Mangling.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Analysis/TargetLibraryInfo.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace kaleidoscope
+{
+    struct TieringOptions
+    {
+        /// calls of a function after which its module is recompiled with optimisation
+        std::uint64_t hotCalls = 1000;
+        /// runs on the tier-up thread before a module is optimised, e.g. to
+        /// import the definitions of its callees
+        std::function<void(llvm::Module &)> prepare;
+        /// the vector library tier 1 may call, set by KaleidoscopeJIT::enableTiering()
+        llvm::TargetLibraryInfoImpl::VectorLibrary vectorLibrary = llvm::TargetLibraryInfoImpl::NoLibrary;
+    };
+
+    /// TieredCompiler - compiles the functions of a module in two tiers.
+    /// Callers reach a function through an indirect stub named like it. Tier
+    /// 0 is the module as generated, compiled with little optimisation (see
+    /// the constructor) on its first call, and counts the calls of its functions.
+    /// When one of them has been called hotCalls times, the module is
+    /// optimised and compiled again on a background thread, and the stubs
+    /// are repointed to tier 1. A function running in tier 0 stays there
+    /// until it returns. Redefining a function repoints its stub to the new
+    /// definition; the code of replaced definitions is kept.
+    class TieredCompiler
+    {
+    public:
+        /// optimizedLayer compiles tier 1 with optimisation
+        static llvm::Expected<std::unique_ptr<TieredCompiler>> Create(llvm::orc::ExecutionSession &ES,
+                                                                      llvm::orc::JITDylib &JD,
+                                                                      llvm::orc::MangleAndInterner &Mangle,
+                                                                      llvm::orc::ObjectLayer &objectLayer,
+                                                                      llvm::orc::IRLayer &optimizedLayer,
+                                                                      llvm::orc::JITTargetMachineBuilder JTMB,
+                                                                      TieringOptions options);
+
+        TieredCompiler(llvm::orc::ExecutionSession &ES,
+                       llvm::orc::JITDylib &JD,
+                       llvm::orc::MangleAndInterner &Mangle,
+                       llvm::orc::ObjectLayer &objectLayer,
+                       llvm::orc::IRLayer &optimizedLayer,
+                       llvm::orc::JITTargetMachineBuilder JTMB,
+                       std::unique_ptr<llvm::TargetMachine> TM,
+                       std::unique_ptr<llvm::orc::IndirectStubsManager> stubs,
+                       std::unique_ptr<llvm::orc::LazyCallThroughManager> callThrough,
+                       TieringOptions options);
+
+        /// stops the tier-up thread; compiles not started yet are dropped
+        ~TieredCompiler();
+
+        TieredCompiler(TieredCompiler const &) = delete;
+        TieredCompiler &operator=(TieredCompiler const &) = delete;
+
+        /// adds the externally visible functions defined in module behind
+        /// their stubs, replacing earlier definitions of the same names
+        llvm::Error addModule(llvm::orc::ThreadSafeModule TSM);
+
+        /// An error if functions whose tier 0 failed to compile have been
+        /// called, by the code of any TieredCompiler, since the last call.
+        /// Such a call returns NaN to the generated code, which cannot handle
+        /// an error; the frontend decides what to make of the result.
+        static llvm::Error takeCallFailures();
+
+    private:
+        /// a module handed to addModule
+        struct Unit
+        {
+            TieredCompiler *compiler;
+            unsigned number;
+            std::vector<std::string> functions;
+            /// the module as generated, for the tier 1 compile
+            std::string bitcode;
+            std::atomic<bool> hot = false;
+        };
+
+        struct Stub
+        {
+            /// the unit the current definition belongs to
+            Unit const *unit;
+            /// the tier the stub points to, -1 for the call-through to tier 0
+            int tier;
+        };
+
+        static void tierUp(Unit *unit);
+
+        static std::string tierName(std::string const &name, int tier, unsigned unit);
+
+        void instrument(llvm::Module &module, Unit &unit);
+        llvm::Error setStub(std::string const &name, Unit const &unit, int tier, llvm::JITTargetAddress address);
+
+        void work();
+        llvm::Error compileTier1(Unit const &unit);
+
+        llvm::orc::ExecutionSession &session_;
+        llvm::orc::JITDylib &dylib_;
+        llvm::orc::MangleAndInterner &mangle_;
+        llvm::orc::IRCompileLayer unoptimizedLayer_;
+        llvm::orc::IRLayer &optimizedLayer_;
+        /// for the optimisation on the tier-up thread
+        std::unique_ptr<llvm::TargetMachine> targetMachine_;
+        std::unique_ptr<llvm::orc::IndirectStubsManager> stubsManager_;
+        std::unique_ptr<llvm::orc::LazyCallThroughManager> callThrough_;
+        TieringOptions options_;
+
+        std::vector<std::unique_ptr<Unit>> units_;
+
+        std::mutex stubsMutex_;
+        std::unordered_map<std::string, Stub> stubs_;
+
+        std::mutex queueMutex_;
+        std::condition_variable wakeUp_;
+        std::deque<Unit *> queue_;
+        bool stopping_ = false;
+        std::thread worker_;
+    };
+}
+
+#endif
@@ -1,9 +1,10 @@
 #ifndef INCLUDED_KALEIDOSCOPE_TOKEN_HPP
 #define INCLUDED_KALEIDOSCOPE_TOKEN_HPP
 
+#include "interner.hpp"
+
 #include <cassert>
 #include <limits>
-#include <string>
 
 namespace kaleidoscope
 {
@@ -20,13 +21,19 @@ namespace kaleidoscope
         tok_char
     };
 
+    /// Character values of the operators '&&' and '||', the only ones spelled
+    /// with two characters. They lie outside the printable range, so they never
+    /// clash with user-defined operators.
+    inline constexpr char op_and = '\x01';
+    inline constexpr char op_or = '\x02';
+
     class Token
     {
     public:
         Token(TokenType const &type) : type_(type) { assert(type < 0); }
         Token(char charValue) : type_(tok_char), charValue_(charValue) {}
         Token(double numValue) : type_(tok_number), numValue_(numValue) {}
-        Token(std::string identifier)
+        Token(Symbol identifier)
             : type_(tok_identifier), identifier_(identifier) {}
 
         TokenType getType() const noexcept { return type_; }
@@ -43,7 +50,7 @@ namespace kaleidoscope
             return numValue_;
         }
 
-        std::string const &getIdentifierValue() const
+        Symbol getIdentifierValue() const
         {
             assert(type_ == tok_identifier);
             return identifier_;
@@ -78,7 +85,7 @@ namespace kaleidoscope
         TokenType type_;
         char charValue_ = '\0';
         double numValue_ = std::numeric_limits<double>::quiet_NaN();
-        std::string identifier_;
+        Symbol identifier_;
     };
 } // namespace kaleidoscope
 
@@ -0,0 +1,396 @@
+#include "typeinference.hpp"
+
+#include "arrays.hpp"
+#include "token.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <string>
+#include <utility>
+
+namespace kaleidoscope
+{
+    bool isExactInteger(double v)
+    {
+        return std::trunc(v) == v && std::abs(v) <= 0x1p53 && !(v == 0.0 && std::signbit(v));
+    }
+
+    namespace
+    {
+        /// Walks the body with an explicit task stack, like CodeGenerator, so
+        /// that variables can be resolved in the same scopes as in codegen.
+        class TypeInference
+        {
+        public:
+            TypeInference(ASTArena const &arena, PrototypeLookup const &getPrototype)
+                : arena_(arena),
+                  getPrototype_(getPrototype),
+                  firstIndex_(arena.size())
+            {
+                info_.expressions.resize(arena.size());
+                info_.loopVariables.resize(arena.size());
+
+                // children are stored before their parents, so the nodes of the
+                // subtree of i lie in [firstIndex_[i], i]
+                for (std::uint32_t i = 0; i < arena.size(); ++i)
+                {
+                    firstIndex_[i] = i;
+                    arena.forEachChild(arena[ExprRef(i)], [this, i](ExprRef child)
+                                       { firstIndex_[i] = std::min(firstIndex_[i], firstIndex_[child.index()]); });
+                }
+            }
+
+            TypeInfo operator()(FunctionAST const &function)
+            {
+                auto const &proto = function.getProto();
+                for (std::size_t i = 0; i < proto.getArgs().size(); ++i)
+                {
+                    scope_.emplace_back(proto.getArgs()[i], proto.isArrayArg(i) ? ValueType::Array : ValueType::Float);
+                }
+
+                descend(function.getBody());
+
+                while (!tasks_.empty())
+                {
+                    auto &task = tasks_.back();
+                    bool finished = std::visit([this, &task](auto const &node)
+                                               { return step(node, task); },
+                                               arena_[task.expr]);
+
+                    if (finished)
+                    {
+                        tasks_.pop_back();
+                    }
+                }
+
+                return std::move(info_);
+            }
+
+        private:
+            struct Task
+            {
+                explicit Task(ExprRef expr) : expr(expr) {}
+
+                ExprRef expr;
+                std::size_t stage = 0;
+            };
+
+            bool descend(ExprRef child)
+            {
+                tasks_.emplace_back(child);
+                return false;
+            }
+
+            bool finish(Task const &task, ValueType type)
+            {
+                info_.expressions[task.expr.index()] = type;
+                return true;
+            }
+
+            ValueType typeOf(ExprRef expr) const
+            {
+                return info_.getType(expr);
+            }
+
+            ValueType lookup(Symbol name) const
+            {
+                auto binding = std::find_if(scope_.rbegin(), scope_.rend(), [name](auto const &entry)
+                                            { return entry.first == name; });
+
+                return binding != scope_.rend() ? binding->second : ValueType::Float;
+            }
+
+            /// the type of the result of a call of callee
+            ValueType resultOf(Symbol callee) const
+            {
+                auto proto = getPrototype_(callee);
+                return proto != nullptr && proto->returnsArray() ? ValueType::Array : ValueType::Float;
+            }
+
+            /// some '=' in the subtree of expr, other than expr itself, assigns to name
+            bool isAssigned(Symbol name, ExprRef expr) const
+            {
+                for (auto i = firstIndex_[expr.index()]; i < expr.index(); ++i)
+                {
+                    auto binary = std::get_if<BinaryExprAST>(&arena_[ExprRef(i)]);
+
+                    if (binary != nullptr && binary->getOp() == '=')
+                    {
+                        auto target = std::get_if<VariableExprAST>(&arena_[binary->getLHS()]);
+
+                        if (target != nullptr && target->getName() == name)
+                        {
+                            return true;
+                        }
+                    }
+                }
+
+                return false;
+            }
+
+            bool step(NumberExprAST const &expr, Task &task)
+            {
+                return finish(task, isExactInteger(expr.getVal()) ? ValueType::Int : ValueType::Float);
+            }
+
+            bool step(VariableExprAST const &expr, Task &task)
+            {
+                return finish(task, lookup(expr.getName()));
+            }
+
+            bool step(UnaryExprAST const &expr, Task &task)
+            {
+                if (task.stage++ == 0)
+                {
+                    return descend(expr.getOperand());
+                }
+
+                return finish(task, expr.getOp() == '!' ? ValueType::Bool : resultOf(Symbol(std::string("unary") + expr.getOp())));
+            }
+
+            bool step(BinaryExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getLHS());
+                case 1:
+                    return descend(expr.getRHS());
+                default:
+                    break;
+                }
+
+                // an assignment has the type of the variable, which may be an array
+                if (auto target = std::get_if<VariableExprAST>(&arena_[expr.getLHS()]); target != nullptr && expr.getOp() == '=')
+                {
+                    return finish(task, lookup(target->getName()));
+                }
+
+                switch (expr.getOp())
+                {
+                case '<':
+                case op_and:
+                case op_or:
+                    return finish(task, ValueType::Bool);
+                case '=':
+                case '+':
+                case '-':
+                case '*':
+                case '/':
+                    return finish(task, ValueType::Float);
+                default:
+                    return finish(task, resultOf(Symbol(std::string("binary") + expr.getOp())));
+                }
+            }
+
+            bool step(CallExprAST const &expr, Task &task)
+            {
+                auto args = arena_.getArgs(expr);
+
+                if (task.stage < args.size())
+                {
+                    return descend(args[task.stage++]);
+                }
+
+                auto callee = expr.getCallee().str();
+
+                if (callee == lengthBuiltin)
+                {
+                    return finish(task, ValueType::Int);
+                }
+
+                return finish(task, callee == arrayBuiltin ? ValueType::Array : resultOf(expr.getCallee()));
+            }
+
+            bool step(IndexExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getArray());
+                case 1:
+                    return descend(expr.getIndex());
+                default:
+                    break;
+                }
+
+                return finish(task, ValueType::Float);
+            }
+
+            bool step(IfExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getCondition());
+                case 1:
+                    return descend(expr.getThenBranch());
+                case 2:
+                    return descend(expr.getElseBranch());
+                default:
+                    break;
+                }
+
+                auto thenType = typeOf(expr.getThenBranch());
+
+                return finish(task, thenType == typeOf(expr.getElseBranch()) ? thenType : ValueType::Float);
+            }
+
+            bool step(ForExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getStart());
+                case 1:
+                {
+                    auto stepNumber = std::get_if<NumberExprAST>(arena_.tryGet(expr.getStep()));
+                    bool integralStep = !expr.getStep().isValid() || (stepNumber != nullptr && isExactInteger(stepNumber->getVal()));
+
+                    auto type = typeOf(expr.getStart()) == ValueType::Int && integralStep && !isAssigned(expr.getVarName(), task.expr)
+                                    ? ValueType::Int
+                                    : ValueType::Float;
+
+                    info_.loopVariables[task.expr.index()] = type;
+                    scope_.emplace_back(expr.getVarName(), type);
+
+                    return descend(expr.getEnd());
+                }
+                case 2:
+                    if (expr.getStep().isValid())
+                    {
+                        return descend(expr.getStep());
+                    }
+
+                    ++task.stage;
+                    [[fallthrough]];
+                case 3:
+                    return descend(expr.getBody());
+                default:
+                    break;
+                }
+
+                scope_.pop_back();
+
+                // the value of a loop is always 0.0
+                return finish(task, ValueType::Float);
+            }
+
+            bool step(ParForExprAST const &expr, Task &task)
+            {
+                return stepCountedLoop(expr, task);
+            }
+
+            /// the value of a reduction is a Float, like those of loops
+            bool step(ReductionExprAST const &expr, Task &task)
+            {
+                return stepCountedLoop(expr, task);
+            }
+
+            /// parfor and reductions
+            bool stepCountedLoop(ForExprAST const &expr, Task &task)
+            {
+                switch (task.stage++)
+                {
+                case 0:
+                    return descend(expr.getStart());
+                case 1:
+                    return descend(expr.getEnd());
+                case 2:
+                    if (expr.getStep().isValid())
+                    {
+                        return descend(expr.getStep());
+                    }
+
+                    ++task.stage;
+                    [[fallthrough]];
+                case 3:
+                {
+                    // start, end and step are evaluated outside the scope of the loop variable
+                    auto stepNumber = std::get_if<NumberExprAST>(arena_.tryGet(expr.getStep()));
+                    bool integralStep = !expr.getStep().isValid() || (stepNumber != nullptr && isExactInteger(stepNumber->getVal()));
+
+                    auto type = typeOf(expr.getStart()) == ValueType::Int && integralStep && !isAssigned(expr.getVarName(), task.expr)
+                                    ? ValueType::Int
+                                    : ValueType::Float;
+
+                    info_.loopVariables[task.expr.index()] = type;
+                    scope_.emplace_back(expr.getVarName(), type);
+
+                    return descend(expr.getBody());
+                }
+                default:
+                    break;
+                }
+
+                scope_.pop_back();
+
+                return finish(task, ValueType::Float);
+            }
+
+            bool step(VarExprAST const &expr, Task &task)
+            {
+                auto declarations = arena_.getDeclarations(expr);
+
+                // declares the variable of declaration index once its initialiser has a type
+                auto bind = [&](std::size_t index)
+                {
+                    auto const &decl = declarations[index];
+                    auto initType = decl.getInitVal().isValid() ? typeOf(decl.getInitVal()) : ValueType::Float;
+                    // only arrays can be assigned to an array
+                    auto type = initType == ValueType::Array || !isAssigned(decl.getName(), task.expr) ? initType : ValueType::Float;
+
+                    auto slot = expr.getDeclarations().first + index;
+                    if (slot >= info_.declarations.size())
+                    {
+                        info_.declarations.resize(slot + 1);
+                    }
+
+                    info_.declarations[slot] = type;
+                    scope_.emplace_back(decl.getName(), type);
+                };
+
+                if (task.stage > 0 && task.stage <= declarations.size())
+                {
+                    bind(task.stage - 1);
+                }
+
+                while (task.stage < declarations.size())
+                {
+                    auto initVal = declarations[task.stage++].getInitVal();
+
+                    if (initVal.isValid())
+                    {
+                        return descend(initVal);
+                    }
+
+                    bind(task.stage - 1);
+                }
+
+                if (task.stage++ == declarations.size())
+                {
+                    return descend(expr.getBody());
+                }
+
+                scope_.resize(scope_.size() - declarations.size());
+
+                return finish(task, typeOf(expr.getBody()));
+            }
+
+            ASTArena const &arena_;
+            PrototypeLookup const &getPrototype_;
+            std::vector<std::uint32_t> firstIndex_;
+
+            std::deque<Task> tasks_;
+            std::vector<std::pair<Symbol, ValueType>> scope_;
+
+            TypeInfo info_;
+        };
+    }
+
+    TypeInfo inferTypes(FunctionAST const &function, PrototypeLookup const &getPrototype)
+    {
+        return TypeInference(function.getArena(), getPrototype)(function);
+    }
+}
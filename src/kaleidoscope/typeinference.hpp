@@ -0,0 +1,66 @@
+#ifndef INCLUDED_KALEIDOSCOPE_TYPEINFERENCE_HPP
+#define INCLUDED_KALEIDOSCOPE_TYPEINFERENCE_HPP
+
+#include "ast.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace kaleidoscope
+{
+    /// ValueType - representation of a value in the generated IR. A value of
+    /// the language is a number or an array. A number is a floating point
+    /// number of the function's precision; Int (i64) and Bool (i1) are only
+    /// used where the value is known to convert to the same number. An Array
+    /// (double*) converts to no number, so arrays and numbers cannot be mixed.
+    enum class ValueType : std::uint8_t
+    {
+        Float,
+        Int,
+        Bool,
+        Array
+    };
+
+    /// TypeInfo - the types inferred for one function body.
+    struct TypeInfo
+    {
+        ValueType getType(ExprRef expr) const { return expressions[expr.index()]; }
+        /// type of the variable of the for loop forExpr
+        ValueType getLoopVariableType(ExprRef forExpr) const { return loopVariables[forExpr.index()]; }
+        /// type of the variable bound by declaration number index of var
+        ValueType getDeclarationType(VarExprAST const &var, std::size_t index) const { return declarations[var.getDeclarations().first + index]; }
+
+        // indexed by ExprRef
+        std::vector<ValueType> expressions;
+        std::vector<ValueType> loopVariables;
+        // indexed like the declaration storage of the arena
+        std::vector<ValueType> declarations;
+    };
+
+    /// v converts to an i64 and back without change (-0 does not)
+    bool isExactInteger(double v);
+
+    /// the prototype of a function, nullptr if it is not known
+    using PrototypeLookup = std::function<PrototypeAST const *(Symbol name)>;
+
+    /// Infers the types of the nodes of function's body:
+    ///  - '<', '&&', '||' and '!' are Bools,
+    ///  - integral constants up to 2^53 and array lengths are Ints,
+    ///  - the results of array(n), arguments declared with [] and the results
+    ///    of functions and operators declared with [] are Arrays,
+    ///  - the variable of a for, parfor or reduction is an Int if its start value
+    ///    is one, its step is omitted or an integral constant and it is never
+    ///    assigned to,
+    ///  - a var binding has the type of its initialiser if it is an Array or
+    ///    the variable is never assigned to,
+    ///  - an assignment to a variable has the type of the variable,
+    ///  - an if has the type of its branches if they agree,
+    /// everything else, including arithmetic, elements, other arguments and
+    /// call results, is a Float.
+    /// An Int loop variable counts exactly in a float32 function too, beyond
+    /// the 2^24 where a float counter would stop growing.
+    TypeInfo inferTypes(FunctionAST const &function, PrototypeLookup const &getPrototype);
+} // namespace kaleidoscope
+
+#endif